@@ -0,0 +1,222 @@
+#include "simulation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#define LAYERS 20
+#define REPEATS 5
+#define GROVER_ITERATIONS 4
+
+/**
+ * @brief Returns the time of a monotonic clock.
+ * @return The time in seconds
+ */
+double get_time()
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec + time.tv_nsec*1e-9;
+}
+
+/**
+ * @brief Builds a circuit of layers of Hadamard, phase and CNOT gates.
+ * @param qubits The number of qubits in the circuit
+ * @return The list of gates in the circuit
+ */
+OperationList *build_circuit(int qubits)
+{
+    OperationList *list = initialise_operation_list();
+    double phase[8] = {1, 0, 0, 0, 0, 0, cos(0.1), sin(0.1)};
+
+    for(int layer=0; layer<LAYERS; layer++)
+        for(int i=0; i<qubits; i++) {
+            append_gate(i, hadamard, list);
+            append_controlled_gate((i+1) % qubits, i, phase, list);
+            append_controlled_gate((i+layer+1) % qubits, i, x, list);
+        }
+
+    return list;
+}
+
+/**
+ * @brief Times applying a circuit one gate at a time or as one list.
+ * The circuit is followed by a measurement so queued kernels are included.
+ * @param qubits The number of qubits in the circuit
+ * @param batched Applies the circuit with apply_operation_list() if true and
+ * one apply_operation() call per gate otherwise
+ * @return The fastest of REPEATS runs in seconds
+ */
+double time_circuit(int qubits, bool batched)
+{
+    OperationList *list = build_circuit(qubits);
+    Simulation *simulation = set_up_simulation();
+    double best = INFINITY, start;
+
+    initialise_qubits(qubits, simulation);
+
+    for(int r=0; r<REPEATS; r++) {
+        start = get_time();
+        if(batched)
+            apply_operation_list(list, simulation);
+        else
+            for(int i=0; i<list->num_operations; i++)
+                apply_operation(&list->operations[i], simulation);
+        measure(simulation);
+        best = fmin(best, get_time() - start);
+    }
+
+    deallocate_resources(simulation);
+    free_operation_list(list);
+
+    return best;
+}
+
+/**
+ * @brief Applies Grover iterations searching for the last state the way
+ * grover.c does, one apply call per gate.
+ * @param qubits The number of qubits to search over
+ * @param simulation The simulation on which to apply the gates
+ */
+void apply_grover(int qubits, Simulation *simulation)
+{
+    const size_t control_mask = ((size_t) 1 << (qubits-1)) - 1;
+
+    for(int i=0; i<qubits; i++)
+        apply_gate(i, hadamard, simulation);
+
+    for(int iteration=0; iteration<GROVER_ITERATIONS; iteration++) {
+        // The oracle marks the all ones state, the diffuser reflects about
+        // the uniform superposition
+        for(int step=0; step<2; step++) {
+            if(step == 1)
+                for(int i=0; i<qubits; i++) {
+                    apply_gate(i, hadamard, simulation);
+                    apply_gate(i, x, simulation);
+                }
+
+            apply_gate(qubits-1, hadamard, simulation);
+            apply_multi_controlled_gate(qubits-1, control_mask, x, simulation);
+            apply_gate(qubits-1, hadamard, simulation);
+
+            if(step == 1)
+                for(int i=0; i<qubits; i++) {
+                    apply_gate(i, x, simulation);
+                    apply_gate(i, hadamard, simulation);
+                }
+        }
+    }
+}
+
+/**
+ * @brief Times Grover's algorithm applied eagerly or deferred.
+ * Deferred gates are queued and applied as one list by measure().
+ * @param qubits The number of qubits to search over
+ * @param deferred Applies the gates on a deferred simulation if true
+ * @return The fastest of REPEATS runs in seconds
+ */
+double time_grover(int qubits, bool deferred)
+{
+    SimulationOptions options = default_simulation_options();
+    Simulation *simulation;
+    double best = INFINITY, start;
+
+    options.deferred = deferred;
+
+    for(int r=0; r<REPEATS; r++) {
+        simulation = set_up_simulation_with_options(&options);
+        initialise_qubits(qubits, simulation);
+
+        start = get_time();
+        apply_grover(qubits, simulation);
+        measure(simulation);
+        best = fmin(best, get_time() - start);
+
+        deallocate_resources(simulation);
+    }
+
+    return best;
+}
+
+#ifdef OPENCL
+/**
+ * @brief Times a circuit applied as a list on OpenCL with or without the
+ * gate list kernel, which runs the whole list in one launch on one work group.
+ * @param qubits The number of qubits in the circuit
+ * @param gate_list Applies the list with the gate list kernel if true, and
+ * with tiles and one launch per other gate otherwise
+ * @return The fastest of REPEATS runs in seconds, or -1 without an OpenCL
+ * device
+ */
+double time_gate_list(int qubits, bool gate_list)
+{
+    OperationList *list = build_circuit(qubits);
+    SimulationOptions options = default_simulation_options();
+    Simulation *simulation;
+    double best = INFINITY, start;
+
+    options.gate_list_qubits = gate_list ? qubits : 0;
+    simulation = set_up_simulation_with_options(&options);
+
+    if(simulation->backend != BACKEND_OPENCL)
+        best = -1;
+
+    initialise_qubits(qubits, simulation);
+
+    for(int r=0; r<REPEATS && best >= 0; r++) {
+        start = get_time();
+        apply_operation_list(list, simulation);
+        measure(simulation);
+        best = fmin(best, get_time() - start);
+    }
+
+    deallocate_resources(simulation);
+    free_operation_list(list);
+
+    return best;
+}
+#endif
+
+int main()
+{
+    const int sizes[] = {8, 12, 16, 20};
+    double per_gate, batched;
+
+    printf("qubits  gates  per gate (ms)  batched (ms)  speedup\n");
+
+    for(int i=0; i<(int) (sizeof(sizes)/sizeof(sizes[0])); i++) {
+        per_gate = time_circuit(sizes[i], false);
+        batched = time_circuit(sizes[i], true);
+        printf("%6d  %5d  %13.3f  %12.3f  %7.2f\n", sizes[i], 3*LAYERS*sizes[i],
+            per_gate*1e3, batched*1e3, per_gate/batched);
+    }
+
+    printf("\nqubits  grover eager (ms)  deferred (ms)  speedup\n");
+
+    for(int i=0; i<(int) (sizeof(sizes)/sizeof(sizes[0])); i++) {
+        per_gate = time_grover(sizes[i], false);
+        batched = time_grover(sizes[i], true);
+        printf("%6d  %17.3f  %13.3f  %7.2f\n", sizes[i], per_gate*1e3, batched*1e3,
+            per_gate/batched);
+    }
+
+#ifdef OPENCL
+    const int list_sizes[] = {8, 10, 12, 14, 16, 18, 20};
+
+    if(time_gate_list(list_sizes[0], false) >= 0) {
+        printf("\nqubits  opencl launches (ms)  gate list (ms)  speedup\n");
+
+        for(int i=0; i<(int) (sizeof(list_sizes)/sizeof(list_sizes[0])); i++) {
+            per_gate = time_gate_list(list_sizes[i], false);
+            batched = time_gate_list(list_sizes[i], true);
+            printf("%6d  %20.3f  %14.3f  %7.2f\n", list_sizes[i], per_gate*1e3,
+                batched*1e3, per_gate/batched);
+        }
+    }
+#endif
+
+    return 0;
+}
@@ -0,0 +1,1468 @@
+#define _POSIX_C_SOURCE 200809L
+#define AMPLITUDE_ALIGNMENT 64
+#define DEFAULT_L2_CACHE_SIZE (256*1024)
+#define MIN_BLOCK_QUBITS 5
+#define REDUCE_BLOCK_QUBITS 8
+#define MAX_HISTOGRAM_QUBITS 12
+
+#include "cpu_backend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The amplitudes of a task are floats or doubles depending on its
+ * precision, and every task picks the kernel for that precision.
+ */
+
+typedef struct GateTask
+{
+    void *real;
+    void *imag;
+    Precision precision;
+    SimdLevel simd_level;
+    size_t block_size;
+    int target;
+    size_t control_mask;
+    double gate[8];
+} GateTask;
+
+typedef struct DenseTask
+{
+    void *real;
+    void *imag;
+    Precision precision;
+    int num_qubits;
+    int qubits[MAX_FUSED_QUBITS];
+    double matrix_re[1 << (2*MAX_FUSED_QUBITS)];
+    double matrix_im[1 << (2*MAX_FUSED_QUBITS)];
+} DenseTask;
+
+/** An operation with its dense matrix split into real and imaginary parts */
+typedef struct PreparedOperation
+{
+    OperationType type;
+    GateClass gate_class;
+    int target;
+    size_t control_mask;
+    double gate[8];
+    int num_qubits;
+    int qubits[MAX_FUSED_QUBITS];
+    double *matrix_re;
+    double *matrix_im;
+} PreparedOperation;
+
+typedef struct BlockTask
+{
+    void *real;
+    void *imag;
+    Precision precision;
+    SimdLevel simd_level;
+    size_t block_size;
+    int num_operations;
+    PreparedOperation *operations;
+} BlockTask;
+
+typedef struct StateTask
+{
+    void *real;
+    void *imag;
+    Precision precision;
+    double *output;
+} StateTask;
+
+/** A state and one of the most probable states found in it */
+typedef struct RankedState
+{
+    double probability;
+    size_t index;
+} RankedState;
+
+/**
+ * A reduction over the probabilities of the state. Each thread sums its share
+ * into private storage and adds it to the shared result under the lock.
+ */
+typedef struct ReductionTask
+{
+    void *real;
+    void *imag;
+    Precision precision;
+    size_t num_amp;
+    size_t block_size;
+    int num_qubits;
+    size_t qubit_mask;
+    int register_qubits;
+    size_t slice_mask;
+    double *sums;
+    size_t k;
+    size_t num_ranked;
+    RankedState *ranked;
+    size_t *indices;
+    const double *residuals;
+    size_t x_mask;
+    const size_t *z_masks;
+    size_t num_terms;
+    pthread_mutex_t lock;
+} ReductionTask;
+
+/*
+ * The time in nanoseconds per amplitude of each kernel on a cached block of a
+ * 20 qubit state. Single precision gates without controls run on the SIMD
+ * kernels, every other kernel is scalar.
+ */
+static const FusionCosts single_fusion_costs = {
+    {0.35, 0, 3.0, 2.1},
+    {3.7, 0, 2.0, 1.7},
+    {0, 0, 13, 21, 38, 60}
+};
+static const FusionCosts double_fusion_costs = {
+    {3.6, 0, 2.1, 1.5},
+    {2.4, 0, 1.2, 1.0},
+    {0, 0, 11, 16, 33, 70}
+};
+
+/**
+ * @brief Returns the number of amplitude pairs whose controls are all set.
+ * @param num_amp The number of amplitudes in the state or block
+ * @param control_mask A mask of the control qubits
+ * @return The size of the control subspace in amplitude pairs
+ */
+static size_t get_num_pairs(size_t num_amp, size_t control_mask)
+{
+    size_t num_pairs = num_amp/2;
+
+    for(; control_mask; control_mask &= control_mask-1)
+        num_pairs /= 2;
+
+    return num_pairs;
+}
+
+/**
+ * @brief Applies a gate to the amplitude pairs in the range [start, end).
+ * The range is widened to whole SIMD blocks, which keeps neighbouring
+ * threads' ranges disjoint as they round their bounds the same way.
+ * @param start The first amplitude pair to update
+ * @param end One past the last amplitude pair to update
+ * @param data The GateTask describing the gate
+ */
+static void apply_gate_task(size_t start, size_t end, void *data)
+{
+    GateTask *task = (GateTask *) data;
+    const size_t block = task->block_size;
+
+    start = (start + block - 1)/block*block;
+    end = (end + block - 1)/block*block;
+
+    if(start >= end)
+        return;
+
+    if(task->precision == PRECISION_DOUBLE)
+        apply_gate_kernel_double(task->real, task->imag, start, end, task->target,
+            task->gate);
+    else
+        apply_gate_kernel(task->simd_level, task->real, task->imag, start, end,
+            task->target, task->gate);
+}
+
+/**
+ * @brief Applies a controlled gate to the pairs in [start, end) of the
+ * control subspace.
+ * @param start The first pair of the control subspace to update
+ * @param end One past the last pair of the control subspace to update
+ * @param data The GateTask describing the gate
+ */
+static void apply_controlled_gate_task(size_t start, size_t end, void *data)
+{
+    GateTask *task = (GateTask *) data;
+
+    if(task->precision == PRECISION_DOUBLE)
+        apply_controlled_gate_kernel_double(task->real, task->imag, start, end,
+            task->target, task->control_mask, task->gate);
+    else
+        apply_controlled_gate_kernel(task->real, task->imag, start, end, task->target,
+            task->control_mask, task->gate);
+}
+
+/**
+ * @brief Applies a diagonal gate to the pairs in [start, end) of the
+ * control subspace.
+ * @param start The first pair of the control subspace to update
+ * @param end One past the last pair of the control subspace to update
+ * @param data The GateTask describing the gate
+ */
+static void apply_diagonal_gate_task(size_t start, size_t end, void *data)
+{
+    GateTask *task = (GateTask *) data;
+
+    if(task->precision == PRECISION_DOUBLE)
+        apply_diagonal_gate_kernel_double(task->real, task->imag, start, end,
+            task->target, task->control_mask, task->gate);
+    else
+        apply_diagonal_gate_kernel(task->real, task->imag, start, end, task->target,
+            task->control_mask, task->gate);
+}
+
+/**
+ * @brief Applies an X gate to the pairs in [start, end) of the control
+ * subspace.
+ * @param start The first pair of the control subspace to update
+ * @param end One past the last pair of the control subspace to update
+ * @param data The GateTask describing the gate
+ */
+static void apply_permutation_gate_task(size_t start, size_t end, void *data)
+{
+    GateTask *task = (GateTask *) data;
+
+    if(task->precision == PRECISION_DOUBLE)
+        apply_permutation_gate_kernel_double(task->real, task->imag, start, end,
+            task->target, task->control_mask);
+    else
+        apply_permutation_gate_kernel(task->real, task->imag, start, end, task->target,
+            task->control_mask);
+}
+
+/**
+ * @brief Applies a dense unitary to the amplitude groups in [start, end).
+ * @param start The first amplitude group to update
+ * @param end One past the last amplitude group to update
+ * @param data The DenseTask describing the unitary
+ */
+static void apply_dense_gate_task(size_t start, size_t end, void *data)
+{
+    DenseTask *task = (DenseTask *) data;
+
+    if(task->precision == PRECISION_DOUBLE)
+        apply_dense_gate_kernel_double(task->real, task->imag, start, end,
+            task->num_qubits, task->qubits, task->matrix_re, task->matrix_im);
+    else
+        apply_dense_gate_kernel(task->real, task->imag, start, end, task->num_qubits,
+            task->qubits, task->matrix_re, task->matrix_im);
+}
+
+/**
+ * @brief Applies a prepared operation to the amplitudes of one block.
+ * @param operation The operation to apply, acting only on qubits in the block
+ * @param real The real parts of the block's amplitudes
+ * @param imag The imaginary parts of the block's amplitudes
+ * @param block_size The number of amplitudes in the block
+ * @param task The BlockTask giving the precision and SIMD level
+ */
+static void apply_to_block(PreparedOperation *operation, void *real, void *imag,
+    size_t block_size, BlockTask *task)
+{
+    const size_t num_pairs = get_num_pairs(block_size, operation->control_mask);
+
+    if(operation->type == GATE_OPERATION && operation->gate_class == GATE_IDENTITY)
+        return;
+
+    if(operation->type == GATE_OPERATION && operation->gate_class == GATE_DIAGONAL) {
+        if(task->precision == PRECISION_DOUBLE)
+            apply_diagonal_gate_kernel_double(real, imag, 0, num_pairs, operation->target,
+                operation->control_mask, operation->gate);
+        else
+            apply_diagonal_gate_kernel(real, imag, 0, num_pairs, operation->target,
+                operation->control_mask, operation->gate);
+        return;
+    }
+
+    if(operation->type == GATE_OPERATION && operation->gate_class == GATE_PERMUTATION) {
+        if(task->precision == PRECISION_DOUBLE)
+            apply_permutation_gate_kernel_double(real, imag, 0, num_pairs,
+                operation->target, operation->control_mask);
+        else
+            apply_permutation_gate_kernel(real, imag, 0, num_pairs, operation->target,
+                operation->control_mask);
+        return;
+    }
+
+    if(task->precision == PRECISION_DOUBLE) {
+        if(operation->type == DENSE_OPERATION)
+            apply_dense_gate_kernel_double(real, imag, 0, block_size >> operation->num_qubits,
+                operation->num_qubits, operation->qubits, operation->matrix_re,
+                operation->matrix_im);
+        else
+            apply_controlled_gate_kernel_double(real, imag, 0, num_pairs,
+                operation->target, operation->control_mask, operation->gate);
+    } else if(operation->type == DENSE_OPERATION) {
+        apply_dense_gate_kernel(real, imag, 0, block_size >> operation->num_qubits,
+            operation->num_qubits, operation->qubits, operation->matrix_re,
+            operation->matrix_im);
+    } else if(operation->control_mask) {
+        apply_controlled_gate_kernel(real, imag, 0, num_pairs,
+            operation->target, operation->control_mask, operation->gate);
+    } else {
+        apply_gate_kernel(task->simd_level, real, imag, 0, block_size/2,
+            operation->target, operation->gate);
+    }
+}
+
+/**
+ * @brief Applies a run of low qubit operations to the blocks in [start, end).
+ * Every operation of the run is applied to a block before moving on to the
+ * next, so each block is read from memory once and stays in cache.
+ * @param start The first block to update
+ * @param end One past the last block to update
+ * @param data The BlockTask holding the run of operations
+ */
+static void apply_block_task(size_t start, size_t end, void *data)
+{
+    BlockTask *task = (BlockTask *) data;
+    const size_t block_size = task->block_size;
+    const size_t block_bytes = block_size*precision_size(task->precision);
+    char *real, *imag;
+
+    for(size_t block=start; block<end; block++) {
+        real = (char *) task->real + block*block_bytes;
+        imag = (char *) task->imag + block*block_bytes;
+
+        for(int i=0; i<task->num_operations; i++)
+            apply_to_block(&task->operations[i], real, imag, block_size, task);
+    }
+}
+
+/**
+ * @brief Computes the probabilities of the amplitudes in [start, end).
+ * @param start The first amplitude to measure
+ * @param end One past the last amplitude to measure
+ * @param data The StateTask holding the state and probability arrays
+ */
+static void measure_task(size_t start, size_t end, void *data)
+{
+    StateTask *task = (StateTask *) data;
+
+    if(task->precision == PRECISION_DOUBLE)
+        measure_kernel_double(task->real, task->imag, task->output, start, end);
+    else
+        measure_kernel(task->real, task->imag, task->output, start, end);
+}
+
+/**
+ * @brief Interleaves the amplitudes in [start, end) into (real, imag) pairs.
+ * @param start The first amplitude to copy
+ * @param end One past the last amplitude to copy
+ * @param data The StateTask holding the state and output arrays
+ */
+static void interleave_task(size_t start, size_t end, void *data)
+{
+    StateTask *task = (StateTask *) data;
+    const double *real_double = task->real, *imag_double = task->imag;
+    const float *real = task->real, *imag = task->imag;
+
+    if(task->precision == PRECISION_DOUBLE) {
+        for(size_t i=start; i<end; i++) {
+            task->output[2*i] = real_double[i];
+            task->output[2*i+1] = imag_double[i];
+        }
+        return;
+    }
+
+    for(size_t i=start; i<end; i++) {
+        task->output[2*i] = real[i];
+        task->output[2*i+1] = imag[i];
+    }
+}
+
+/**
+ * @brief Zeroes the amplitudes in [start, end).
+ * Run across the thread pool so that each thread first touches the pages
+ * it will later work on.
+ * @param start The first amplitude to zero
+ * @param end One past the last amplitude to zero
+ * @param data The StateTask holding the state arrays
+ */
+static void zero_task(size_t start, size_t end, void *data)
+{
+    StateTask *task = (StateTask *) data;
+    const size_t size = precision_size(task->precision);
+
+    memset((char *) task->real + start*size, 0, size*(end-start));
+    memset((char *) task->imag + start*size, 0, size*(end-start));
+}
+
+/**
+ * @brief Splits a controlled gate application across the thread pool.
+ * Controlled gates are split over their control subspace and single
+ * precision gates without controls run on the SIMD kernels.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param gate_class The class of the gate, picking the kernel to run
+ * @param simulation The simulation on which to apply the gate
+ */
+static void run_gate(int target, size_t control_mask, const double gate[8],
+    GateClass gate_class, Simulation *simulation)
+{
+    GateTask task;
+    const size_t num_pairs = get_num_pairs(simulation->num_amp, control_mask);
+
+    task.real = simulation->real_amplitudes;
+    task.imag = simulation->imag_amplitudes;
+    task.precision = simulation->precision;
+    task.simd_level = simulation->simd_level;
+    task.block_size = simd_block_size(task.simd_level);
+    task.target = target;
+    task.control_mask = control_mask;
+    memcpy(task.gate, gate, sizeof(double)*8);
+
+    if(num_pairs < task.block_size || task.precision == PRECISION_DOUBLE) {
+        task.simd_level = SIMD_SCALAR;
+        task.block_size = 1;
+    }
+
+    switch(gate_class) {
+        case GATE_IDENTITY:
+            return;
+        case GATE_DIAGONAL:
+            run_parallel(simulation->thread_pool, apply_diagonal_gate_task, num_pairs, &task);
+            return;
+        case GATE_PERMUTATION:
+            run_parallel(simulation->thread_pool, apply_permutation_gate_task,
+                num_pairs, &task);
+            return;
+        default:
+            break;
+    }
+
+    if(control_mask)
+        run_parallel(simulation->thread_pool, apply_controlled_gate_task,
+            num_pairs, &task);
+    else
+        run_parallel(simulation->thread_pool, apply_gate_task, num_pairs, &task);
+}
+
+/**
+ * @brief Splits an operation's dense matrix into real and imaginary parts.
+ * @param operation The operation to convert
+ * @param prepared The prepared operation, whose dense matrix must later be
+ * freed with free_prepared_operation()
+ */
+static void prepare_operation(Operation *operation, PreparedOperation *prepared)
+{
+    size_t size;
+
+    prepared->type = operation->type;
+    prepared->gate_class = classify_gate(operation->gate);
+    prepared->target = operation->target;
+    prepared->control_mask = operation->control_mask;
+    prepared->num_qubits = operation->num_qubits;
+    prepared->matrix_re = NULL;
+    prepared->matrix_im = NULL;
+
+    memcpy(prepared->gate, operation->gate, sizeof(double)*8);
+
+    if(operation->type != DENSE_OPERATION)
+        return;
+
+    memcpy(prepared->qubits, operation->qubits, sizeof(int)*operation->num_qubits);
+    size = (size_t) 1 << (2*operation->num_qubits);
+    prepared->matrix_re = (double *) malloc(sizeof(double)*size);
+    prepared->matrix_im = (double *) malloc(sizeof(double)*size);
+
+    for(size_t i=0; i<size; i++) {
+        prepared->matrix_re[i] = operation->matrix[2*i];
+        prepared->matrix_im[i] = operation->matrix[2*i+1];
+    }
+}
+
+/**
+ * @brief Frees the matrices of a prepared operation.
+ * @param prepared The prepared operation
+ */
+static void free_prepared_operation(PreparedOperation *prepared)
+{
+    free(prepared->matrix_re);
+    free(prepared->matrix_im);
+}
+
+/**
+ * @brief Applies a run of operations on low qubits block by block.
+ * @param indices The indices of the run's operations in list
+ * @param num_indices The number of operations in the run
+ * @param block_qubits The number of qubits in a block, above every qubit
+ * the run acts on
+ * @param list The operations
+ * @param simulation The simulation on which to apply the run
+ */
+static void run_blocked(int *indices, int num_indices, int block_qubits,
+    OperationList *list, Simulation *simulation)
+{
+    BlockTask task;
+
+    if(num_indices == 0)
+        return;
+
+    task.real = simulation->real_amplitudes;
+    task.imag = simulation->imag_amplitudes;
+    task.precision = simulation->precision;
+    task.simd_level = simulation->simd_level;
+    task.block_size = (size_t) 1 << block_qubits;
+    task.num_operations = num_indices;
+    task.operations = (PreparedOperation *) malloc(sizeof(PreparedOperation)*num_indices);
+
+    for(int i=0; i<num_indices; i++)
+        prepare_operation(&list->operations[indices[i]], &task.operations[i]);
+
+    run_parallel_blocks(simulation->thread_pool, apply_block_task,
+        simulation->num_amp >> block_qubits, &task);
+
+    for(int i=0; i<num_indices; i++)
+        free_prepared_operation(&task.operations[i]);
+    free(task.operations);
+}
+
+/**
+ * @brief Allocates an array of reals aligned for SIMD loads.
+ * @param size The number of reals to allocate
+ * @param precision The precision of the reals
+ * @return The allocated array
+ */
+static void *allocate_amplitudes(size_t size, Precision precision)
+{
+    void *amplitudes;
+
+    if(posix_memalign(&amplitudes, AMPLITUDE_ALIGNMENT, precision_size(precision)*size)) {
+        fprintf(stderr, "error: unable to allocate state vector.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return amplitudes;
+}
+
+/**
+ * @brief Computes the probabilities of a range of amplitudes of a reduction.
+ * @param task The ReductionTask holding the state
+ * @param start The first amplitude of the range
+ * @param size The number of amplitudes in the range
+ * @param probabilities An array to hold the size probabilities
+ */
+static void read_probabilities(ReductionTask *task, size_t start, size_t size,
+    double *probabilities)
+{
+    const double *real_double = task->real, *imag_double = task->imag;
+    const float *real = task->real, *imag = task->imag;
+
+    if(task->precision == PRECISION_DOUBLE) {
+        for(size_t i=0; i<size; i++)
+            probabilities[i] = real_double[start+i]*real_double[start+i] +
+                imag_double[start+i]*imag_double[start+i];
+        return;
+    }
+
+    for(size_t i=0; i<size; i++)
+        probabilities[i] = (double) real[start+i]*real[start+i] +
+            (double) imag[start+i]*imag[start+i];
+}
+
+/**
+ * @brief Sums the probabilities of the blocks in [start, end) and of each
+ * qubit being one in them. Within a block only the low qubits vary, so the
+ * higher qubits take the block's total.
+ * @param start The first block to sum
+ * @param end One past the last block to sum
+ * @param data The ReductionTask holding the state and the num_qubits+1 sums
+ */
+static void qubit_marginals_task(size_t start, size_t end, void *data)
+{
+    ReductionTask *task = (ReductionTask *) data;
+    double probabilities[1 << REDUCE_BLOCK_QUBITS];
+    double sums[8*sizeof(size_t)+1] = {0};
+    double total;
+    size_t base;
+    int q;
+
+    for(size_t block=start; block<end; block++) {
+        base = block*task->block_size;
+        read_probabilities(task, base, task->block_size, probabilities);
+
+        total = 0;
+        for(size_t i=0; i<task->block_size; i++) {
+            total += probabilities[i];
+            for(q=0; (i >> q) != 0; q++)
+                if((i >> q) & 1)
+                    sums[1+q] += probabilities[i];
+        }
+
+        sums[0] += total;
+        for(q=0; q<task->num_qubits; q++)
+            if((base >> q) & 1)
+                sums[1+q] += total;
+    }
+
+    pthread_mutex_lock(&task->lock);
+    for(q=0; q<=task->num_qubits; q++)
+        task->sums[q] += sums[q];
+    pthread_mutex_unlock(&task->lock);
+}
+
+/**
+ * @brief Gathers the bits of a value at the set bits of a mask into the low
+ * bits, the lowest bit of the mask becoming bit 0.
+ * @param value The value
+ * @param mask The mask of the bits to gather
+ * @return The gathered bits
+ */
+static size_t extract_bits(size_t value, size_t mask)
+{
+    size_t result = 0;
+
+    for(size_t bit=1; mask; mask &= mask-1, bit <<= 1)
+        if(value & mask & (~mask + 1))
+            result |= bit;
+
+    return result;
+}
+
+/**
+ * @brief Scatters the low bits of a value to the set bits of a mask, the
+ * inverse of extract_bits().
+ * @param value The value
+ * @param mask The mask of the bits to scatter to
+ * @return The scattered bits
+ */
+static size_t deposit_bits(size_t value, size_t mask)
+{
+    size_t result = 0;
+
+    for(; value && mask; mask &= mask-1, value >>= 1)
+        if(value & 1)
+            result |= mask & (~mask + 1);
+
+    return result;
+}
+
+/**
+ * @brief Sums the probabilities of each value of a register over the blocks in
+ * [start, end) into a private histogram. A block is aligned to its size, so a
+ * state's value is that of the block's base and of its offset combined, and
+ * the values of the offsets are gathered once.
+ * @param start The first block to sum
+ * @param end One past the last block to sum
+ * @param data The ReductionTask holding the state and the register's sums
+ */
+static void register_histogram_task(size_t start, size_t end, void *data)
+{
+    ReductionTask *task = (ReductionTask *) data;
+    const size_t num_values = (size_t) 1 << task->register_qubits;
+    double probabilities[1 << REDUCE_BLOCK_QUBITS];
+    double *histogram = (double *) calloc(num_values, sizeof(double));
+    size_t offsets[1 << REDUCE_BLOCK_QUBITS], base, value;
+
+    if(!histogram) {
+        fprintf(stderr, "error: unable to allocate marginal histogram.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i=0; i<task->block_size; i++)
+        offsets[i] = extract_bits(i, task->qubit_mask);
+
+    for(size_t block=start; block<end; block++) {
+        base = block*task->block_size;
+        value = extract_bits(base, task->qubit_mask);
+        read_probabilities(task, base, task->block_size, probabilities);
+        for(size_t i=0; i<task->block_size; i++)
+            histogram[value | offsets[i]] += probabilities[i];
+    }
+
+    pthread_mutex_lock(&task->lock);
+    for(size_t value=0; value<num_values; value++)
+        task->sums[value] += histogram[value];
+    pthread_mutex_unlock(&task->lock);
+
+    free(histogram);
+}
+
+/**
+ * @brief Sums the probabilities of the register slices in [start, end) into
+ * the register's sums. A slice is the blocks whose register qubits above the
+ * block, those of the slice mask, hold the slice's bits, so the slices own
+ * disjoint values and are summed without a lock. The blocks of a slice are
+ * visited by incrementing the other bits of the block index.
+ * @param start The first slice to sum
+ * @param end One past the last slice to sum
+ * @param data The ReductionTask holding the state and the register's zeroed sums
+ */
+static void register_slices_task(size_t start, size_t end, void *data)
+{
+    ReductionTask *task = (ReductionTask *) data;
+    const size_t num_blocks = task->num_amp/task->block_size;
+    const size_t slice_mask = task->slice_mask;
+    double probabilities[1 << REDUCE_BLOCK_QUBITS];
+    size_t offsets[1 << REDUCE_BLOCK_QUBITS], slice_bits, base, value;
+
+    for(size_t i=0; i<task->block_size; i++)
+        offsets[i] = extract_bits(i, task->qubit_mask);
+
+    for(size_t slice=start; slice<end; slice++) {
+        slice_bits = deposit_bits(slice, slice_mask);
+        for(size_t rest=0; rest<num_blocks; rest=((rest | slice_mask) + 1) & ~slice_mask) {
+            base = (rest | slice_bits)*task->block_size;
+            value = extract_bits(base, task->qubit_mask);
+            read_probabilities(task, base, task->block_size, probabilities);
+            for(size_t i=0; i<task->block_size; i++)
+                task->sums[value | offsets[i]] += probabilities[i];
+        }
+    }
+}
+
+/**
+ * @brief Checks whether a state ranks below another, by lower probability and
+ * then by higher index.
+ * @param a The first state
+ * @param b The second state
+ * @return true if a ranks below b
+ */
+static bool ranks_below(RankedState a, RankedState b)
+{
+    return a.probability < b.probability ||
+        (a.probability == b.probability && a.index > b.index);
+}
+
+/**
+ * @brief Offers a state to a heap of the k highest ranked states so far, whose
+ * root is the lowest ranked of them.
+ * @param state The state to offer
+ * @param heap The heap of at most k states
+ * @param size The number of states in the heap, updated
+ * @param k The number of states to keep
+ */
+static void offer_ranked_state(RankedState state, RankedState *heap, size_t *size,
+    size_t k)
+{
+    size_t i, child;
+
+    if(*size < k) {
+        for(i=(*size)++; i > 0 && ranks_below(state, heap[(i-1)/2]); i=(i-1)/2)
+            heap[i] = heap[(i-1)/2];
+        heap[i] = state;
+        return;
+    }
+
+    if(!ranks_below(heap[0], state))
+        return;
+
+    for(i=0; (child = 2*i+1) < k; i=child) {
+        if(child+1 < k && ranks_below(heap[child+1], heap[child]))
+            child++;
+        if(!ranks_below(heap[child], state))
+            break;
+        heap[i] = heap[child];
+    }
+    heap[i] = state;
+}
+
+/**
+ * @brief Finds the k most probable states of the blocks in [start, end) and
+ * offers them to the shared heap.
+ * @param start The first block to search
+ * @param end One past the last block to search
+ * @param data The ReductionTask holding the state and the shared heap
+ */
+static void top_k_task(size_t start, size_t end, void *data)
+{
+    ReductionTask *task = (ReductionTask *) data;
+    double probabilities[1 << REDUCE_BLOCK_QUBITS];
+    RankedState *heap = (RankedState *) malloc(sizeof(RankedState)*task->k);
+    RankedState state;
+    size_t size = 0;
+
+    if(!heap) {
+        fprintf(stderr, "error: unable to allocate top k heap.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t block=start; block<end; block++) {
+        read_probabilities(task, block*task->block_size, task->block_size, probabilities);
+        for(size_t i=0; i<task->block_size; i++) {
+            state.probability = probabilities[i];
+            state.index = block*task->block_size + i;
+            offer_ranked_state(state, heap, &size, task->k);
+        }
+    }
+
+    pthread_mutex_lock(&task->lock);
+    for(size_t i=0; i<size; i++)
+        offer_ranked_state(heap[i], task->ranked, &task->num_ranked, task->k);
+    pthread_mutex_unlock(&task->lock);
+
+    free(heap);
+}
+
+/**
+ * @brief Sums the probabilities of each of the blocks in [start, end).
+ * @param start The first block to sum
+ * @param end One past the last block to sum
+ * @param data The ReductionTask holding the state and an array for the sum of
+ * each block
+ */
+static void block_sums_task(size_t start, size_t end, void *data)
+{
+    ReductionTask *task = (ReductionTask *) data;
+    double probabilities[1 << REDUCE_BLOCK_QUBITS], sum;
+
+    for(size_t block=start; block<end; block++) {
+        read_probabilities(task, block*task->block_size, task->block_size, probabilities);
+
+        sum = 0;
+        for(size_t i=0; i<task->block_size; i++)
+            sum += probabilities[i];
+        task->sums[block] = sum;
+    }
+}
+
+/**
+ * @brief Resolves the shots in [start, end) to states within their blocks.
+ * Each shot takes the first state at which the sum of the block's
+ * probabilities passes its residual, or the block's last state of non-zero
+ * probability if rounding leaves the residual unreached.
+ * @param start The first shot to resolve
+ * @param end One past the last shot to resolve
+ * @param data The ReductionTask holding the state, the shots' blocks and
+ * their residuals
+ */
+static void sample_blocks_task(size_t start, size_t end, void *data)
+{
+    ReductionTask *task = (ReductionTask *) data;
+    double probabilities[1 << REDUCE_BLOCK_QUBITS], sum;
+    size_t base, chosen;
+
+    for(size_t shot=start; shot<end; shot++) {
+        base = task->indices[shot]*task->block_size;
+        read_probabilities(task, base, task->block_size, probabilities);
+
+        chosen = base;
+        sum = 0;
+        for(size_t i=0; i<task->block_size; i++) {
+            if(probabilities[i] > 0)
+                chosen = base + i;
+            sum += probabilities[i];
+            if(sum > task->residuals[shot])
+                break;
+        }
+
+        task->indices[shot] = chosen;
+    }
+}
+
+/**
+ * @brief Returns the parity of the number of bits set in a value.
+ * @param value The value
+ * @return 1 if an odd number of bits are set and 0 otherwise
+ */
+static int parity(size_t value)
+{
+    for(size_t shift=4*sizeof(size_t); shift; shift/=2)
+        value ^= value >> shift;
+
+    return (int) (value & 1);
+}
+
+/**
+ * @brief Computes conj(state[j^x_mask])*state[j] for a range of the pairs of
+ * states visited by a Pauli group, see pauli_group_task().
+ * @param task The ReductionTask holding the state and the X mask
+ * @param start The first pair of the range
+ * @param size The number of pairs in the range
+ * @param indices An array to hold the state j of each pair
+ * @param real_parts An array to hold the real part of each product
+ * @param imag_parts An array to hold the imaginary part of each product
+ */
+static void read_pair_products(ReductionTask *task, size_t start, size_t size,
+    size_t *indices, double *real_parts, double *imag_parts)
+{
+    const double *real_double = task->real, *imag_double = task->imag;
+    const float *real = task->real, *imag = task->imag;
+    const size_t low_mask = (task->x_mask & (~task->x_mask + 1)) - 1;
+    double amp_re, amp_im, partner_re, partner_im;
+    size_t pair, index, partner;
+
+    for(size_t i=0; i<size; i++) {
+        pair = start + i;
+        index = task->x_mask ? ((pair & ~low_mask) << 1) | (pair & low_mask) : pair;
+        partner = index ^ task->x_mask;
+
+        if(task->precision == PRECISION_DOUBLE) {
+            amp_re = real_double[index];
+            amp_im = imag_double[index];
+            partner_re = real_double[partner];
+            partner_im = imag_double[partner];
+        } else {
+            amp_re = real[index];
+            amp_im = imag[index];
+            partner_re = real[partner];
+            partner_im = imag[partner];
+        }
+
+        indices[i] = index;
+        real_parts[i] = partner_re*amp_re + partner_im*amp_im;
+        imag_parts[i] = partner_re*amp_im - partner_im*amp_re;
+    }
+}
+
+/**
+ * @brief Sums the Pauli strings of a group over the blocks of pairs in
+ * [start, end) into private sums. Each pair of states j and j^x_mask is
+ * visited once, from the j whose lowest bit of x_mask is clear, and every
+ * state is visited when x_mask is zero. A term takes the real part of
+ * conj(state[j^x_mask])*state[j] if it has an even number of Y and the
+ * imaginary part otherwise, with sign (-1)^popcount(j & z_mask).
+ * @param start The first block to sum
+ * @param end One past the last block to sum
+ * @param data The ReductionTask holding the state, the masks and the sums
+ */
+static void pauli_group_task(size_t start, size_t end, void *data)
+{
+    ReductionTask *task = (ReductionTask *) data;
+    double real_parts[1 << REDUCE_BLOCK_QUBITS], imag_parts[1 << REDUCE_BLOCK_QUBITS];
+    double *sums = (double *) calloc(task->num_terms, sizeof(double)), sum;
+    size_t indices[1 << REDUCE_BLOCK_QUBITS], z_mask;
+    const double *parts;
+
+    if(!sums) {
+        fprintf(stderr, "error: unable to allocate Pauli sums.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t block=start; block<end; block++) {
+        read_pair_products(task, block*task->block_size, task->block_size, indices,
+            real_parts, imag_parts);
+
+        for(size_t t=0; t<task->num_terms; t++) {
+            z_mask = task->z_masks[t];
+            parts = parity(task->x_mask & z_mask) ? imag_parts : real_parts;
+            sum = 0;
+            for(size_t i=0; i<task->block_size; i++)
+                sum += parity(indices[i] & z_mask) ? -parts[i] : parts[i];
+            sums[t] += sum;
+        }
+    }
+
+    pthread_mutex_lock(&task->lock);
+    for(size_t t=0; t<task->num_terms; t++)
+        task->sums[t] += sums[t];
+    pthread_mutex_unlock(&task->lock);
+
+    free(sums);
+}
+
+/**
+ * @brief Prepares a reduction over the state of a simulation.
+ * @param task The ReductionTask to prepare
+ * @param simulation The simulation to reduce
+ */
+static void initialise_reduction(ReductionTask *task, Simulation *simulation)
+{
+    memset(task, 0, sizeof(ReductionTask));
+    task->real = simulation->real_amplitudes;
+    task->imag = simulation->imag_amplitudes;
+    task->precision = simulation->precision;
+    task->num_amp = simulation->num_amp;
+    while(((size_t) 1 << task->num_qubits) < simulation->num_amp)
+        task->num_qubits++;
+    task->block_size = (size_t) 1 << (task->num_qubits < REDUCE_BLOCK_QUBITS ?
+        task->num_qubits : REDUCE_BLOCK_QUBITS);
+    pthread_mutex_init(&task->lock, NULL);
+}
+
+/**
+ * Copies the state vector into the state array as (real, imaginary) pairs.
+ * @param state An array to hold the state, must be at least of size
+ * simulation->num_amp * 2
+ * @param simulation The simulation to test
+ */
+void cpu_test_state_vector(double *state, Simulation *simulation)
+{
+    StateTask task;
+
+    task.real = simulation->real_amplitudes;
+    task.imag = simulation->imag_amplitudes;
+    task.precision = simulation->precision;
+    task.output = state;
+
+    run_parallel(simulation->thread_pool, interleave_task, simulation->num_amp, &task);
+}
+
+/**
+ * Frees the state vector and stops the thread pool of a simulation.
+ * @param simulation A simulation object which is no longer in use
+ */
+void cpu_deallocate_resources(Simulation *simulation)
+{
+    free(simulation->real_amplitudes);
+    free(simulation->imag_amplitudes);
+    free_thread_pool(simulation->thread_pool);
+}
+
+/**
+ * Computes the probability of the simulation collapsing to each state.
+ * @param probabilities An array to hold the probabilities, must be at least of
+ * size simulation->num_amp
+ * @param simulation The simulation to be measured
+ */
+void cpu_compute_probabilities(double *probabilities, Simulation *simulation)
+{
+    StateTask task;
+
+    task.real = simulation->real_amplitudes;
+    task.imag = simulation->imag_amplitudes;
+    task.precision = simulation->precision;
+    task.output = probabilities;
+
+    run_parallel(simulation->thread_pool, measure_task, simulation->num_amp, &task);
+}
+
+/**
+ * Measures all registers of a simulation and stores the probabilities of a
+ * qubit collapsing to each state in the simulation's probabilities array.
+ * @param simulation The simulation to be measured
+ */
+void cpu_measure(Simulation *simulation)
+{
+    cpu_compute_probabilities(simulation->probabilities, simulation);
+}
+
+/**
+ * Sums the probability of every state and of each qubit being one.
+ * @param sums An array to hold the total followed by the probability of each
+ * qubit being one, must be at least of size num_qubits+1
+ * @param simulation The simulation to reduce
+ */
+void cpu_reduce_qubit_marginals(double *sums, Simulation *simulation)
+{
+    ReductionTask task;
+
+    initialise_reduction(&task, simulation);
+    task.sums = sums;
+    memset(sums, 0, sizeof(double)*(task.num_qubits+1));
+
+    run_parallel_blocks(simulation->thread_pool, qubit_marginals_task,
+        task.num_amp/task.block_size, &task);
+
+    pthread_mutex_destroy(&task.lock);
+}
+
+/**
+ * Computes the probability of each value of a register of any qubits, see
+ * marginal(). Each thread keeps a private histogram of up to
+ * 2^MAX_HISTOGRAM_QUBITS values, small enough to stay in its cache. Larger
+ * registers are split into slices by their qubits above a reduction block,
+ * each summed straight into the probabilities by one thread.
+ * @param qubit_mask A mask of the qubits in the register
+ * @param probabilities An array to hold the 2^k probabilities of the k qubits
+ * @param simulation The simulation to reduce
+ */
+void cpu_marginal(size_t qubit_mask, double *probabilities, Simulation *simulation)
+{
+    ReductionTask task;
+    size_t num_values = 1, num_slices = 1;
+
+    initialise_reduction(&task, simulation);
+    task.qubit_mask = qubit_mask;
+    for(; qubit_mask; qubit_mask &= qubit_mask-1, num_values *= 2)
+        task.register_qubits++;
+    task.sums = probabilities;
+    memset(probabilities, 0, sizeof(double)*num_values);
+
+    if(task.register_qubits <= MAX_HISTOGRAM_QUBITS &&
+        num_values*simulation->thread_pool->num_threads <= task.num_amp) {
+        run_parallel_blocks(simulation->thread_pool, register_histogram_task,
+            task.num_amp/task.block_size, &task);
+    } else {
+        task.slice_mask = task.qubit_mask/task.block_size;
+        for(qubit_mask=task.slice_mask; qubit_mask; qubit_mask &= qubit_mask-1)
+            num_slices *= 2;
+        run_parallel_blocks(simulation->thread_pool, register_slices_task, num_slices,
+            &task);
+    }
+
+    pthread_mutex_destroy(&task.lock);
+}
+
+/**
+ * Sums the probabilities of blocks of consecutive states, see sample(). Each
+ * block is summed once by one thread, straight into its entry of sums.
+ * @param block_qubits The number of qubits varying within a block, at most
+ * REDUCE_BLOCK_QUBITS
+ * @param sums An array to hold the sum of each block
+ * @param simulation The simulation to reduce
+ */
+void cpu_sum_blocks(int block_qubits, double *sums, Simulation *simulation)
+{
+    ReductionTask task;
+
+    initialise_reduction(&task, simulation);
+    task.block_size = (size_t) 1 << block_qubits;
+    task.sums = sums;
+
+    run_parallel(simulation->thread_pool, block_sums_task,
+        task.num_amp/task.block_size, &task);
+
+    pthread_mutex_destroy(&task.lock);
+}
+
+/**
+ * Resolves shots drawn within blocks of consecutive states to the states
+ * they land on, see sample().
+ * @param block_qubits The number of qubits varying within a block, at most
+ * REDUCE_BLOCK_QUBITS
+ * @param num_shots The number of shots
+ * @param indices The block of each shot, replaced by the state it lands on
+ * @param residuals How far into its block's probability each shot lands
+ * @param simulation The simulation being sampled
+ */
+void cpu_sample_blocks(int block_qubits, size_t num_shots, size_t *indices,
+    const double *residuals, Simulation *simulation)
+{
+    ReductionTask task;
+
+    initialise_reduction(&task, simulation);
+    task.block_size = (size_t) 1 << block_qubits;
+    task.indices = indices;
+    task.residuals = residuals;
+
+    run_parallel(simulation->thread_pool, sample_blocks_task, num_shots, &task);
+
+    pthread_mutex_destroy(&task.lock);
+}
+
+/**
+ * Sums each Pauli string of a group sharing one X mask in one read-only pass
+ * over the state, see expectation(). Each thread keeps private sums for
+ * every term of the group.
+ * @param x_mask The X mask shared by the group
+ * @param num_terms The number of terms in the group
+ * @param z_masks The Z mask of each term
+ * @param sums An array to hold the num_terms sums
+ * @param simulation The simulation to reduce
+ */
+void cpu_pauli_group_sums(size_t x_mask, size_t num_terms, const size_t *z_masks,
+    double *sums, Simulation *simulation)
+{
+    ReductionTask task;
+    const size_t num_pairs = x_mask ? simulation->num_amp/2 : simulation->num_amp;
+
+    initialise_reduction(&task, simulation);
+    if(task.block_size > num_pairs)
+        task.block_size = num_pairs;
+    task.x_mask = x_mask;
+    task.z_masks = z_masks;
+    task.num_terms = num_terms;
+    task.sums = sums;
+    memset(sums, 0, sizeof(double)*num_terms);
+
+    run_parallel_blocks(simulation->thread_pool, pauli_group_task,
+        num_pairs/task.block_size, &task);
+
+    pthread_mutex_destroy(&task.lock);
+}
+
+/**
+ * Finds the k most probable states, in no particular order.
+ * @param k The number of states to find, at most simulation->num_amp
+ * @param indices An array to hold the k states
+ * @param probabilities An array to hold the k probabilities
+ * @param simulation The simulation to search
+ */
+void cpu_top_k(size_t k, size_t *indices, double *probabilities, Simulation *simulation)
+{
+    ReductionTask task;
+
+    initialise_reduction(&task, simulation);
+    task.k = k;
+    task.ranked = (RankedState *) malloc(sizeof(RankedState)*k);
+    if(!task.ranked) {
+        fprintf(stderr, "error: unable to allocate top k heap.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    run_parallel_blocks(simulation->thread_pool, top_k_task,
+        task.num_amp/task.block_size, &task);
+
+    for(size_t i=0; i<k; i++) {
+        indices[i] = task.ranked[i].index;
+        probabilities[i] = task.ranked[i].probability;
+    }
+
+    free(task.ranked);
+    pthread_mutex_destroy(&task.lock);
+}
+
+/**
+ * Applies a dense unitary acting on several qubits in one pass.
+ * @param operation The DENSE_OPERATION to apply
+ * @param simulation The simulation on which to apply the unitary
+ */
+void cpu_apply_dense_gate(Operation *operation, Simulation *simulation)
+{
+    DenseTask task;
+    const size_t size = (size_t) 1 << (2*operation->num_qubits);
+
+    task.real = simulation->real_amplitudes;
+    task.imag = simulation->imag_amplitudes;
+    task.precision = simulation->precision;
+    task.num_qubits = operation->num_qubits;
+    memcpy(task.qubits, operation->qubits, sizeof(int)*operation->num_qubits);
+
+    for(size_t i=0; i<size; i++) {
+        task.matrix_re[i] = operation->matrix[2*i];
+        task.matrix_im[i] = operation->matrix[2*i+1];
+    }
+
+    run_parallel(simulation->thread_pool, apply_dense_gate_task,
+        simulation->num_amp >> operation->num_qubits, &task);
+}
+
+/**
+ * Applies an operation with any number of control qubits in one full pass.
+ * @param operation The operation to apply
+ * @param simulation The simulation on which to apply the operation
+ */
+void cpu_apply_operation(Operation *operation, Simulation *simulation)
+{
+    if(operation->type == DENSE_OPERATION) {
+        cpu_apply_dense_gate(operation, simulation);
+        return;
+    }
+
+    run_gate(operation->target, operation->control_mask, operation->gate,
+        classify_gate(operation->gate), simulation);
+}
+
+/**
+ * Returns the cost of each kernel for fuse_operations(). The dense kernel is
+ * scalar, so a fused block only pays off in place of many scalar gates.
+ * @param precision The precision of the state
+ * @return The costs of the kernels for that precision
+ */
+const FusionCosts *cpu_fusion_costs(Precision precision)
+{
+    return precision == PRECISION_DOUBLE ? &double_fusion_costs : &single_fusion_costs;
+}
+
+/**
+ * Applies a list of operations, running gates on low qubits cache block
+ * by cache block.
+ * Operations acting only on qubits below simulation->block_qubits are
+ * gathered into runs and every operation of a run is applied to one
+ * cache sized block of the state before moving to the next. A low qubit
+ * operation joins the current run ahead of any pending high qubit
+ * operations it shares no qubits with, and so commutes with. High qubit
+ * operations are applied with full passes over the state.
+ * @param list The operations to apply
+ * @param simulation The simulation on which to apply the operations
+ */
+void cpu_apply_operation_list(OperationList *list, Simulation *simulation)
+{
+    int num_qubits = 0, block_qubits = simulation->block_qubits;
+    int num_run = 0, num_pending = 0;
+    int *run, *pending;
+    size_t low_mask, mask, pending_mask = 0;
+
+    while(((size_t) 1 << num_qubits) < simulation->num_amp)
+        num_qubits++;
+
+    // A block never spans more than the whole state
+    if(block_qubits > num_qubits)
+        block_qubits = num_qubits;
+
+    // Leave at least one block for every thread
+    while(block_qubits > MIN_BLOCK_QUBITS && ((size_t) 1 << (num_qubits - block_qubits))
+        < (size_t) simulation->thread_pool->num_threads)
+        block_qubits--;
+
+    if(block_qubits < MIN_BLOCK_QUBITS || num_qubits <= block_qubits) {
+        for(int i=0; i<list->num_operations; i++)
+            cpu_apply_operation(&list->operations[i], simulation);
+        return;
+    }
+
+    low_mask = ((size_t) 1 << block_qubits) - 1;
+    run = (int *) malloc(sizeof(int)*(list->num_operations+1));
+    pending = (int *) malloc(sizeof(int)*(list->num_operations+1));
+
+    for(int i=0; i<list->num_operations; i++) {
+        mask = get_qubit_mask(&list->operations[i]);
+
+        if(mask & ~low_mask) {
+            pending[num_pending++] = i;
+            pending_mask |= mask;
+            continue;
+        }
+
+        if(mask & pending_mask) {
+            run_blocked(run, num_run, block_qubits, list, simulation);
+            for(int j=0; j<num_pending; j++)
+                cpu_apply_operation(&list->operations[pending[j]], simulation);
+            num_run = 0;
+            num_pending = 0;
+            pending_mask = 0;
+        }
+
+        run[num_run++] = i;
+    }
+
+    run_blocked(run, num_run, block_qubits, list, simulation);
+    for(int j=0; j<num_pending; j++)
+        cpu_apply_operation(&list->operations[pending[j]], simulation);
+
+    free(run);
+    free(pending);
+}
+
+/**
+ * Applies the doubly controlled version of a gate.
+ * @param target The target qubit for the gate
+ * @param control_1 The first control qubit for the gate
+ * @param control_2 The seccond control qubit for the gate
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void cpu_apply_double_controlled_gate(int target, int control_1, int control_2,
+    double gate[8], Simulation *simulation)
+{
+    run_gate(target, ((size_t) 1 << control_1) | ((size_t) 1 << control_2),
+        gate, GATE_GENERAL, simulation);
+}
+
+/**
+ * Applies the controlled version of a gate.
+ * @param target The target qubit for the gate
+ * @param controlled The control qubit for the gate
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void cpu_apply_controlled_gate(int target, int controlled, double gate[8],
+    Simulation *simulation)
+{
+    run_gate(target, (size_t) 1 << controlled, gate, GATE_GENERAL, simulation);
+}
+
+/**
+ * Applies a gate on the specified target qubit.
+ * @param target The target qubit for the gate
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void cpu_apply_gate(int target, double gate[8], Simulation *simulation)
+{
+    run_gate(target, 0, gate, GATE_GENERAL, simulation);
+}
+
+/**
+ * Applies a gate with any number of control qubits, visiting only the
+ * amplitude pairs whose controls are all set.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param simulation The simulation on which to apply the gate
+ */
+void cpu_apply_multi_controlled_gate(int target, size_t control_mask, double gate[8],
+    Simulation *simulation)
+{
+    run_gate(target, control_mask, gate, GATE_GENERAL, simulation);
+}
+
+/**
+ * Applies a diagonal gate with any number of control qubits by scaling
+ * the affected amplitudes.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate, zero off the diagonal
+ * @param simulation The simulation on which to apply the gate
+ */
+void cpu_apply_diagonal_gate(int target, size_t control_mask, double gate[8],
+    Simulation *simulation)
+{
+    run_gate(target, control_mask, gate, GATE_DIAGONAL, simulation);
+}
+
+/**
+ * Applies an X gate with any number of control qubits by swapping the
+ * affected amplitudes.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param simulation The simulation on which to apply the gate
+ */
+void cpu_apply_permutation_gate(int target, size_t control_mask, Simulation *simulation)
+{
+    run_gate(target, control_mask, x, GATE_PERMUTATION, simulation);
+}
+
+/**
+ * Allocates the state vector in host memory as separate real and imaginary
+ * arrays of the simulation's precision and sets it to |0...0>. The previous
+ * state vector, if any, is freed first.
+ * @param num_qubits The number of qubits to initialise
+ * @param simulation The simulation object to initialise
+ */
+void cpu_initialise_qubits(int num_qubits, Simulation *simulation)
+{
+    StateTask task;
+
+    free(simulation->real_amplitudes);
+    free(simulation->imag_amplitudes);
+    simulation->real_amplitudes = allocate_amplitudes(simulation->num_amp,
+        simulation->precision);
+    simulation->imag_amplitudes = allocate_amplitudes(simulation->num_amp,
+        simulation->precision);
+    task.real = simulation->real_amplitudes;
+    task.imag = simulation->imag_amplitudes;
+    task.precision = simulation->precision;
+    run_parallel(simulation->thread_pool, zero_task, simulation->num_amp, &task);
+
+    if(simulation->precision == PRECISION_DOUBLE)
+        ((double *) simulation->real_amplitudes)[0] = 1;
+    else
+        ((float *) simulation->real_amplitudes)[0] = 1;
+}
+
+/**
+ * @brief Sets up the thread pool and SIMD level of a simulation.
+ * The widest SIMD level supported by the processor is used unless the
+ * SIMULATION_SIMD environment variable ("scalar", "avx2" or "avx512") asks
+ * for a narrower one. Double precision states always run the scalar kernels.
+ * Cache blocks hold as many amplitudes as fit in the L2 cache, unless
+ * SIMULATION_BLOCK_QUBITS sets their size. The available memory is the
+ * host's physical memory.
+ * @param num_threads The number of threads to run on, uses all online
+ * processors if less than 1
+ * @param simulation The simulation in which to store the thread pool
+ * @return 0 on success
+ */
+int cpu_set_up(int num_threads, Simulation *simulation)
+{
+    char *simd = getenv("SIMULATION_SIMD");
+    char *block_qubits = getenv("SIMULATION_BLOCK_QUBITS");
+    long cache_size = 0;
+
+    simulation->thread_pool = initialise_thread_pool(num_threads);
+    simulation->global_mem_size = simulation->host_mem_size;
+    simulation->max_alloc_size = simulation->host_mem_size;
+
+    simulation->simd_level = detect_simd_level();
+    if(simd && strcmp(simd, "scalar") == 0)
+        simulation->simd_level = SIMD_SCALAR;
+    else if(simd && strcmp(simd, "avx2") == 0 && simulation->simd_level > SIMD_AVX2)
+        simulation->simd_level = SIMD_AVX2;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if(cache_size <= 0)
+        cache_size = DEFAULT_L2_CACHE_SIZE;
+
+    simulation->block_qubits = 0;
+    while((2*precision_size(simulation->precision) << simulation->block_qubits)
+        <= (size_t) cache_size)
+        simulation->block_qubits++;
+    simulation->block_qubits--;
+
+    if(block_qubits)
+        simulation->block_qubits = atoi(block_qubits);
+
+    return 0;
+}
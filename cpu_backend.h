@@ -0,0 +1,30 @@
+#ifndef _CPU_BACKEND_H
+#define _CPU_BACKEND_H
+
+#include "gate_fusion.h"
+#include "simulation.h"
+
+int cpu_set_up(int, Simulation *);
+void cpu_initialise_qubits(int, Simulation *);
+void cpu_apply_gate(int, double[8], Simulation *);
+void cpu_apply_controlled_gate(int, int, double[8], Simulation *);
+void cpu_apply_double_controlled_gate(int, int, int, double[8], Simulation *);
+void cpu_apply_multi_controlled_gate(int, size_t, double[8], Simulation *);
+void cpu_apply_diagonal_gate(int, size_t, double[8], Simulation *);
+void cpu_apply_permutation_gate(int, size_t, Simulation *);
+void cpu_apply_dense_gate(Operation *, Simulation *);
+void cpu_apply_operation(Operation *, Simulation *);
+void cpu_apply_operation_list(OperationList *, Simulation *);
+const FusionCosts *cpu_fusion_costs(Precision);
+void cpu_measure(Simulation *);
+void cpu_compute_probabilities(double *, Simulation *);
+void cpu_reduce_qubit_marginals(double *, Simulation *);
+void cpu_marginal(size_t, double *, Simulation *);
+void cpu_top_k(size_t, size_t *, double *, Simulation *);
+void cpu_sum_blocks(int, double *, Simulation *);
+void cpu_sample_blocks(int, size_t, size_t *, const double *, Simulation *);
+void cpu_pauli_group_sums(size_t, size_t, const size_t *, double *, Simulation *);
+void cpu_test_state_vector(double *, Simulation *);
+void cpu_deallocate_resources(Simulation *);
+
+#endif
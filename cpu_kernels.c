@@ -0,0 +1,368 @@
+#include "cpu_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Returns the widest SIMD instruction set supported by the processor.
+ * @return The SIMD level to run the gate kernels at
+ */
+SimdLevel detect_simd_level()
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx512f"))
+        return SIMD_AVX512;
+
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SIMD_AVX2;
+#endif
+    return SIMD_SCALAR;
+}
+
+/**
+ * @brief Returns the number of amplitude pairs a kernel processes at once.
+ * Ranges passed to apply_gate_kernel() must be multiples of this size.
+ * @param level The SIMD level of the kernel
+ * @return The number of amplitude pairs in one block
+ */
+size_t simd_block_size(SimdLevel level)
+{
+    switch(level) {
+        case SIMD_AVX512:
+            return 16;
+        case SIMD_AVX2:
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+/**
+ * @brief Applies a gate to the amplitude pairs in [start, end) one at a time.
+ * @param real The real parts of the state vector
+ * @param imag The imaginary parts of the state vector
+ * @param start The first amplitude pair to update
+ * @param end One past the last amplitude pair to update
+ * @param target The target qubit for the gate
+ * @param gate An array containing the matrix of the gate
+ */
+static void apply_gate_scalar(float *real, float *imag, size_t start, size_t end,
+    int target, const double gate[8])
+{
+    apply_controlled_gate_kernel(real, imag, start, end, target, 0, gate);
+}
+
+#ifdef SIMD_X86
+/**
+ * @brief Fills the per-lane coefficients used by the low target kernels.
+ * Lane j of a vector holding amplitudes base+j is updated as
+ * self[j]*amp[j] + other[j]*amp[j^(1<<target)], so lanes in the zero state
+ * take A and B and lanes in the one state take D and C.
+ * @param width The number of lanes in a vector
+ * @param target The target qubit for the gate, less than log2(width)
+ * @param gate An array containing the matrix of the gate
+ * @param coefficients An array of 4*width floats receiving the real and
+ * imaginary parts of the self and other coefficients
+ * @param partners An array of width ints receiving the partner lane of each lane
+ */
+static void set_lane_coefficients(int width, int target, const double gate[8],
+    float *coefficients, int *partners)
+{
+    for(int j=0; j<width; j++) {
+        int bit = (j >> target) & 1;
+
+        coefficients[j] = bit ? gate[6] : gate[0];
+        coefficients[width+j] = bit ? gate[7] : gate[1];
+        coefficients[2*width+j] = bit ? gate[4] : gate[2];
+        coefficients[3*width+j] = bit ? gate[5] : gate[3];
+        partners[j] = j ^ (1 << target);
+    }
+}
+
+/**
+ * @brief Applies a gate to the amplitude pairs in [start, end) with AVX2.
+ * Targets below 3 pair up lanes of the same vector, which are swapped into
+ * place with a permute. Higher targets stream 8 zero state and 8 one state
+ * amplitudes at a time.
+ * @param real The real parts of the state vector
+ * @param imag The imaginary parts of the state vector
+ * @param start The first amplitude pair to update, a multiple of 8
+ * @param end One past the last amplitude pair to update, a multiple of 8
+ * @param target The target qubit for the gate
+ * @param gate An array containing the matrix of the gate
+ */
+__attribute__((target("avx2,fma")))
+static void apply_gate_avx2(float *real, float *imag, size_t start, size_t end,
+    int target, const double gate[8])
+{
+    const size_t mask = ((size_t) 1 << target) - 1;
+    const size_t one_bit = (size_t) 1 << target;
+
+    if(target < 3) {
+        float coefficients[32];
+        int partners[8];
+        __m256 self_re, self_im, other_re, other_im, amp_re, amp_im, pair_re, pair_im;
+        __m256 out_re, out_im;
+        __m256i partner;
+
+        set_lane_coefficients(8, target, gate, coefficients, partners);
+        self_re = _mm256_loadu_ps(coefficients);
+        self_im = _mm256_loadu_ps(coefficients+8);
+        other_re = _mm256_loadu_ps(coefficients+16);
+        other_im = _mm256_loadu_ps(coefficients+24);
+        partner = _mm256_loadu_si256((__m256i *) partners);
+
+        for(size_t i=2*start; i<2*end; i += 8) {
+            amp_re = _mm256_loadu_ps(real+i);
+            amp_im = _mm256_loadu_ps(imag+i);
+            pair_re = _mm256_permutevar8x32_ps(amp_re, partner);
+            pair_im = _mm256_permutevar8x32_ps(amp_im, partner);
+
+            out_re = _mm256_mul_ps(self_re, amp_re);
+            out_re = _mm256_fnmadd_ps(self_im, amp_im, out_re);
+            out_re = _mm256_fmadd_ps(other_re, pair_re, out_re);
+            out_re = _mm256_fnmadd_ps(other_im, pair_im, out_re);
+
+            out_im = _mm256_mul_ps(self_re, amp_im);
+            out_im = _mm256_fmadd_ps(self_im, amp_re, out_im);
+            out_im = _mm256_fmadd_ps(other_re, pair_im, out_im);
+            out_im = _mm256_fmadd_ps(other_im, pair_re, out_im);
+
+            _mm256_storeu_ps(real+i, out_re);
+            _mm256_storeu_ps(imag+i, out_im);
+        }
+    } else {
+        const __m256 a_re = _mm256_set1_ps(gate[0]), a_im = _mm256_set1_ps(gate[1]);
+        const __m256 b_re = _mm256_set1_ps(gate[2]), b_im = _mm256_set1_ps(gate[3]);
+        const __m256 c_re = _mm256_set1_ps(gate[4]), c_im = _mm256_set1_ps(gate[5]);
+        const __m256 d_re = _mm256_set1_ps(gate[6]), d_im = _mm256_set1_ps(gate[7]);
+        __m256 zero_re, zero_im, one_re, one_im, out_re, out_im;
+        size_t zero_state, one_state;
+
+        for(size_t i=start; i<end; i += 8) {
+            zero_state = (i & mask) | ((i & ~mask) << 1);
+            one_state = zero_state | one_bit;
+
+            zero_re = _mm256_loadu_ps(real+zero_state);
+            zero_im = _mm256_loadu_ps(imag+zero_state);
+            one_re = _mm256_loadu_ps(real+one_state);
+            one_im = _mm256_loadu_ps(imag+one_state);
+
+            out_re = _mm256_mul_ps(a_re, zero_re);
+            out_re = _mm256_fnmadd_ps(a_im, zero_im, out_re);
+            out_re = _mm256_fmadd_ps(b_re, one_re, out_re);
+            out_re = _mm256_fnmadd_ps(b_im, one_im, out_re);
+            out_im = _mm256_mul_ps(a_re, zero_im);
+            out_im = _mm256_fmadd_ps(a_im, zero_re, out_im);
+            out_im = _mm256_fmadd_ps(b_re, one_im, out_im);
+            out_im = _mm256_fmadd_ps(b_im, one_re, out_im);
+            _mm256_storeu_ps(real+zero_state, out_re);
+            _mm256_storeu_ps(imag+zero_state, out_im);
+
+            out_re = _mm256_mul_ps(c_re, zero_re);
+            out_re = _mm256_fnmadd_ps(c_im, zero_im, out_re);
+            out_re = _mm256_fmadd_ps(d_re, one_re, out_re);
+            out_re = _mm256_fnmadd_ps(d_im, one_im, out_re);
+            out_im = _mm256_mul_ps(c_re, zero_im);
+            out_im = _mm256_fmadd_ps(c_im, zero_re, out_im);
+            out_im = _mm256_fmadd_ps(d_re, one_im, out_im);
+            out_im = _mm256_fmadd_ps(d_im, one_re, out_im);
+            _mm256_storeu_ps(real+one_state, out_re);
+            _mm256_storeu_ps(imag+one_state, out_im);
+        }
+    }
+}
+
+/**
+ * @brief Applies a gate to the amplitude pairs in [start, end) with AVX-512.
+ * Targets below 4 pair up lanes of the same vector, which are swapped into
+ * place with a permute. Higher targets stream 16 zero state and 16 one
+ * state amplitudes at a time.
+ * @param real The real parts of the state vector
+ * @param imag The imaginary parts of the state vector
+ * @param start The first amplitude pair to update, a multiple of 16
+ * @param end One past the last amplitude pair to update, a multiple of 16
+ * @param target The target qubit for the gate
+ * @param gate An array containing the matrix of the gate
+ */
+__attribute__((target("avx512f")))
+static void apply_gate_avx512(float *real, float *imag, size_t start, size_t end,
+    int target, const double gate[8])
+{
+    const size_t mask = ((size_t) 1 << target) - 1;
+    const size_t one_bit = (size_t) 1 << target;
+
+    if(target < 4) {
+        float coefficients[64];
+        int partners[16];
+        __m512 self_re, self_im, other_re, other_im, amp_re, amp_im, pair_re, pair_im;
+        __m512 out_re, out_im;
+        __m512i partner;
+
+        set_lane_coefficients(16, target, gate, coefficients, partners);
+        self_re = _mm512_loadu_ps(coefficients);
+        self_im = _mm512_loadu_ps(coefficients+16);
+        other_re = _mm512_loadu_ps(coefficients+32);
+        other_im = _mm512_loadu_ps(coefficients+48);
+        partner = _mm512_loadu_si512(partners);
+
+        for(size_t i=2*start; i<2*end; i += 16) {
+            amp_re = _mm512_loadu_ps(real+i);
+            amp_im = _mm512_loadu_ps(imag+i);
+            pair_re = _mm512_permutexvar_ps(partner, amp_re);
+            pair_im = _mm512_permutexvar_ps(partner, amp_im);
+
+            out_re = _mm512_mul_ps(self_re, amp_re);
+            out_re = _mm512_fnmadd_ps(self_im, amp_im, out_re);
+            out_re = _mm512_fmadd_ps(other_re, pair_re, out_re);
+            out_re = _mm512_fnmadd_ps(other_im, pair_im, out_re);
+
+            out_im = _mm512_mul_ps(self_re, amp_im);
+            out_im = _mm512_fmadd_ps(self_im, amp_re, out_im);
+            out_im = _mm512_fmadd_ps(other_re, pair_im, out_im);
+            out_im = _mm512_fmadd_ps(other_im, pair_re, out_im);
+
+            _mm512_storeu_ps(real+i, out_re);
+            _mm512_storeu_ps(imag+i, out_im);
+        }
+    } else {
+        const __m512 a_re = _mm512_set1_ps(gate[0]), a_im = _mm512_set1_ps(gate[1]);
+        const __m512 b_re = _mm512_set1_ps(gate[2]), b_im = _mm512_set1_ps(gate[3]);
+        const __m512 c_re = _mm512_set1_ps(gate[4]), c_im = _mm512_set1_ps(gate[5]);
+        const __m512 d_re = _mm512_set1_ps(gate[6]), d_im = _mm512_set1_ps(gate[7]);
+        __m512 zero_re, zero_im, one_re, one_im, out_re, out_im;
+        size_t zero_state, one_state;
+
+        for(size_t i=start; i<end; i += 16) {
+            zero_state = (i & mask) | ((i & ~mask) << 1);
+            one_state = zero_state | one_bit;
+
+            zero_re = _mm512_loadu_ps(real+zero_state);
+            zero_im = _mm512_loadu_ps(imag+zero_state);
+            one_re = _mm512_loadu_ps(real+one_state);
+            one_im = _mm512_loadu_ps(imag+one_state);
+
+            out_re = _mm512_mul_ps(a_re, zero_re);
+            out_re = _mm512_fnmadd_ps(a_im, zero_im, out_re);
+            out_re = _mm512_fmadd_ps(b_re, one_re, out_re);
+            out_re = _mm512_fnmadd_ps(b_im, one_im, out_re);
+            out_im = _mm512_mul_ps(a_re, zero_im);
+            out_im = _mm512_fmadd_ps(a_im, zero_re, out_im);
+            out_im = _mm512_fmadd_ps(b_re, one_im, out_im);
+            out_im = _mm512_fmadd_ps(b_im, one_re, out_im);
+            _mm512_storeu_ps(real+zero_state, out_re);
+            _mm512_storeu_ps(imag+zero_state, out_im);
+
+            out_re = _mm512_mul_ps(c_re, zero_re);
+            out_re = _mm512_fnmadd_ps(c_im, zero_im, out_re);
+            out_re = _mm512_fmadd_ps(d_re, one_re, out_re);
+            out_re = _mm512_fnmadd_ps(d_im, one_im, out_re);
+            out_im = _mm512_mul_ps(c_re, zero_im);
+            out_im = _mm512_fmadd_ps(c_im, zero_re, out_im);
+            out_im = _mm512_fmadd_ps(d_re, one_im, out_im);
+            out_im = _mm512_fmadd_ps(d_im, one_re, out_im);
+            _mm512_storeu_ps(real+one_state, out_re);
+            _mm512_storeu_ps(imag+one_state, out_im);
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Applies a gate to the amplitude pairs in [start, end).
+ * @param level The SIMD level to run at, start and end must be multiples of
+ * simd_block_size(level)
+ * @param real The real parts of the state vector
+ * @param imag The imaginary parts of the state vector
+ * @param start The first amplitude pair to update
+ * @param end One past the last amplitude pair to update
+ * @param target The target qubit for the gate
+ * @param gate An array containing the matrix of the gate
+ */
+void apply_gate_kernel(SimdLevel level, float *real, float *imag, size_t start,
+    size_t end, int target, const double gate[8])
+{
+    switch(level) {
+#ifdef SIMD_X86
+        case SIMD_AVX512:
+            apply_gate_avx512(real, imag, start, end, target, gate);
+            return;
+        case SIMD_AVX2:
+            apply_gate_avx2(real, imag, start, end, target, gate);
+            return;
+#endif
+        default:
+            apply_gate_scalar(real, imag, start, end, target, gate);
+    }
+}
+
+/**
+ * @brief Lists the set bits of a mask in ascending order.
+ * @param mask The mask to list
+ * @param positions An array of at least sizeof(size_t)*8 ints receiving
+ * the positions of the set bits
+ * @return The number of set bits
+ */
+static int get_bit_positions(size_t mask, int *positions)
+{
+    int num_positions = 0;
+
+    for(int q=0; mask; q++, mask >>= 1)
+        if(mask & 1)
+            positions[num_positions++] = q;
+
+    return num_positions;
+}
+
+/**
+ * @brief Deposits the bits of an index around a set of fixed bit positions.
+ * A zero is inserted at each position, lowest first, so consecutive
+ * indices enumerate every state whose fixed bits are all zero.
+ * @param index The index to spread out
+ * @param positions The fixed bit positions in ascending order
+ * @param num_positions The number of fixed bit positions
+ * @return The index with a zero bit at every fixed position
+ */
+static size_t insert_zero_bits(size_t index, const int *positions, int num_positions)
+{
+    size_t mask;
+
+    for(int i=0; i<num_positions; i++) {
+        mask = ((size_t) 1 << positions[i]) - 1;
+        index = (index & mask) | ((index & ~mask) << 1);
+    }
+
+    return index;
+}
+
+// Scalar kernels for single and double precision amplitudes
+#define REAL float
+#define KERNEL(name) name
+#include "cpu_kernels_generic.h"
+#undef REAL
+#undef KERNEL
+
+#define REAL double
+#define KERNEL(name) name##_double
+#include "cpu_kernels_generic.h"
+#undef REAL
+#undef KERNEL
+
+/**
+ * @brief Applies a gate to the double precision amplitude pairs in [start, end).
+ * @param real The real parts of the state vector
+ * @param imag The imaginary parts of the state vector
+ * @param start The first amplitude pair to update
+ * @param end One past the last amplitude pair to update
+ * @param target The target qubit for the gate
+ * @param gate An array containing the matrix of the gate
+ */
+void apply_gate_kernel_double(double *real, double *imag, size_t start, size_t end,
+    int target, const double gate[8])
+{
+    apply_controlled_gate_kernel_double(real, imag, start, end, target, 0, gate);
+}
@@ -0,0 +1,29 @@
+#ifndef _CPU_KERNELS_H
+#define _CPU_KERNELS_H
+
+#include <stddef.h>
+
+typedef enum {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512} SimdLevel;
+
+SimdLevel detect_simd_level(void);
+size_t simd_block_size(SimdLevel);
+void apply_gate_kernel(SimdLevel, float *, float *, size_t, size_t, int, const double[8]);
+void apply_controlled_gate_kernel(float *, float *, size_t, size_t, int, size_t,
+    const double[8]);
+void apply_diagonal_gate_kernel(float *, float *, size_t, size_t, int, size_t,
+    const double[8]);
+void apply_permutation_gate_kernel(float *, float *, size_t, size_t, int, size_t);
+void apply_dense_gate_kernel(float *, float *, size_t, size_t, int, const int *,
+    const double *, const double *);
+void measure_kernel(const float *, const float *, double *, size_t, size_t);
+void apply_gate_kernel_double(double *, double *, size_t, size_t, int, const double[8]);
+void apply_controlled_gate_kernel_double(double *, double *, size_t, size_t, int, size_t,
+    const double[8]);
+void apply_diagonal_gate_kernel_double(double *, double *, size_t, size_t, int, size_t,
+    const double[8]);
+void apply_permutation_gate_kernel_double(double *, double *, size_t, size_t, int, size_t);
+void apply_dense_gate_kernel_double(double *, double *, size_t, size_t, int, const int *,
+    const double *, const double *);
+void measure_kernel_double(const double *, const double *, double *, size_t, size_t);
+
+#endif
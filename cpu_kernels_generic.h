@@ -0,0 +1,196 @@
+/*
+ * Scalar kernels shared by both state precisions.
+ * Included by cpu_kernels.c once per precision, with REAL defined as the
+ * type of the amplitudes and KERNEL(name) as the name of each kernel for
+ * that precision. Gate coefficients are always given in double precision
+ * and the arithmetic is carried out in double precision.
+ *
+ * Controlled kernels run over the pairs of the control subspace, the
+ * 2^(n-1-c) amplitude pairs whose c controls are all set. Pair i is found
+ * by depositing the bits of i around the target and control qubits with
+ * insert_zero_bits() and then setting the control bits, so no work is
+ * spent on pairs the gate leaves unchanged.
+ */
+
+/**
+ * @brief Applies a controlled gate to the pairs in [start, end) of the
+ * control subspace.
+ * An empty control mask applies the gate to every amplitude pair.
+ * @param real The real parts of the state vector
+ * @param imag The imaginary parts of the state vector
+ * @param start The first pair of the control subspace to update
+ * @param end One past the last pair of the control subspace to update
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate
+ */
+void KERNEL(apply_controlled_gate_kernel)(REAL *real, REAL *imag, size_t start,
+    size_t end, int target, size_t control_mask, const double gate[8])
+{
+    const size_t one_bit = (size_t) 1 << target;
+    int positions[sizeof(size_t)*8];
+    const int num_positions = get_bit_positions(control_mask | one_bit, positions);
+    size_t zero_state, one_state;
+    double zero_re, zero_im, one_re, one_im;
+
+    for(size_t i=start; i<end; i++) {
+        zero_state = insert_zero_bits(i, positions, num_positions) | control_mask;
+        one_state = zero_state | one_bit;
+
+        zero_re = real[zero_state];
+        zero_im = imag[zero_state];
+        one_re = real[one_state];
+        one_im = imag[one_state];
+
+        real[zero_state] = gate[0]*zero_re - gate[1]*zero_im + gate[2]*one_re - gate[3]*one_im;
+        imag[zero_state] = gate[0]*zero_im + gate[1]*zero_re + gate[2]*one_im + gate[3]*one_re;
+        real[one_state] = gate[4]*zero_re - gate[5]*zero_im + gate[6]*one_re - gate[7]*one_im;
+        imag[one_state] = gate[4]*zero_im + gate[5]*zero_re + gate[6]*one_im + gate[7]*one_re;
+    }
+}
+
+/**
+ * @brief Applies a controlled diagonal gate to the pairs in [start, end) of
+ * the control subspace.
+ * Only scales amplitudes, and leaves zero states alone when the gate's
+ * top left entry is 1 as for phase gates.
+ * @param real The real parts of the state vector
+ * @param imag The imaginary parts of the state vector
+ * @param start The first pair of the control subspace to update
+ * @param end One past the last pair of the control subspace to update
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate, zero off the diagonal
+ */
+void KERNEL(apply_diagonal_gate_kernel)(REAL *real, REAL *imag, size_t start,
+    size_t end, int target, size_t control_mask, const double gate[8])
+{
+    const size_t one_bit = (size_t) 1 << target;
+    int positions[sizeof(size_t)*8];
+    const int num_positions = get_bit_positions(control_mask | one_bit, positions);
+    const int scale_zero = gate[0] != 1 || gate[1] != 0;
+    size_t zero_state, one_state;
+    double amp_re, amp_im;
+
+    for(size_t i=start; i<end; i++) {
+        zero_state = insert_zero_bits(i, positions, num_positions) | control_mask;
+        one_state = zero_state | one_bit;
+
+        if(scale_zero) {
+            amp_re = real[zero_state];
+            amp_im = imag[zero_state];
+            real[zero_state] = gate[0]*amp_re - gate[1]*amp_im;
+            imag[zero_state] = gate[0]*amp_im + gate[1]*amp_re;
+        }
+
+        amp_re = real[one_state];
+        amp_im = imag[one_state];
+        real[one_state] = gate[6]*amp_re - gate[7]*amp_im;
+        imag[one_state] = gate[6]*amp_im + gate[7]*amp_re;
+    }
+}
+
+/**
+ * @brief Applies a controlled X gate to the pairs in [start, end) of the
+ * control subspace.
+ * Swaps the zero and one state amplitudes without any arithmetic.
+ * @param real The real parts of the state vector
+ * @param imag The imaginary parts of the state vector
+ * @param start The first pair of the control subspace to update
+ * @param end One past the last pair of the control subspace to update
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ */
+void KERNEL(apply_permutation_gate_kernel)(REAL *real, REAL *imag, size_t start,
+    size_t end, int target, size_t control_mask)
+{
+    const size_t one_bit = (size_t) 1 << target;
+    int positions[sizeof(size_t)*8];
+    const int num_positions = get_bit_positions(control_mask | one_bit, positions);
+    size_t zero_state, one_state;
+    REAL swap;
+
+    for(size_t i=start; i<end; i++) {
+        zero_state = insert_zero_bits(i, positions, num_positions) | control_mask;
+        one_state = zero_state | one_bit;
+
+        swap = real[zero_state];
+        real[zero_state] = real[one_state];
+        real[one_state] = swap;
+
+        swap = imag[zero_state];
+        imag[zero_state] = imag[one_state];
+        imag[one_state] = swap;
+    }
+}
+
+/**
+ * @brief Applies a dense unitary to the amplitude groups in [start, end).
+ * Each group holds the 2^num_qubits amplitudes which share every bit
+ * outside the gate's qubits, and the group index supplies those bits.
+ * @param real The real parts of the state vector
+ * @param imag The imaginary parts of the state vector
+ * @param start The first amplitude group to update
+ * @param end One past the last amplitude group to update
+ * @param num_qubits The number of qubits the unitary acts on
+ * @param qubits The qubits the unitary acts on in ascending order
+ * @param matrix_re The real parts of the row-major unitary
+ * @param matrix_im The imaginary parts of the row-major unitary
+ */
+void KERNEL(apply_dense_gate_kernel)(REAL *real, REAL *imag, size_t start, size_t end,
+    int num_qubits, const int *qubits, const double *matrix_re, const double *matrix_im)
+{
+    const int size = 1 << num_qubits;
+    size_t offsets[1 << 5], base, mask;
+    double in_re[1 << 5], in_im[1 << 5], sum_re, sum_im;
+
+    for(int j=0; j<size; j++) {
+        offsets[j] = 0;
+        for(int i=0; i<num_qubits; i++)
+            if((j >> i) & 1)
+                offsets[j] |= (size_t) 1 << qubits[i];
+    }
+
+    for(size_t group=start; group<end; group++) {
+        base = group;
+        for(int i=0; i<num_qubits; i++) {
+            mask = ((size_t) 1 << qubits[i]) - 1;
+            base = (base & mask) | ((base & ~mask) << 1);
+        }
+
+        for(int j=0; j<size; j++) {
+            in_re[j] = real[base | offsets[j]];
+            in_im[j] = imag[base | offsets[j]];
+        }
+
+        for(int row=0; row<size; row++) {
+            const double *row_re = matrix_re + row*size;
+            const double *row_im = matrix_im + row*size;
+
+            sum_re = 0;
+            sum_im = 0;
+            for(int col=0; col<size; col++) {
+                sum_re += row_re[col]*in_re[col] - row_im[col]*in_im[col];
+                sum_im += row_re[col]*in_im[col] + row_im[col]*in_re[col];
+            }
+
+            real[base | offsets[row]] = sum_re;
+            imag[base | offsets[row]] = sum_im;
+        }
+    }
+}
+
+/**
+ * @brief Computes the probabilities of the amplitudes in [start, end).
+ * @param real The real parts of the state vector
+ * @param imag The imaginary parts of the state vector
+ * @param probabilities The array in which to store the probabilities
+ * @param start The first amplitude to measure
+ * @param end One past the last amplitude to measure
+ */
+void KERNEL(measure_kernel)(const REAL *real, const REAL *imag, double *probabilities,
+    size_t start, size_t end)
+{
+    for(size_t i=start; i<end; i++)
+        probabilities[i] = (double) real[i]*real[i] + (double) imag[i]*imag[i];
+}
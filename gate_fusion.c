@@ -0,0 +1,486 @@
+#include "gate_fusion.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#define MAX_QUBITS (int) (sizeof(size_t)*8)
+#define IDENTITY_TOLERANCE 1e-12
+
+/**
+ * A group of operations which will be applied as one dense unitary. The
+ * indices of its operations are chained in ascending order through a next
+ * array shared by every block, ending in -1.
+ */
+typedef struct FusionBlock
+{
+    size_t qubit_mask;
+    int first;
+    int last;
+    int num_indices;
+} FusionBlock;
+
+/**
+ * @brief Counts the number of qubits in a mask.
+ * @param mask The qubit mask
+ * @return The number of set bits
+ */
+static int count_qubits(size_t mask)
+{
+    int count = 0;
+
+    for(; mask; mask &= mask - 1)
+        count++;
+
+    return count;
+}
+
+/**
+ * @brief Multiplies two 2x2 complex matrices.
+ * Matrices are stored as in apply_gate(), {A, B, C, D} row-major with
+ * interleaved real and imaginary parts.
+ * @param a The left matrix, applied second
+ * @param b The right matrix, applied first
+ * @param result The array in which to store a*b, may not alias a or b
+ */
+void multiply_gates(const double a[8], const double b[8], double result[8])
+{
+    for(int row=0; row<2; row++)
+        for(int col=0; col<2; col++) {
+            const double *a_0 = &a[4*row], *a_1 = &a[4*row+2];
+            const double *b_0 = &b[2*col], *b_1 = &b[4+2*col];
+
+            result[4*row+2*col] = a_0[0]*b_0[0] - a_0[1]*b_0[1]
+                + a_1[0]*b_1[0] - a_1[1]*b_1[1];
+            result[4*row+2*col+1] = a_0[0]*b_0[1] + a_0[1]*b_0[0]
+                + a_1[0]*b_1[1] + a_1[1]*b_1[0];
+        }
+}
+
+/**
+ * @brief Tests whether a gate is the identity up to rounding errors.
+ * @param gate An array containing the matrix of the gate
+ * @return true if every element is within IDENTITY_TOLERANCE of the identity
+ */
+static bool is_identity(const double gate[8])
+{
+    const double identity[8] = {1,0,0,0,0,0,1,0};
+
+    for(int i=0; i<8; i++)
+        if(fabs(gate[i] - identity[i]) > IDENTITY_TOLERANCE)
+            return false;
+
+    return true;
+}
+
+/**
+ * @brief Merges consecutive gates with the same target and controls.
+ * A gate is multiplied into the last operation on its qubits when that
+ * operation is a gate on the same target with the same controls, so runs of
+ * rotations and controlled phases become one gate. Gates whose product is
+ * the identity, such as pairs of Hadamard or CNOT gates, are dropped.
+ * @param list The operations to simplify
+ * @return A new list of the simplified operations
+ */
+OperationList *simplify_operations(OperationList *list)
+{
+    OperationList *merged = initialise_operation_list();
+    OperationList *simplified = initialise_operation_list();
+    int last[MAX_QUBITS], index;
+    Operation *operation, *previous;
+    double product[8];
+    size_t mask;
+    bool adjacent;
+
+    for(int q=0; q<MAX_QUBITS; q++)
+        last[q] = -1;
+
+    for(int i=0; i<list->num_operations; i++) {
+        operation = &list->operations[i];
+        mask = get_qubit_mask(operation);
+
+        if(operation->type == GATE_OPERATION && last[operation->target] >= 0) {
+            index = last[operation->target];
+            previous = &merged->operations[index];
+
+            // Nothing in between may act on any qubit of the two gates
+            adjacent = true;
+            for(int q=0; (mask >> q) != 0; q++)
+                if((mask >> q) & 1 && last[q] != index)
+                    adjacent = false;
+
+            if(adjacent && previous->type == GATE_OPERATION &&
+                previous->target == operation->target &&
+                previous->control_mask == operation->control_mask) {
+                multiply_gates(operation->gate, previous->gate, product);
+                memcpy(previous->gate, product, sizeof(double)*8);
+
+                if(is_identity(previous->gate))
+                    for(int q=0; (mask >> q) != 0; q++)
+                        if((mask >> q) & 1)
+                            last[q] = -1;
+                continue;
+            }
+        }
+
+        append_operation(operation, merged);
+        for(int q=0; (mask >> q) != 0; q++)
+            if((mask >> q) & 1)
+                last[q] = merged->num_operations-1;
+    }
+
+    for(int i=0; i<merged->num_operations; i++) {
+        operation = &merged->operations[i];
+        if(operation->type != GATE_OPERATION || !is_identity(operation->gate))
+            append_operation(operation, simplified);
+    }
+
+    free_operation_list(merged);
+
+    return simplified;
+}
+
+/**
+ * @brief Folds consecutive single qubit gates on the same qubit together.
+ * A gate is multiplied into the last operation on its qubit when that
+ * operation is itself an uncontrolled gate on the qubit, as nothing
+ * between the two can then act on the qubit.
+ * @param list The operations to fold
+ * @return A new list of the folded operations
+ */
+OperationList *fold_single_qubit_gates(OperationList *list)
+{
+    OperationList *folded = initialise_operation_list();
+    int last[MAX_QUBITS];
+    Operation *operation, *previous;
+    double product[8];
+    size_t mask;
+
+    for(int q=0; q<MAX_QUBITS; q++)
+        last[q] = -1;
+
+    for(int i=0; i<list->num_operations; i++) {
+        operation = &list->operations[i];
+
+        if(operation->type == GATE_OPERATION && !operation->control_mask &&
+            last[operation->target] >= 0) {
+            previous = &folded->operations[last[operation->target]];
+
+            if(previous->type == GATE_OPERATION && !previous->control_mask) {
+                multiply_gates(operation->gate, previous->gate, product);
+                memcpy(previous->gate, product, sizeof(double)*8);
+                continue;
+            }
+        }
+
+        append_operation(operation, folded);
+
+        mask = get_qubit_mask(operation);
+        for(int q=0; (mask >> q) != 0; q++)
+            if((mask >> q) & 1)
+                last[q] = folded->num_operations-1;
+    }
+
+    return folded;
+}
+
+/**
+ * @brief Applies a gate to every column of a dense matrix.
+ * Left multiplies the matrix by the gate acting on the local qubits of a
+ * fusion block.
+ * @param target The local target qubit
+ * @param control_mask The local control qubits
+ * @param gate The 2x2 matrix of the gate
+ * @param num_qubits The number of qubits the matrix acts on
+ * @param matrix The matrix to be updated
+ */
+static void apply_gate_to_matrix(int target, size_t control_mask,
+    const double gate[8], int num_qubits, double *matrix)
+{
+    const size_t size = (size_t) 1 << num_qubits;
+    const size_t mask = ((size_t) 1 << target) - 1;
+    size_t zero_row, one_row;
+    double *zero, *one, zero_re, zero_im, one_re, one_im;
+
+    for(size_t col=0; col<size; col++)
+        for(size_t i=0; i<size/2; i++) {
+            zero_row = (i & mask) | ((i & ~mask) << 1);
+            if((zero_row & control_mask) != control_mask)
+                continue;
+            one_row = zero_row | ((size_t) 1 << target);
+
+            zero = &matrix[2*(zero_row*size+col)];
+            one = &matrix[2*(one_row*size+col)];
+            zero_re = zero[0];
+            zero_im = zero[1];
+            one_re = one[0];
+            one_im = one[1];
+
+            zero[0] = gate[0]*zero_re - gate[1]*zero_im + gate[2]*one_re - gate[3]*one_im;
+            zero[1] = gate[0]*zero_im + gate[1]*zero_re + gate[2]*one_im + gate[3]*one_re;
+            one[0] = gate[4]*zero_re - gate[5]*zero_im + gate[6]*one_re - gate[7]*one_im;
+            one[1] = gate[4]*zero_im + gate[5]*zero_re + gate[6]*one_im + gate[7]*one_re;
+        }
+}
+
+/**
+ * @brief Maps a mask of global qubits onto the local qubits of a block.
+ * @param mask The mask of global qubits, a subset of block_mask
+ * @param block_mask The qubits of the block
+ * @return The mask of the corresponding local qubits
+ */
+static size_t to_local_mask(size_t mask, size_t block_mask)
+{
+    size_t local = 0;
+    int bit = 0;
+
+    for(int q=0; q<MAX_QUBITS; q++)
+        if((block_mask >> q) & 1) {
+            if((mask >> q) & 1)
+                local |= (size_t) 1 << bit;
+            bit++;
+        }
+
+    return local;
+}
+
+/**
+ * @brief Estimates the cost of applying a gate on its own.
+ * Every control past the first halves the amplitudes the gate visits.
+ * @param operation The gate
+ * @param costs The costs of each kind of operation
+ * @return The cost per amplitude of the state
+ */
+static double gate_cost(Operation *operation, const FusionCosts *costs)
+{
+    const GateClass gate_class = classify_gate(operation->gate);
+    size_t controls = operation->control_mask;
+    double cost;
+
+    if(!controls)
+        return costs->gate[gate_class];
+
+    cost = costs->controlled_gate[gate_class];
+    for(controls &= controls - 1; controls; controls &= controls - 1)
+        cost /= 2;
+
+    return cost;
+}
+
+/**
+ * @brief Appends the operations of a block to a list as one operation.
+ * A block of a single operation is copied unchanged, a block on one qubit
+ * becomes a single gate and any other block becomes a dense operation,
+ * unless its gates cost no more than the dense unitary applied one by one.
+ * @param block The block to be emitted
+ * @param next The chains of the blocks' operation indices
+ * @param list The list the block's operation indices refer to
+ * @param costs The costs of each kind of operation, or NULL to always fuse
+ * @param fused The list to append to
+ */
+static void emit_block(FusionBlock *block, const int *next, OperationList *list,
+    const FusionCosts *costs, OperationList *fused)
+{
+    Operation dense, *operation;
+    size_t size, local_target;
+    double separate_cost = 0;
+    int bit = 0;
+
+    if(block->num_indices == 1) {
+        append_operation(&list->operations[block->first], fused);
+        return;
+    }
+
+    dense.num_qubits = count_qubits(block->qubit_mask);
+
+    if(costs && dense.num_qubits > 1) {
+        for(int i=block->first; i>=0; i=next[i])
+            separate_cost += gate_cost(&list->operations[i], costs);
+
+        if(separate_cost <= costs->dense[dense.num_qubits]) {
+            for(int i=block->first; i>=0; i=next[i])
+                append_operation(&list->operations[i], fused);
+            return;
+        }
+    }
+
+    dense.type = DENSE_OPERATION;
+    dense.target = 0;
+    dense.control_mask = 0;
+    for(int q=0; q<MAX_QUBITS; q++)
+        if((block->qubit_mask >> q) & 1)
+            dense.qubits[bit++] = q;
+
+    size = (size_t) 1 << dense.num_qubits;
+    dense.matrix = (double *) calloc(2*size*size, sizeof(double));
+    for(size_t i=0; i<size; i++)
+        dense.matrix[2*(i*size+i)] = 1;
+
+    for(int i=block->first; i>=0; i=next[i]) {
+        operation = &list->operations[i];
+        local_target = to_local_mask((size_t) 1 << operation->target, block->qubit_mask);
+
+        bit = 0;
+        while(!((local_target >> bit) & 1))
+            bit++;
+
+        apply_gate_to_matrix(bit, to_local_mask(operation->control_mask, block->qubit_mask),
+            operation->gate, dense.num_qubits, dense.matrix);
+    }
+
+    if(dense.num_qubits == 1) {
+        dense.type = GATE_OPERATION;
+        dense.target = dense.qubits[0];
+        memcpy(dense.gate, dense.matrix, sizeof(double)*8);
+        dense.num_qubits = 0;
+        free(dense.matrix);
+        dense.matrix = NULL;
+        append_operation(&dense, fused);
+        return;
+    }
+
+    append_operation(&dense, fused);
+    free(dense.matrix);
+}
+
+/**
+ * @brief Merges the operations of a block into another, keeping them in order.
+ * @param block The block to merge into
+ * @param other The block to merge, which is left empty
+ * @param next The chains of the blocks' operation indices
+ */
+static void merge_blocks(FusionBlock *block, FusionBlock *other, int *next)
+{
+    int a = block->first, b = other->first, *link = &block->first;
+
+    while(a >= 0 && b >= 0) {
+        if(a < b) {
+            *link = a;
+            link = &next[a];
+            a = next[a];
+        } else {
+            *link = b;
+            link = &next[b];
+            b = next[b];
+        }
+    }
+
+    *link = a >= 0 ? a : b;
+    if(block->last < other->last)
+        block->last = other->last;
+    block->qubit_mask |= other->qubit_mask;
+    block->num_indices += other->num_indices;
+}
+
+/**
+ * @brief Emits and removes every open block acting on the given qubits.
+ * Open blocks act on disjoint qubits, so they may be emitted in any order.
+ * @param mask The qubits whose blocks should be closed
+ * @param blocks The open blocks
+ * @param num_blocks The number of open blocks, updated on return
+ * @param next The chains of the blocks' operation indices
+ * @param list The list the blocks' operation indices refer to
+ * @param costs The costs of each kind of operation, or NULL to always fuse
+ * @param fused The list to append to
+ */
+static void close_blocks(size_t mask, FusionBlock *blocks, int *num_blocks,
+    const int *next, OperationList *list, const FusionCosts *costs, OperationList *fused)
+{
+    int remaining = 0;
+
+    for(int i=0; i<*num_blocks; i++) {
+        if(blocks[i].qubit_mask & mask) {
+            emit_block(&blocks[i], next, list, costs, fused);
+        } else {
+            blocks[remaining++] = blocks[i];
+        }
+    }
+
+    *num_blocks = remaining;
+}
+
+/**
+ * @brief Fuses a list of operations into fewer, larger operations.
+ * First folds consecutive gates on the same qubit into one 2x2 matrix,
+ * then greedily packs neighbouring gates into blocks acting on at most
+ * max_qubits qubits, each applied as a single dense unitary. Blocks are
+ * kept on disjoint qubits, so an operation may join a block past
+ * operations on other qubits, with which it commutes. Given the costs of a
+ * backend's kernels, a block is only fused when the dense unitary is cheaper
+ * than its gates, and its gates are kept otherwise.
+ * @param list The operations to fuse
+ * @param max_qubits The largest number of qubits in a fused block, between
+ * 2 and MAX_FUSED_QUBITS. Smaller values only fold single qubit gates.
+ * @param costs The costs of each kind of operation, or NULL to fuse every
+ * block
+ * @return A new list of the fused operations
+ */
+OperationList *fuse_operations(OperationList *list, int max_qubits,
+    const FusionCosts *costs)
+{
+    OperationList *folded = fold_single_qubit_gates(list);
+    OperationList *fused;
+    FusionBlock blocks[MAX_QUBITS], merged;
+    int num_blocks = 0, remaining, *next;
+    size_t mask, union_mask;
+    Operation *operation;
+
+    if(max_qubits < 2)
+        return folded;
+    if(max_qubits > MAX_FUSED_QUBITS)
+        max_qubits = MAX_FUSED_QUBITS;
+
+    fused = initialise_operation_list();
+    next = (int *) malloc(sizeof(int)*(folded->num_operations + 1));
+
+    for(int i=0; i<folded->num_operations; i++) {
+        operation = &folded->operations[i];
+        mask = get_qubit_mask(operation);
+
+        if(operation->type == DENSE_OPERATION || count_qubits(mask) > max_qubits) {
+            close_blocks(mask, blocks, &num_blocks, next, folded, costs, fused);
+            append_operation(operation, fused);
+            continue;
+        }
+
+        union_mask = mask;
+        for(int b=0; b<num_blocks; b++)
+            if(blocks[b].qubit_mask & mask)
+                union_mask |= blocks[b].qubit_mask;
+
+        if(count_qubits(union_mask) > max_qubits)
+            close_blocks(mask, blocks, &num_blocks, next, folded, costs, fused);
+
+        // Merge the blocks sharing qubits with the operation into one
+        merged.qubit_mask = mask;
+        merged.first = -1;
+        merged.last = -1;
+        merged.num_indices = 0;
+        remaining = 0;
+
+        for(int b=0; b<num_blocks; b++) {
+            if(blocks[b].qubit_mask & mask)
+                merge_blocks(&merged, &blocks[b], next);
+            else
+                blocks[remaining++] = blocks[b];
+        }
+
+        if(merged.last >= 0)
+            next[merged.last] = i;
+        else
+            merged.first = i;
+        next[i] = -1;
+        merged.last = i;
+        merged.num_indices++;
+        blocks[remaining++] = merged;
+        num_blocks = remaining;
+    }
+
+    close_blocks(~(size_t) 0, blocks, &num_blocks, next, folded, costs, fused);
+    free_operation_list(folded);
+    free(next);
+
+    return fused;
+}
@@ -0,0 +1,25 @@
+#ifndef _GATE_FUSION_H
+#define _GATE_FUSION_H
+
+#include "operation_list.h"
+
+/**
+ * The cost of applying each kind of operation, per amplitude of the state in
+ * any unit, used by fuse_operations() to decide whether a block is cheaper
+ * applied as one dense unitary than gate by gate. Gates are indexed by
+ * GateClass, controlled gates are costed with one control and dense
+ * unitaries are indexed by their number of qubits.
+ */
+typedef struct FusionCosts
+{
+    double gate[4];
+    double controlled_gate[4];
+    double dense[MAX_FUSED_QUBITS+1];
+} FusionCosts;
+
+void multiply_gates(const double[8], const double[8], double[8]);
+OperationList *simplify_operations(OperationList *);
+OperationList *fold_single_qubit_gates(OperationList *);
+OperationList *fuse_operations(OperationList *, int, const FusionCosts *);
+
+#endif
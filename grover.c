@@ -1,7 +1,7 @@
 #include "simulation.h"
-#include "circuit_synthesis.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 
 #define QUBITS 12
@@ -53,50 +53,24 @@ int request_user_input()
 
 void apply_control_z(Simulation *simulation)
 {
-    int *circuit = synthesise_multi_cnot(QUBITS-1);
-    int i = 0;
-    int n = pow(2, (QUBITS-2));
+    size_t control_mask = ((size_t) 1 << (QUBITS-1)) - 1;
 
-    float root_x[8] = {0.5*(1+cosf(M_PI/n)), 0.5*sin(M_PI/n), 0.5*(1-cosf(M_PI/n)), -0.5*sin(M_PI/n),
-                       0.5*(1-cosf(M_PI/n)), -0.5*sin(M_PI/n), 0.5*(1+cosf(M_PI/n)), 0.5*sin(M_PI/n)};
-
-    float inv_root_x[8] = {0.5*(1+cosf(M_PI/n)), -0.5*sin(M_PI/n), 0.5*(1-cosf(M_PI/n)), 0.5*sin(M_PI/n),
-                           0.5*(1-cosf(M_PI/n)), 0.5*sin(M_PI/n), 0.5*(1+cosf(M_PI/n)), -0.5*sin(M_PI/n)};
-
-    apply_gate(QUBITS-1, (float *) hadamard, simulation);
-
-    while(circuit[i] != QUBITS) {
-        int control = circuit[i++];
-        int target = circuit[i++];
-        int parity = circuit[i++];
-
-        if(target != QUBITS-1) {
-            apply_controlled_gate(target, control, x, simulation);
-        } else {
-            if(parity == 0) {
-                apply_controlled_gate(target, control, root_x, simulation);
-            } else {
-                apply_controlled_gate(target, control, inv_root_x, simulation);
-            }
-        }
-    }
-
-    apply_gate(QUBITS-1, (float *) hadamard, simulation);
-
-    free(circuit);
+    apply_gate(QUBITS-1, hadamard, simulation);
+    apply_multi_controlled_gate(QUBITS-1, control_mask, x, simulation);
+    apply_gate(QUBITS-1, hadamard, simulation);
 }
 
 void apply_hadamard(Simulation *simulation)
 {
     for(int i=0; i<QUBITS; i++) {
-        apply_gate(i, (float *) hadamard, simulation);
+        apply_gate(i, hadamard, simulation);
     }
 }
 
 void apply_x(Simulation *simulation)
 {
     for(int i=0; i<QUBITS; i++) {
-        apply_gate(i, (float *) x, simulation);
+        apply_gate(i, x, simulation);
     }
 }
 
@@ -117,14 +91,14 @@ void apply_oracle(int n, Simulation *simulation)
 
     for(int i=0; i<QUBITS; i++)
         if(binary_list[i]) {
-            apply_gate(i, (float *) x, simulation);
+            apply_gate(i, x, simulation);
         }
     
     apply_control_z(simulation);
 
     for(int i=0; i<QUBITS; i++)
         if(!binary_list[i]) {
-            apply_gate(i, (float *) x, simulation);
+            apply_gate(i, x, simulation);
         }
 }
 
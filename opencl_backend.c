@@ -0,0 +1,2738 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define APPLY_GATE_FUNC "apply_gate"
+#define APPLY_CGATE_FUNC "apply_controlled_gate"
+#define APPLY_CCGATE_FUNC "apply_double_controlled_gate"
+#define MEASURE_FUNC "measure"
+#define INITIALISE_FUNC "initialise_state"
+#define APPLY_DENSE_GATE_FUNC "apply_dense_gate"
+#define APPLY_MCGATE_FUNC "apply_multi_controlled_gate"
+#define APPLY_DIAGONAL_GATE_FUNC "apply_diagonal_gate"
+#define APPLY_PERMUTATION_GATE_FUNC "apply_permutation_gate"
+#define APPLY_GATE_LIST_FUNC "apply_gate_list"
+#define APPLY_GATE_TILE_FUNC "apply_gate_tile"
+#define REDUCE_QUBIT_MARGINALS_FUNC "reduce_qubit_marginals"
+#define REDUCE_REGISTER_FUNC "reduce_register"
+#define SUM_PARTIALS_FUNC "sum_partials"
+#define PROBABILITY_HISTOGRAM_FUNC "probability_histogram"
+#define SELECT_TOP_K_FUNC "select_top_k"
+#define APPLY_GLOBAL_GATE_FUNC "apply_global_gate"
+#define APPLY_SPECIALISED_GATE_FUNC "apply_specialised_gate"
+#define SUM_BLOCKS_FUNC "sum_blocks"
+#define SAMPLE_IN_BLOCKS_FUNC "sample_in_blocks"
+#define PAULI_GROUP_SUMS_FUNC "pauli_group_sums"
+#define MAX_TILE_QUBITS 12
+#define MAX_PLATFORMS 16
+#define MAX_DEVICES 16
+#define REDUCE_ITEM_QUBITS 8
+#define REDUCE_REGISTER_ITEMS ((size_t) 1 << 16)
+#define HISTOGRAM_BINS 256
+#define HISTOGRAM_ITEMS ((size_t) 1 << 20)
+#define MAX_PROFILED_LAUNCHES 4096
+#define MIN_PARTITION_QUBITS MAX_TILE_QUBITS
+#define MAX_KERNEL_VARIANTS 64
+#define SPECIALISE_AFTER_USES 8
+
+#include "opencl_backend.h"
+#include "gate_fusion.h"
+#include "opencl_program.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <math.h>
+
+/** The header of a gate descriptor, followed by the 8 reals of its matrix */
+typedef struct GateDescriptorHeader
+{
+    cl_ulong control_mask;
+    cl_int target;
+    cl_int kind;
+} GateDescriptorHeader;
+
+/** The commands queued on a partitioned state since its queues were joined */
+typedef enum
+{
+    PARTITION_JOINED,
+    PARTITION_LOCAL,
+    PARTITION_WHOLE,
+    PARTITION_CROSS
+} PartitionWork;
+
+/** A gate configuration and, once it is used often enough, its kernel */
+typedef struct KernelVariant
+{
+    int target;
+    size_t control_mask;
+    GateClass gate_class;
+    int uses;
+    cl_program program;
+    cl_kernel kernel;
+} KernelVariant;
+
+/** A kernel launch whose profiling event has not been read yet */
+typedef struct ProfiledLaunch
+{
+    cl_event event;
+    cl_kernel kernel;
+    int target;
+} ProfiledLaunch;
+
+/** The name and kind of each kernel of a simulation, found by its offset */
+static const struct
+{
+    size_t offset;
+    const char *name;
+    ProfileKind kind;
+} profiled_kernels[] = {
+    {offsetof(Simulation, apply_gate_kernel), APPLY_GATE_FUNC, PROFILE_GENERAL},
+    {offsetof(Simulation, apply_controlled_gate_kernel), APPLY_CGATE_FUNC, PROFILE_GENERAL},
+    {offsetof(Simulation, apply_double_controlled_gate_kernel), APPLY_CCGATE_FUNC,
+        PROFILE_GENERAL},
+    {offsetof(Simulation, apply_multi_controlled_gate_kernel), APPLY_MCGATE_FUNC,
+        PROFILE_GENERAL},
+    {offsetof(Simulation, apply_diagonal_gate_kernel), APPLY_DIAGONAL_GATE_FUNC,
+        PROFILE_DIAGONAL},
+    {offsetof(Simulation, apply_permutation_gate_kernel), APPLY_PERMUTATION_GATE_FUNC,
+        PROFILE_PERMUTATION},
+    {offsetof(Simulation, apply_global_gate_kernel), APPLY_GLOBAL_GATE_FUNC,
+        PROFILE_GENERAL},
+    {offsetof(Simulation, apply_dense_gate_kernel), APPLY_DENSE_GATE_FUNC, PROFILE_DENSE},
+    {offsetof(Simulation, apply_gate_list_kernel), APPLY_GATE_LIST_FUNC, PROFILE_GATE_LIST},
+    {offsetof(Simulation, apply_gate_tile_kernel), APPLY_GATE_TILE_FUNC, PROFILE_GATE_LIST},
+    {offsetof(Simulation, measure_kernel), MEASURE_FUNC, PROFILE_READOUT},
+    {offsetof(Simulation, reduce_qubit_marginals_kernel), REDUCE_QUBIT_MARGINALS_FUNC,
+        PROFILE_READOUT},
+    {offsetof(Simulation, reduce_register_kernel), REDUCE_REGISTER_FUNC, PROFILE_READOUT},
+    {offsetof(Simulation, sum_partials_kernel), SUM_PARTIALS_FUNC, PROFILE_READOUT},
+    {offsetof(Simulation, probability_histogram_kernel), PROBABILITY_HISTOGRAM_FUNC,
+        PROFILE_READOUT},
+    {offsetof(Simulation, select_top_k_kernel), SELECT_TOP_K_FUNC, PROFILE_READOUT},
+    {offsetof(Simulation, sum_blocks_kernel), SUM_BLOCKS_FUNC, PROFILE_READOUT},
+    {offsetof(Simulation, sample_in_blocks_kernel), SAMPLE_IN_BLOCKS_FUNC, PROFILE_READOUT},
+    {offsetof(Simulation, pauli_group_sums_kernel), PAULI_GROUP_SUMS_FUNC, PROFILE_READOUT},
+    {offsetof(Simulation, initialise_state_kernel), INITIALISE_FUNC, PROFILE_OTHER}
+};
+
+/** The profile kind of the specialised kernels of each GateClass */
+static const ProfileKind class_kinds[] = {PROFILE_GENERAL, PROFILE_OTHER,
+    PROFILE_DIAGONAL, PROFILE_PERMUTATION};
+
+/**
+ * Reads the device times of every profiled launch into the simulation's
+ * profile and releases their events. Waits for launches still running.
+ * @param simulation The simulation being profiled
+ */
+void opencl_collect_profile(Simulation *simulation)
+{
+    const cl_profiling_info info[4] = {CL_PROFILING_COMMAND_QUEUED,
+        CL_PROFILING_COMMAND_SUBMIT, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END};
+    const int num_kernels = sizeof(profiled_kernels)/sizeof(profiled_kernels[0]);
+    ProfiledLaunch *launch;
+    unsigned long long times[4];
+    cl_ulong time;
+    cl_int error;
+    int k;
+
+    for(int i=0; i<simulation->num_profiled_launches; i++) {
+        launch = &simulation->profiled_launches[i];
+
+        error = clWaitForEvents(1, &launch->event);
+        for(int j=0; j<4; j++) {
+            error |= clGetEventProfilingInfo(launch->event, info[j], sizeof(cl_ulong),
+                &time, NULL);
+            times[j] = time;
+        }
+        if(error < 0) {
+            perror("Couldn't read a kernel's profiling information");
+            exit(1);
+        }
+
+        for(k=0; k<num_kernels; k++)
+            if(*(cl_kernel *) ((char *) simulation + profiled_kernels[k].offset) ==
+                launch->kernel)
+                break;
+
+        if(k < num_kernels)
+            add_profile_sample(profiled_kernels[k].name, profiled_kernels[k].kind,
+                launch->target, times, simulation->profile_stats);
+
+        for(k=0; k<simulation->num_kernel_variants; k++)
+            if(simulation->kernel_variants[k].kernel == launch->kernel)
+                add_profile_sample(APPLY_SPECIALISED_GATE_FUNC,
+                    class_kinds[simulation->kernel_variants[k].gate_class],
+                    launch->target, times, simulation->profile_stats);
+
+        clReleaseEvent(launch->event);
+    }
+
+    simulation->num_profiled_launches = 0;
+}
+
+/**
+ * @brief Makes every partition's queue wait for the commands of all the others.
+ * A marker is queued on each queue and then a barrier on all of the markers.
+ * @param simulation The partitioned simulation
+ */
+static void join_partitions(Simulation *simulation)
+{
+    cl_event markers[MAX_DEVICES];
+    cl_int error = 0;
+
+    for(int p=0; p<simulation->num_partitions; p++) {
+        error |= clEnqueueMarkerWithWaitList(simulation->partition_queues[p], 0, NULL,
+            &markers[p]);
+        error |= clFlush(simulation->partition_queues[p]);
+    }
+
+    for(int p=0; p<simulation->num_partitions; p++)
+        error |= clEnqueueBarrierWithWaitList(simulation->partition_queues[p],
+            simulation->num_partitions, markers, NULL);
+
+    if(error < 0) {
+        perror("Couldn't join the partitions' command queues");
+        exit(1);
+    }
+
+    for(int p=0; p<simulation->num_partitions; p++)
+        clReleaseEvent(markers[p]);
+}
+
+/**
+ * @brief Orders the next commands on a partitioned state after earlier ones.
+ * Commands on each partition's own amplitudes (PARTITION_LOCAL) may follow
+ * each other freely, as may commands on the whole state, which only run on
+ * simulation->queue (PARTITION_WHOLE). Any other change of work, and every
+ * command pairing two partitions (PARTITION_CROSS), joins the queues first.
+ * @param work The kind of commands about to be queued
+ * @param simulation The simulation the commands run on
+ */
+static void order_partitions(PartitionWork work, Simulation *simulation)
+{
+    if(simulation->num_partitions < 2)
+        return;
+
+    if(simulation->partition_work != PARTITION_JOINED &&
+        (work == PARTITION_CROSS || (int) work != simulation->partition_work))
+        join_partitions(simulation);
+
+    simulation->partition_work = work;
+}
+
+/**
+ * @brief Queues a kernel on a command queue, recording an event for its
+ * profile if the simulation is profiled.
+ * Profiled launches are read once MAX_PROFILED_LAUNCHES are pending.
+ * @param queue The command queue to queue the kernel on
+ * @param kernel The kernel to queue
+ * @param offset The global id of the first work item
+ * @param global_size The number of work items
+ * @param local_size The number of work items in each work group
+ * @param target The target qubit of the gate the kernel applies, or -1
+ * @param simulation The simulation running the kernel
+ * @return The error code of clEnqueueNDRangeKernel()
+ */
+static cl_int queue_kernel(cl_command_queue queue, cl_kernel kernel, size_t offset,
+    size_t global_size, size_t local_size, int target, Simulation *simulation)
+{
+    ProfiledLaunch *launch;
+    cl_event event;
+    cl_int error;
+
+    if(!simulation->profile_stats)
+        return clEnqueueNDRangeKernel(queue, kernel, 1, &offset, &global_size,
+            &local_size, 0, NULL, NULL);
+
+    if(!simulation->profiled_launches) {
+        simulation->profiled_launches = (ProfiledLaunch *) malloc(sizeof(ProfiledLaunch)*
+            MAX_PROFILED_LAUNCHES);
+        if(!simulation->profiled_launches) {
+            fprintf(stderr, "error: unable to allocate profiled launches.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(simulation->num_profiled_launches == MAX_PROFILED_LAUNCHES)
+        opencl_collect_profile(simulation);
+
+    error = clEnqueueNDRangeKernel(queue, kernel, 1, &offset, &global_size,
+        &local_size, 0, NULL, &event);
+    if(error < 0)
+        return error;
+
+    launch = &simulation->profiled_launches[simulation->num_profiled_launches++];
+    launch->event = event;
+    launch->kernel = kernel;
+    launch->target = target;
+
+    return error;
+}
+
+/**
+ * @brief Queues a kernel on the whole state.
+ * @param kernel The kernel to queue
+ * @param global_size The number of work items
+ * @param local_size The number of work items in each work group
+ * @param target The target qubit of the gate the kernel applies, or -1
+ * @param simulation The simulation running the kernel
+ * @return The error code of clEnqueueNDRangeKernel()
+ */
+static cl_int launch_kernel(cl_kernel kernel, size_t global_size, size_t local_size,
+    int target, Simulation *simulation)
+{
+    order_partitions(PARTITION_WHOLE, simulation);
+
+    return queue_kernel(simulation->queue, kernel, 0, global_size, local_size, target,
+        simulation);
+}
+
+/**
+ * @brief Returns the work group size enqueue_kernel() uses for a range.
+ * The ranges of the gate kernels are powers of two, so the work group is the
+ * largest power of two up to simulation->work_group_size dividing the range.
+ * @param global_size The number of work items
+ * @param simulation The simulation running the kernel
+ * @return The number of work items in each work group
+ */
+static size_t get_local_size(size_t global_size, Simulation *simulation)
+{
+    size_t local_size = simulation->work_group_size;
+
+    while(local_size > 1 && global_size % local_size)
+        local_size /= 2;
+
+    return local_size;
+}
+
+/**
+ * @brief Queues a kernel over a range in work groups of the device's size.
+ * @param kernel The kernel to queue
+ * @param global_size The number of work items
+ * @param simulation The simulation running the kernel
+ * @return The error code of clEnqueueNDRangeKernel()
+ */
+static cl_int enqueue_kernel(cl_kernel kernel, size_t global_size,
+    Simulation *simulation)
+{
+    return launch_kernel(kernel, global_size, get_local_size(global_size, simulation),
+        -1, simulation);
+}
+
+/**
+ * @brief Queues a gate kernel over a range in work groups of the device's size.
+ * @param kernel The kernel to queue
+ * @param global_size The number of work items
+ * @param target The target qubit of the gate, by which it is profiled
+ * @param simulation The simulation running the kernel
+ * @return The error code of clEnqueueNDRangeKernel()
+ */
+static cl_int enqueue_gate_kernel(cl_kernel kernel, size_t global_size, int target,
+    Simulation *simulation)
+{
+    return launch_kernel(kernel, global_size, get_local_size(global_size, simulation),
+        target, simulation);
+}
+
+/**
+ * @brief Queues a kernel taking the state as its first argument on each
+ * partition of a partitioned state, on the partition's own device.
+ * @param kernel The kernel to queue
+ * @param global_controls A mask of the global qubits which must be set in
+ * the partitions the kernel runs on, by their index among the global qubits
+ * @param global_size The number of work items on each partition
+ * @param local_size The number of work items in each work group
+ * @param target The target qubit of the gate the kernel applies, or -1
+ * @param simulation The simulation running the kernel
+ */
+static void launch_partitions(cl_kernel kernel, size_t global_controls,
+    size_t global_size, size_t local_size, int target, Simulation *simulation)
+{
+    cl_int error = 0;
+
+    order_partitions(PARTITION_LOCAL, simulation);
+
+    for(int p=0; p<simulation->num_partitions; p++) {
+        if(((size_t) p & global_controls) != global_controls)
+            continue;
+
+        error |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &simulation->partition_buffers[p]);
+        error |= queue_kernel(simulation->partition_queues[p], kernel, 0, global_size,
+            local_size, target, simulation);
+    }
+
+    error |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't enqueue a kernel on the partitions");
+        exit(1);
+    }
+}
+
+/**
+ * @brief Sets a complex kernel argument in the simulation's precision.
+ * @param kernel The kernel whose argument to set
+ * @param index The index of the argument
+ * @param value The real and imaginary parts of the argument
+ * @param simulation The simulation running the kernel
+ * @return The error code of clSetKernelArg()
+ */
+static cl_int set_complex_arg(cl_kernel kernel, cl_uint index, const double value[2],
+    Simulation *simulation)
+{
+    float value_float[2] = {value[0], value[1]};
+
+    if(simulation->precision == PRECISION_DOUBLE)
+        return clSetKernelArg(kernel, index, sizeof(double)*2, value);
+
+    return clSetKernelArg(kernel, index, sizeof(float)*2, value_float);
+}
+
+/**
+ * @brief Reads reals of the simulation's precision from a buffer as doubles.
+ * The buffer is mapped rather than copied into a staging array, so buffers in
+ * host memory are converted in place without any transfer.
+ * @param buffer The buffer to read from
+ * @param size The number of reals to read
+ * @param output The array in which to store the reals
+ * @param simulation The simulation owning the buffer
+ * @return The error code of clEnqueueMapBuffer() or clEnqueueUnmapMemObject()
+ */
+static cl_int read_reals(cl_mem buffer, size_t size, double *output,
+    Simulation *simulation)
+{
+    cl_int error;
+    void *reals;
+
+    order_partitions(PARTITION_WHOLE, simulation);
+
+    reals = clEnqueueMapBuffer(simulation->queue, buffer, CL_TRUE, CL_MAP_READ, 0,
+        precision_size(simulation->precision)*size, 0, NULL, NULL, &error);
+    if(error < 0)
+        return error;
+
+    if(simulation->precision == PRECISION_DOUBLE)
+        memcpy(output, reals, sizeof(double)*size);
+    else
+        for(size_t i=0; i<size; i++)
+            output[i] = ((float *) reals)[i];
+
+    return clEnqueueUnmapMemObject(simulation->queue, buffer, reals, 0, NULL, NULL);
+}
+
+/**
+ * Reads the state vector from the GPU'memory and stores it in the state array.
+ * Useful for debugging quantum algorithms.
+ * @param state An array to hold the state buffer, must be at least of size
+ * simulation->num_amplitudes * 2
+ * @param simulation The simulation to test
+ */
+void opencl_test_state_vector(double *state, Simulation *simulation)
+{
+    cl_int error;
+
+    error = read_reals(simulation->state_vector_buffer, simulation->num_amp*2, state,
+        simulation);
+    if(error < 0) {
+        printf("error: %d\n", error);
+        perror("Couldn't enqueue the read state command");
+        exit(1);   
+    }
+    
+    return;
+}
+
+/**
+ * @brief Releases the partitions of a simulation's state once queued
+ * commands on them finish.
+ * @param simulation The simulation whose state is partitioned
+ */
+static void release_partitions(Simulation *simulation)
+{
+    for(int p=0; p<simulation->num_partitions; p++) {
+        clFinish(simulation->partition_queues[p]);
+        if(simulation->partition_buffers[p])
+            clReleaseMemObject(simulation->partition_buffers[p]);
+        simulation->partition_buffers[p] = NULL;
+    }
+
+    simulation->num_partitions = 1;
+    simulation->partition_work = PARTITION_JOINED;
+}
+
+/**
+ * Releases all OpenCL objects associated with a simulation.
+ * @param simulation A simulation object which is no longer in use
+ */
+void opencl_deallocate_resources(Simulation *simulation)
+{
+    if(simulation->profiled_launches) {
+        opencl_collect_profile(simulation);
+        free(simulation->profiled_launches);
+    }
+
+    if(simulation->apply_gate_kernel)
+        clReleaseKernel(simulation->apply_gate_kernel);
+    
+    if(simulation->apply_controlled_gate_kernel)
+        clReleaseKernel(simulation->apply_controlled_gate_kernel);
+    
+    if(simulation->apply_double_controlled_gate_kernel)
+        clReleaseKernel(simulation->apply_double_controlled_gate_kernel);
+
+    if(simulation->measure_kernel)
+        clReleaseKernel(simulation->measure_kernel);
+
+    if(simulation->initialise_state_kernel)
+        clReleaseKernel(simulation->initialise_state_kernel);
+
+    if(simulation->apply_dense_gate_kernel)
+        clReleaseKernel(simulation->apply_dense_gate_kernel);
+
+    if(simulation->apply_multi_controlled_gate_kernel)
+        clReleaseKernel(simulation->apply_multi_controlled_gate_kernel);
+
+    if(simulation->apply_diagonal_gate_kernel)
+        clReleaseKernel(simulation->apply_diagonal_gate_kernel);
+
+    if(simulation->apply_permutation_gate_kernel)
+        clReleaseKernel(simulation->apply_permutation_gate_kernel);
+
+    if(simulation->apply_gate_list_kernel)
+        clReleaseKernel(simulation->apply_gate_list_kernel);
+
+    if(simulation->apply_gate_tile_kernel)
+        clReleaseKernel(simulation->apply_gate_tile_kernel);
+
+    if(simulation->reduce_qubit_marginals_kernel)
+        clReleaseKernel(simulation->reduce_qubit_marginals_kernel);
+
+    if(simulation->reduce_register_kernel)
+        clReleaseKernel(simulation->reduce_register_kernel);
+
+    if(simulation->sum_partials_kernel)
+        clReleaseKernel(simulation->sum_partials_kernel);
+
+    if(simulation->probability_histogram_kernel)
+        clReleaseKernel(simulation->probability_histogram_kernel);
+
+    if(simulation->select_top_k_kernel)
+        clReleaseKernel(simulation->select_top_k_kernel);
+
+    if(simulation->sum_blocks_kernel)
+        clReleaseKernel(simulation->sum_blocks_kernel);
+
+    if(simulation->sample_in_blocks_kernel)
+        clReleaseKernel(simulation->sample_in_blocks_kernel);
+
+    if(simulation->pauli_group_sums_kernel)
+        clReleaseKernel(simulation->pauli_group_sums_kernel);
+
+    if(simulation->apply_global_gate_kernel)
+        clReleaseKernel(simulation->apply_global_gate_kernel);
+
+    for(int i=0; i<simulation->num_kernel_variants; i++) {
+        if(simulation->kernel_variants[i].kernel)
+            clReleaseKernel(simulation->kernel_variants[i].kernel);
+        if(simulation->kernel_variants[i].program)
+            clReleaseProgram(simulation->kernel_variants[i].program);
+    }
+    free(simulation->kernel_variants);
+
+    if(simulation->partition_buffers) {
+        release_partitions(simulation);
+        free(simulation->partition_buffers);
+    }
+
+    for(int p=1; p<simulation->num_partition_devices; p++)
+        clReleaseCommandQueue(simulation->partition_queues[p]);
+    free(simulation->partition_queues);
+
+    if(simulation->sub_devices)
+        for(int p=0; p<simulation->num_partition_devices; p++)
+            clReleaseDevice(simulation->partition_devices[p]);
+    free(simulation->partition_devices);
+
+    if(simulation->dense_matrix_buffer)
+        clReleaseMemObject(simulation->dense_matrix_buffer);
+
+    if(simulation->state_vector_buffer)
+        clReleaseMemObject(simulation->state_vector_buffer);
+
+    if(simulation->probability_buffer)
+        clReleaseMemObject(simulation->probability_buffer);
+
+    if(simulation->back_probability_buffer)
+        clReleaseMemObject(simulation->back_probability_buffer);
+
+    if(simulation->queue)
+        clReleaseCommandQueue(simulation->queue);
+
+    if(simulation->program)
+        clReleaseProgram(simulation->program);
+
+    if(simulation->context)
+        clReleaseContext(simulation->context);
+
+    return;
+}
+
+/**
+ * Meaures all registers of a simulation and stores the probabilities of a
+ * qubit collapsing to each state in the simulation's probabilities array.
+ * @param simulation The simulation to be measured
+ */
+void opencl_measure(Simulation *simulation)
+{
+    const size_t num_op = simulation->num_amp;
+    cl_int error;
+
+    error = clSetKernelArg(simulation->measure_kernel, 1,
+        sizeof(cl_mem), &simulation->probability_buffer);
+    error |= enqueue_kernel(simulation->measure_kernel, num_op, simulation);
+    
+    if(error < 0) {
+        perror("Couldn't enqueue the measure execution command");
+        exit(1); 
+    }
+
+    error = read_reals(simulation->probability_buffer, simulation->num_amp,
+        simulation->probabilities, simulation);
+    
+    if(error < 0) {
+        perror("Couldn't enqueue the read buffer command");
+        exit(1);   
+    }
+    
+    return;
+}
+
+/**
+ * @brief Finishes an asynchronous read once its data is on the host.
+ * Converts single precision values to doubles before completing the result.
+ * Runs on a thread of the OpenCL runtime, so a failed read only records its
+ * status for wait_result() to report.
+ * @param event The event of the read command
+ * @param status The execution status of the read command
+ * @param data The AsyncResult of the read
+ */
+static void CL_CALLBACK read_complete(cl_event event, cl_int status, void *data)
+{
+    AsyncResult *result = (AsyncResult *) data;
+    const float *reals = (const float *) result->staging;
+
+    (void) event;
+
+    if(status < 0) {
+        result->status = status;
+        complete_result(result);
+        return;
+    }
+
+    if(reals)
+        for(size_t i=0; i<result->size; i++)
+            result->values[i] = reals[i];
+
+    complete_result(result);
+}
+
+/**
+ * @brief Enqueues a non-blocking read of a buffer into a result.
+ * Single precision values are read into a staging array and converted when
+ * the read completes.
+ * @param buffer The buffer to read from
+ * @param result The result to hold the values
+ * @param simulation The simulation owning the buffer
+ */
+static void enqueue_async_read(cl_mem buffer, AsyncResult *result, Simulation *simulation)
+{
+    void *destination = result->values;
+    size_t size = sizeof(double)*result->size;
+    cl_int error;
+
+    if(simulation->precision == PRECISION_SINGLE) {
+        size = sizeof(float)*result->size;
+        result->staging = malloc(size);
+        if(!result->staging) {
+            fprintf(stderr, "error: unable to allocate read buffer.\n");
+            exit(EXIT_FAILURE);
+        }
+        destination = result->staging;
+    }
+
+    order_partitions(PARTITION_WHOLE, simulation);
+
+    error = clEnqueueReadBuffer(simulation->queue, buffer, CL_FALSE, 0, size,
+        destination, 0, NULL, &result->event);
+    if(error < 0) {
+        perror("Couldn't enqueue the read buffer command");
+        exit(1);
+    }
+
+    error = clSetEventCallback(result->event, CL_COMPLETE, read_complete, result);
+    error |= clFlush(simulation->queue);
+    if(error < 0) {
+        perror("Couldn't set the read buffer callback");
+        exit(1);
+    }
+}
+
+/**
+ * @brief Measures all registers of a simulation without waiting for the result.
+ * The second of the double buffered probability buffers is created the first
+ * time it is used.
+ * @param result The result to hold the probabilities, with its slot chosen
+ * @param simulation The simulation to be measured
+ */
+void opencl_measure_async(AsyncResult *result, Simulation *simulation)
+{
+    cl_mem buffer = simulation->probability_buffer;
+    cl_int error;
+
+    if(result->slot == 1) {
+        if(!simulation->back_probability_buffer) {
+            simulation->back_probability_buffer = clCreateBuffer(simulation->context,
+                CL_MEM_WRITE_ONLY, precision_size(simulation->precision)*simulation->num_amp,
+                NULL, &error);
+            if(error < 0) {
+                perror("Couldn't create a buffer object");
+                exit(1);
+            }
+        }
+        buffer = simulation->back_probability_buffer;
+    }
+
+    error = clSetKernelArg(simulation->measure_kernel, 1, sizeof(cl_mem), &buffer);
+    error |= enqueue_kernel(simulation->measure_kernel, simulation->num_amp, simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the measure execution command");
+        exit(1);
+    }
+
+    enqueue_async_read(buffer, result, simulation);
+}
+
+/**
+ * @brief Reads the state vector without waiting for the result.
+ * @param result The result to hold the interleaved state vector
+ * @param simulation The simulation to read
+ */
+void opencl_read_state_async(AsyncResult *result, Simulation *simulation)
+{
+    enqueue_async_read(simulation->state_vector_buffer, result, simulation);
+}
+
+/**
+ * @brief Reads the column sums of rows of partial sums in the probability buffer.
+ * More than one row is summed on the device first.
+ * @param num_rows The number of rows of partial sums
+ * @param num_columns The number of partial sums in each row
+ * @param sums An array to hold the num_columns sums
+ * @param simulation The simulation holding the partial sums
+ */
+static void read_partial_sums(size_t num_rows, int num_columns, double *sums,
+    Simulation *simulation)
+{
+    cl_mem sums_buffer;
+    cl_ulong rows = num_rows;
+    cl_int error;
+
+    if(num_rows == 1) {
+        error = read_reals(simulation->probability_buffer, num_columns, sums, simulation);
+        if(error < 0) {
+            perror("Couldn't enqueue the read buffer command");
+            exit(1);
+        }
+        return;
+    }
+
+    sums_buffer = clCreateBuffer(simulation->context, CL_MEM_WRITE_ONLY,
+        precision_size(simulation->precision)*num_columns, NULL, &error);
+    if(error < 0) {
+        perror("Couldn't create a buffer object");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->sum_partials_kernel, 0, sizeof(cl_mem),
+        &simulation->probability_buffer);
+    error |= clSetKernelArg(simulation->sum_partials_kernel, 1, sizeof(cl_mem),
+        &sums_buffer);
+    error |= clSetKernelArg(simulation->sum_partials_kernel, 2, sizeof(cl_ulong), &rows);
+    error |= clSetKernelArg(simulation->sum_partials_kernel, 3, sizeof(cl_int),
+        &num_columns);
+    error |= enqueue_kernel(simulation->sum_partials_kernel, num_columns, simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the sum partials execution command");
+        exit(1);
+    }
+
+    error = read_reals(sums_buffer, num_columns, sums, simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the read buffer command");
+        exit(1);
+    }
+
+    clReleaseMemObject(sums_buffer);
+}
+
+/**
+ * Sums the probability of every state and of each qubit being one on the
+ * device. Each work group writes a row of partial sums to the probability
+ * buffer, and only the num_qubits+1 column sums are read back.
+ * @param sums An array to hold the total followed by the probability of each
+ * qubit being one
+ * @param simulation The simulation to reduce
+ */
+void opencl_reduce_qubit_marginals(double *sums, Simulation *simulation)
+{
+    const cl_int num_qubits = (cl_int) log2(simulation->num_amp);
+    const cl_int item_qubits = num_qubits < REDUCE_ITEM_QUBITS ? num_qubits :
+        REDUCE_ITEM_QUBITS;
+    const size_t global_size = simulation->num_amp >> item_qubits;
+    const size_t local_size = get_local_size(global_size, simulation);
+    cl_kernel kernel = simulation->reduce_qubit_marginals_kernel;
+    cl_int error;
+
+    error = clSetKernelArg(kernel, 1, sizeof(cl_mem), &simulation->probability_buffer);
+    error |= clSetKernelArg(kernel, 2, sizeof(cl_int), &num_qubits);
+    error |= clSetKernelArg(kernel, 3, sizeof(cl_int), &item_qubits);
+    error |= clSetKernelArg(kernel, 4, precision_size(simulation->precision)*local_size,
+        NULL);
+    error |= enqueue_kernel(kernel, global_size, simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the reduce qubit marginals execution command");
+        exit(1);
+    }
+
+    read_partial_sums(global_size/local_size, num_qubits+1, sums, simulation);
+}
+
+/**
+ * Computes the probability of each value of a register of any qubits on the
+ * device, see marginal(). Small registers are summed in
+ * REDUCE_REGISTER_ITEMS/2^k rows of partial histograms to keep the device
+ * busy, and only the 2^k values are read.
+ * @param qubit_mask A mask of the qubits in the register
+ * @param probabilities An array to hold the 2^k probabilities of the k qubits
+ * @param simulation The simulation to reduce
+ */
+void opencl_marginal(size_t qubit_mask, double *probabilities, Simulation *simulation)
+{
+    const cl_ulong mask = qubit_mask;
+    size_t num_values = 1;
+    cl_ulong num_rest, num_rows;
+    cl_kernel kernel = simulation->reduce_register_kernel;
+    cl_int error;
+
+    for(; qubit_mask; qubit_mask &= qubit_mask-1)
+        num_values *= 2;
+    num_rest = simulation->num_amp/num_values;
+    num_rows = REDUCE_REGISTER_ITEMS/num_values;
+
+    if(num_rows < 1)
+        num_rows = 1;
+    if(num_rows > num_rest)
+        num_rows = num_rest;
+
+    error = clSetKernelArg(kernel, 1, sizeof(cl_mem), &simulation->probability_buffer);
+    error |= clSetKernelArg(kernel, 2, sizeof(cl_ulong), &mask);
+    error |= clSetKernelArg(kernel, 3, sizeof(cl_ulong), &num_rest);
+    error |= clSetKernelArg(kernel, 4, sizeof(cl_ulong), &num_rows);
+    error |= enqueue_kernel(kernel, num_values*num_rows, simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the reduce register execution command");
+        exit(1);
+    }
+
+    read_partial_sums(num_rows, (int) num_values, probabilities, simulation);
+}
+
+/**
+ * Sums the probabilities of blocks of consecutive states on the device with
+ * the sum_blocks() kernel, one work item per block, see sample(). The sums
+ * are written to the probability buffer and read back directly.
+ * @param block_qubits The number of qubits varying within a block
+ * @param sums An array to hold the sum of each block
+ * @param simulation The simulation to reduce
+ */
+void opencl_sum_blocks(int block_qubits, double *sums, Simulation *simulation)
+{
+    const size_t num_blocks = simulation->num_amp >> block_qubits;
+    cl_kernel kernel = simulation->sum_blocks_kernel;
+    cl_int error;
+
+    error = clSetKernelArg(kernel, 1, sizeof(cl_mem), &simulation->probability_buffer);
+    error |= clSetKernelArg(kernel, 2, sizeof(cl_int), &block_qubits);
+    error |= enqueue_kernel(kernel, num_blocks, simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the sum blocks execution command");
+        exit(1);
+    }
+
+    error = read_reals(simulation->probability_buffer, num_blocks, sums, simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the read buffer command");
+        exit(1);
+    }
+}
+
+/**
+ * Resolves shots drawn within blocks of consecutive states to the states
+ * they land on with the sample_in_blocks() kernel, see sample(). Only the
+ * shots' blocks and residuals are written and their states read back.
+ * @param block_qubits The number of qubits varying within a block
+ * @param num_shots The number of shots
+ * @param indices The block of each shot, replaced by the state it lands on
+ * @param residuals How far into its block's probability each shot lands
+ * @param simulation The simulation being sampled
+ */
+void opencl_sample_blocks(int block_qubits, size_t num_shots, size_t *indices,
+    const double *residuals, Simulation *simulation)
+{
+    const size_t real_size = precision_size(simulation->precision);
+    const size_t global_size = (num_shots + simulation->work_group_size - 1)/
+        simulation->work_group_size*simulation->work_group_size;
+    cl_kernel kernel = simulation->sample_in_blocks_kernel;
+    cl_ulong *blocks = (cl_ulong *) malloc(sizeof(cl_ulong)*num_shots);
+    float *residuals_float = (float *) malloc(sizeof(float)*num_shots);
+    const cl_ulong shots = num_shots;
+    cl_mem blocks_buffer, residuals_buffer;
+    cl_int error;
+
+    if(!blocks || !residuals_float) {
+        fprintf(stderr, "error: unable to allocate shots.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i=0; i<num_shots; i++) {
+        blocks[i] = indices[i];
+        residuals_float[i] = residuals[i];
+    }
+
+    blocks_buffer = clCreateBuffer(simulation->context,
+        CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_ulong)*num_shots, blocks,
+        &error);
+    if(error < 0) {
+        perror("Couldn't create a buffer object");
+        exit(1);
+    }
+
+    residuals_buffer = clCreateBuffer(simulation->context,
+        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, real_size*num_shots,
+        simulation->precision == PRECISION_DOUBLE ? (void *) residuals :
+        (void *) residuals_float, &error);
+    if(error < 0) {
+        perror("Couldn't create a buffer object");
+        exit(1);
+    }
+
+    error = clSetKernelArg(kernel, 1, sizeof(cl_mem), &blocks_buffer);
+    error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &residuals_buffer);
+    error |= clSetKernelArg(kernel, 3, sizeof(cl_int), &block_qubits);
+    error |= clSetKernelArg(kernel, 4, sizeof(cl_ulong), &shots);
+    error |= launch_kernel(kernel, global_size, simulation->work_group_size, -1,
+        simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the sample in blocks execution command");
+        exit(1);
+    }
+
+    error = clEnqueueReadBuffer(simulation->queue, blocks_buffer, CL_TRUE, 0,
+        sizeof(cl_ulong)*num_shots, blocks, 0, NULL, NULL);
+    if(error < 0) {
+        perror("Couldn't read the sampled states");
+        exit(1);
+    }
+
+    for(size_t i=0; i<num_shots; i++)
+        indices[i] = blocks[i];
+
+    clReleaseMemObject(blocks_buffer);
+    clReleaseMemObject(residuals_buffer);
+    free(blocks);
+    free(residuals_float);
+}
+
+/**
+ * Sums each Pauli string of a group sharing one X mask on the device, see
+ * expectation(). The terms are summed in rows of partial sums, as many as
+ * REDUCE_REGISTER_ITEMS work items allow, and only one sum per term is read
+ * back. Groups larger than that are split across launches.
+ * @param x_mask The X mask shared by the group
+ * @param num_terms The number of terms in the group
+ * @param z_masks The Z mask of each term
+ * @param sums An array to hold the num_terms sums
+ * @param simulation The simulation to reduce
+ */
+void opencl_pauli_group_sums(size_t x_mask, size_t num_terms, const size_t *z_masks,
+    double *sums, Simulation *simulation)
+{
+    const size_t max_terms = simulation->num_amp < REDUCE_REGISTER_ITEMS ?
+        simulation->num_amp : REDUCE_REGISTER_ITEMS;
+    const cl_ulong x = x_mask, num_pairs = x_mask ? simulation->num_amp/2 :
+        simulation->num_amp;
+    cl_kernel kernel = simulation->pauli_group_sums_kernel;
+    cl_ulong *masks, terms, num_rows;
+    cl_mem masks_buffer;
+    cl_int error;
+
+    for(size_t first=0; first<num_terms; first+=terms) {
+        terms = num_terms - first < max_terms ? num_terms - first : max_terms;
+        for(num_rows=1; 2*num_rows*terms <= REDUCE_REGISTER_ITEMS &&
+            2*num_rows <= num_pairs && 2*num_rows*terms <= simulation->num_amp;)
+            num_rows *= 2;
+
+        masks = (cl_ulong *) malloc(sizeof(cl_ulong)*terms);
+        if(!masks) {
+            fprintf(stderr, "error: unable to allocate Pauli masks.\n");
+            exit(EXIT_FAILURE);
+        }
+        for(size_t i=0; i<terms; i++)
+            masks[i] = z_masks[first+i];
+
+        masks_buffer = clCreateBuffer(simulation->context,
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_ulong)*terms, masks,
+            &error);
+        if(error < 0) {
+            perror("Couldn't create a buffer object");
+            exit(1);
+        }
+
+        error = clSetKernelArg(kernel, 1, sizeof(cl_mem), &simulation->probability_buffer);
+        error |= clSetKernelArg(kernel, 2, sizeof(cl_ulong), &x);
+        error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &masks_buffer);
+        error |= clSetKernelArg(kernel, 4, sizeof(cl_ulong), &terms);
+        error |= clSetKernelArg(kernel, 5, sizeof(cl_ulong), &num_pairs);
+        error |= clSetKernelArg(kernel, 6, sizeof(cl_ulong), &num_rows);
+        error |= enqueue_kernel(kernel, terms*num_rows, simulation);
+        if(error < 0) {
+            perror("Couldn't enqueue the pauli group sums execution command");
+            exit(1);
+        }
+
+        read_partial_sums(num_rows, (int) terms, sums + first, simulation);
+
+        clReleaseMemObject(masks_buffer);
+        free(masks);
+    }
+}
+
+/**
+ * Finds the k most probable states, in no particular order, by a radix
+ * select over the bits of the probabilities. Each pass histograms one 8 bit
+ * digit of the probabilities whose higher digits match the states chosen so
+ * far, until the digits pick out exactly the k-th largest probability, and a
+ * last pass gathers the states above it and enough of those equal to it.
+ * Only the histograms and the k states are read back.
+ * @param k The number of states to find, at most simulation->num_amp
+ * @param indices An array to hold the k states
+ * @param probabilities An array to hold the k probabilities
+ * @param simulation The simulation to search
+ */
+void opencl_top_k(size_t k, size_t *indices, double *probabilities, Simulation *simulation)
+{
+    const size_t global_size = simulation->num_amp < HISTOGRAM_ITEMS ?
+        simulation->num_amp : HISTOGRAM_ITEMS;
+    const cl_uint zeros[2*HISTOGRAM_BINS] = {0};
+    cl_uint counts[2*HISTOGRAM_BINS], num_above, num_ties;
+    cl_ulong num_amp = simulation->num_amp, prefix = 0, count = 0, remaining = k;
+    cl_ulong *selected;
+    cl_int shift, bin, error;
+    cl_mem counts_buffer, indices_buffer, probabilities_buffer;
+
+    counts_buffer = clCreateBuffer(simulation->context, CL_MEM_READ_WRITE,
+        sizeof(counts), NULL, &error);
+    if(error < 0) {
+        perror("Couldn't create a buffer object");
+        exit(1);
+    }
+
+    for(shift=8*precision_size(simulation->precision)-8; ; shift-=8) {
+        error = clEnqueueWriteBuffer(simulation->queue, counts_buffer, CL_TRUE, 0,
+            sizeof(zeros), zeros, 0, NULL, NULL);
+        error |= clSetKernelArg(simulation->probability_histogram_kernel, 1,
+            sizeof(cl_mem), &counts_buffer);
+        error |= clSetKernelArg(simulation->probability_histogram_kernel, 2,
+            sizeof(cl_ulong), &num_amp);
+        error |= clSetKernelArg(simulation->probability_histogram_kernel, 3,
+            sizeof(cl_ulong), &prefix);
+        error |= clSetKernelArg(simulation->probability_histogram_kernel, 4,
+            sizeof(cl_int), &shift);
+        error |= enqueue_kernel(simulation->probability_histogram_kernel, global_size,
+            simulation);
+        error |= clEnqueueReadBuffer(simulation->queue, counts_buffer, CL_TRUE, 0,
+            sizeof(counts), counts, 0, NULL, NULL);
+        if(error < 0) {
+            perror("Couldn't enqueue the probability histogram execution command");
+            exit(1);
+        }
+
+        // Find the bin holding the remaining-th largest probability
+        for(bin=HISTOGRAM_BINS-1; bin>0; bin--) {
+            count = counts[2*bin] | (cl_ulong) counts[2*bin+1] << 32;
+            if(count >= remaining)
+                break;
+            remaining -= count;
+        }
+        if(bin == 0)
+            count = counts[0] | (cl_ulong) counts[1] << 32;
+
+        prefix = (prefix << 8) | bin;
+        if(count == remaining || shift == 0)
+            break;
+    }
+
+    num_above = k - remaining;
+    num_ties = remaining;
+
+    indices_buffer = clCreateBuffer(simulation->context, CL_MEM_WRITE_ONLY,
+        sizeof(cl_ulong)*k, NULL, &error);
+    if(error < 0) {
+        perror("Couldn't create a buffer object");
+        exit(1);
+    }
+
+    probabilities_buffer = clCreateBuffer(simulation->context, CL_MEM_WRITE_ONLY,
+        precision_size(simulation->precision)*k, NULL, &error);
+    if(error < 0) {
+        perror("Couldn't create a buffer object");
+        exit(1);
+    }
+
+    error = clEnqueueWriteBuffer(simulation->queue, counts_buffer, CL_TRUE, 0,
+        sizeof(cl_uint)*2, zeros, 0, NULL, NULL);
+    error |= clSetKernelArg(simulation->select_top_k_kernel, 1, sizeof(cl_mem),
+        &indices_buffer);
+    error |= clSetKernelArg(simulation->select_top_k_kernel, 2, sizeof(cl_mem),
+        &probabilities_buffer);
+    error |= clSetKernelArg(simulation->select_top_k_kernel, 3, sizeof(cl_mem),
+        &counts_buffer);
+    error |= clSetKernelArg(simulation->select_top_k_kernel, 4, sizeof(cl_ulong),
+        &num_amp);
+    error |= clSetKernelArg(simulation->select_top_k_kernel, 5, sizeof(cl_ulong),
+        &prefix);
+    error |= clSetKernelArg(simulation->select_top_k_kernel, 6, sizeof(cl_int), &shift);
+    error |= clSetKernelArg(simulation->select_top_k_kernel, 7, sizeof(cl_uint),
+        &num_above);
+    error |= clSetKernelArg(simulation->select_top_k_kernel, 8, sizeof(cl_uint),
+        &num_ties);
+    error |= enqueue_kernel(simulation->select_top_k_kernel, global_size, simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the select top k execution command");
+        exit(1);
+    }
+
+    selected = (cl_ulong *) malloc(sizeof(cl_ulong)*k);
+    if(!selected) {
+        fprintf(stderr, "error: unable to allocate top k states.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    error = clEnqueueReadBuffer(simulation->queue, indices_buffer, CL_TRUE, 0,
+        sizeof(cl_ulong)*k, selected, 0, NULL, NULL);
+    error |= read_reals(probabilities_buffer, k, probabilities, simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the read buffer command");
+        exit(1);
+    }
+
+    for(size_t i=0; i<k; i++)
+        indices[i] = selected[i];
+
+    free(selected);
+    clReleaseMemObject(counts_buffer);
+    clReleaseMemObject(indices_buffer);
+    clReleaseMemObject(probabilities_buffer);
+}
+
+/**
+ * @brief Uploads gates of a list to a new buffer of gate descriptors.
+ * Identity gates are left out.
+ * @param list The list holding the gates
+ * @param indices The indices of the gates to upload, in order, or NULL to
+ * upload the first num_indices operations of the list
+ * @param num_indices The number of gates to upload
+ * @param num_gates Set to the number of gates uploaded
+ * @param simulation The simulation which will run the gates
+ * @return The buffer, or NULL if every gate was the identity
+ */
+static cl_mem create_gate_buffer(OperationList *list, const int *indices,
+    int num_indices, cl_int *num_gates, Simulation *simulation)
+{
+    const size_t real_size = precision_size(simulation->precision);
+    const size_t descriptor_size = sizeof(GateDescriptorHeader) + 8*real_size;
+    GateDescriptorHeader header;
+    Operation *operation;
+    cl_mem gate_buffer;
+    char *descriptors, *matrix;
+    cl_int error;
+
+    *num_gates = 0;
+    descriptors = (char *) malloc(descriptor_size*num_indices);
+    if(!descriptors) {
+        fprintf(stderr, "error: unable to allocate gate descriptors.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i=0; i<num_indices; i++) {
+        operation = &list->operations[indices ? indices[i] : i];
+        header.control_mask = operation->control_mask;
+        header.target = operation->target;
+        header.kind = classify_gate(operation->gate);
+        if(header.kind == GATE_IDENTITY)
+            continue;
+
+        matrix = descriptors + descriptor_size*(*num_gates) + sizeof(GateDescriptorHeader);
+        memcpy(descriptors + descriptor_size*(*num_gates), &header,
+            sizeof(GateDescriptorHeader));
+        for(int j=0; j<8; j++)
+            if(simulation->precision == PRECISION_DOUBLE)
+                ((double *) matrix)[j] = operation->gate[j];
+            else
+                ((float *) matrix)[j] = operation->gate[j];
+        (*num_gates)++;
+    }
+
+    if(*num_gates == 0) {
+        free(descriptors);
+        return NULL;
+    }
+
+    gate_buffer = clCreateBuffer(simulation->context, CL_MEM_READ_ONLY |
+        CL_MEM_COPY_HOST_PTR, descriptor_size*(*num_gates), descriptors, &error);
+    free(descriptors);
+    if(error < 0) {
+        perror("Couldn't create a buffer object");
+        exit(1);
+    }
+
+    return gate_buffer;
+}
+
+/**
+ * Applies a list of gates with one launch of the apply_gate_list() kernel.
+ * The gates are uploaded as an array of descriptors. Each gate must see every
+ * amplitude written by the one before, and OpenCL only synchronises the work
+ * items of one work group, so the list runs on a single work group and so a
+ * single compute unit. That beats one launch per gate spread over the whole
+ * device only while the work group's pass over the state takes no longer than
+ * a launch. A pass over 2^16 single precision amplitudes moves 1 MB, around
+ * 10 microseconds for one compute unit of a current GPU and of the same order
+ * as a launch, hence the default limit of 16 qubits. The limit is
+ * simulation->gate_list_qubits (options or SIMULATION_GATE_LIST_QUBITS), so it
+ * can be tuned to a device with the gate list table of `make run_benchmark`.
+ * @param list The operations to apply
+ * @param simulation The simulation on which to apply the gates
+ * @return 0 on success, -1 if the state has more than
+ * simulation->gate_list_qubits qubits or the list holds dense operations, so
+ * it must be applied one operation at a time
+ */
+int opencl_apply_gate_list(OperationList *list, Simulation *simulation)
+{
+    size_t work_group_size = simulation->gate_list_work_group_size;
+    cl_ulong num_pairs = simulation->num_amp/2;
+    cl_int error, num_gates;
+    cl_mem gate_buffer;
+
+    if(simulation->gate_list_qubits < (int) (8*sizeof(size_t)) &&
+        simulation->num_amp > (size_t) 1 << simulation->gate_list_qubits)
+        return -1;
+
+    for(int i=0; i<list->num_operations; i++)
+        if(list->operations[i].type == DENSE_OPERATION)
+            return -1;
+
+    gate_buffer = create_gate_buffer(list, NULL, list->num_operations, &num_gates,
+        simulation);
+    if(!gate_buffer)
+        return 0;
+
+    error = clSetKernelArg(simulation->apply_gate_list_kernel, 1, sizeof(cl_mem),
+        &gate_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_gate_list's gates argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_gate_list_kernel, 2, sizeof(cl_int),
+        &num_gates);
+    if(error < 0) {
+        perror("Couldn't set apply_gate_list's num_gates argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_gate_list_kernel, 3, sizeof(cl_ulong),
+        &num_pairs);
+    if(error < 0) {
+        perror("Couldn't set apply_gate_list's num_pairs argument");
+        exit(1);
+    }
+
+    if(work_group_size > num_pairs)
+        work_group_size = num_pairs;
+
+    error = launch_kernel(simulation->apply_gate_list_kernel, work_group_size,
+        work_group_size, -1, simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the apply gate list kernel");
+        exit(1);
+    }
+
+    // The buffer is only freed once the kernel using it has finished
+    clReleaseMemObject(gate_buffer);
+
+    return 0;
+}
+
+/**
+ * @brief Applies a run of gates on low qubits one tile at a time.
+ * Every work group of the apply_gate_tile() kernel applies the whole run to
+ * a tile of 2^simulation->block_qubits amplitudes held in local memory.
+ * @param list The list holding the gates
+ * @param run The indices of the gates, all below simulation->block_qubits
+ * @param num_run The number of gates in the run
+ * @param simulation The simulation on which to apply the gates
+ */
+static void run_tiled(OperationList *list, const int *run, int num_run,
+    Simulation *simulation)
+{
+    const size_t tile_size = (size_t) 1 << simulation->block_qubits;
+    const size_t local_size = simulation->tile_work_group_size;
+    const size_t global_size = (simulation->num_amp/tile_size)*local_size;
+    cl_int error, num_gates;
+    cl_mem gate_buffer;
+
+    if(num_run == 0)
+        return;
+
+    if(num_run == 1) {
+        opencl_apply_operation(&list->operations[run[0]], simulation);
+        return;
+    }
+
+    gate_buffer = create_gate_buffer(list, run, num_run, &num_gates, simulation);
+    if(!gate_buffer)
+        return;
+
+    error = clSetKernelArg(simulation->apply_gate_tile_kernel, 1, sizeof(cl_mem),
+        &gate_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_gate_tile's gates argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_gate_tile_kernel, 2, sizeof(cl_int),
+        &num_gates);
+    if(error < 0) {
+        perror("Couldn't set apply_gate_tile's num_gates argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_gate_tile_kernel, 3, sizeof(int),
+        &simulation->block_qubits);
+    if(error < 0) {
+        perror("Couldn't set apply_gate_tile's tile_qubits argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_gate_tile_kernel, 4,
+        2*precision_size(simulation->precision)*tile_size, NULL);
+    if(error < 0) {
+        perror("Couldn't set apply_gate_tile's tile argument");
+        exit(1);
+    }
+
+    // Tiles are never larger than a partition, so each partition runs its own
+    if(simulation->num_partitions > 1) {
+        launch_partitions(simulation->apply_gate_tile_kernel, 0,
+            global_size/simulation->num_partitions, local_size, -1, simulation);
+    } else {
+        error = launch_kernel(simulation->apply_gate_tile_kernel, global_size, local_size,
+            -1, simulation);
+        if(error < 0) {
+            perror("Couldn't enqueue the apply gate tile kernel");
+            exit(1);
+        }
+    }
+
+    clReleaseMemObject(gate_buffer);
+}
+
+/**
+ * @brief Fuses the given operations of a list and applies them in order.
+ * @param list The list holding the operations
+ * @param indices The indices of the operations, in order
+ * @param num_indices The number of indices
+ * @param simulation The simulation on which to apply the operations
+ */
+static void run_fused(OperationList *list, const int *indices, int num_indices,
+    Simulation *simulation)
+{
+    OperationList *operations = initialise_operation_list(), *fused;
+
+    for(int i=0; i<num_indices; i++)
+        append_operation(&list->operations[indices[i]], operations);
+
+    fused = fuse_operations(operations, simulation->max_fused_qubits, NULL);
+    for(int i=0; i<fused->num_operations; i++)
+        opencl_apply_operation(&fused->operations[i], simulation);
+
+    free_operation_list(operations);
+    free_operation_list(fused);
+}
+
+/**
+ * Applies an operation with any number of control qubits through the
+ * kernel for its class of gate.
+ * @param operation The operation to apply
+ * @param simulation The simulation on which to apply the operation
+ */
+void opencl_apply_operation(Operation *operation, Simulation *simulation)
+{
+    if(operation->type == DENSE_OPERATION) {
+        opencl_apply_dense_gate(operation, simulation);
+        return;
+    }
+
+    switch(classify_gate(operation->gate)) {
+        case GATE_IDENTITY:
+            break;
+        case GATE_DIAGONAL:
+            opencl_apply_diagonal_gate(operation->target, operation->control_mask,
+                operation->gate, simulation);
+            break;
+        case GATE_PERMUTATION:
+            opencl_apply_permutation_gate(operation->target, operation->control_mask,
+                simulation);
+            break;
+        default:
+            opencl_apply_multi_controlled_gate(operation->target, operation->control_mask,
+                operation->gate, simulation);
+    }
+}
+
+/**
+ * Applies a list of operations with as few passes over global memory as
+ * possible. Small states run the whole list with opencl_apply_gate_list().
+ * Otherwise gates acting only on qubits below simulation->block_qubits are
+ * gathered into runs, as on the CPU backend, and each run is applied with
+ * one launch of the apply_gate_tile() kernel. The other operations are
+ * fused and applied one at a time.
+ * @param list The operations to apply
+ * @param simulation The simulation on which to apply the operations
+ */
+void opencl_apply_operation_list(OperationList *list, Simulation *simulation)
+{
+    int num_run = 0, num_pending = 0;
+    int *run, *pending;
+    size_t low_mask, mask, pending_mask = 0;
+    Operation *operation;
+
+    if(opencl_apply_gate_list(list, simulation) == 0)
+        return;
+
+    low_mask = ((size_t) 1 << simulation->block_qubits) - 1;
+    run = (int *) malloc(sizeof(int)*(list->num_operations+1));
+    pending = (int *) malloc(sizeof(int)*(list->num_operations+1));
+
+    // The state must span more than one tile for tiling to help
+    if(simulation->num_amp <= low_mask + 1)
+        low_mask = 0;
+
+    for(int i=0; i<list->num_operations; i++) {
+        operation = &list->operations[i];
+        mask = get_qubit_mask(operation);
+
+        if(operation->type == DENSE_OPERATION || (mask & ~low_mask)) {
+            pending[num_pending++] = i;
+            pending_mask |= mask;
+            continue;
+        }
+
+        if(mask & pending_mask) {
+            run_tiled(list, run, num_run, simulation);
+            run_fused(list, pending, num_pending, simulation);
+            num_run = 0;
+            num_pending = 0;
+            pending_mask = 0;
+        }
+
+        run[num_run++] = i;
+    }
+
+    run_tiled(list, run, num_run, simulation);
+    run_fused(list, pending, num_pending, simulation);
+
+    free(run);
+    free(pending);
+}
+
+/**
+ * Uploads the matrix of a dense operation and queues the apply_dense_gate()
+ * kernel, which applies it to every group of amplitudes in one pass.
+ * @param operation The DENSE_OPERATION to apply
+ * @param simulation The simulation on which to apply the unitary
+ */
+void opencl_apply_dense_gate(Operation *operation, Simulation *simulation)
+{
+    cl_int error;
+    cl_ulong qubit_mask = get_qubit_mask(operation);
+    const size_t size = (size_t) 1 << (2*operation->num_qubits);
+    const size_t num_op = simulation->num_amp >> operation->num_qubits;
+    float matrix[2 << (2*MAX_FUSED_QUBITS)];
+
+    for(size_t i=0; i<2*size; i++)
+        matrix[i] = operation->matrix[i];
+
+    // The write blocks so the matrix may be reused for the next operation,
+    // and is ordered after every partition's use of the previous matrix
+    order_partitions(PARTITION_WHOLE, simulation);
+    if(simulation->precision == PRECISION_DOUBLE)
+        error = clEnqueueWriteBuffer(simulation->queue, simulation->dense_matrix_buffer,
+            CL_TRUE, 0, sizeof(double)*2*size, operation->matrix, 0, NULL, NULL);
+    else
+        error = clEnqueueWriteBuffer(simulation->queue, simulation->dense_matrix_buffer,
+            CL_TRUE, 0, sizeof(float)*2*size, matrix, 0, NULL, NULL);
+    if(error < 0) {
+        perror("Couldn't write the dense gate matrix");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_dense_gate_kernel, 2, sizeof(int),
+        &operation->num_qubits);
+    if(error < 0) {
+        perror("Couldn't set apply_dense_gate's num_qubits argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_dense_gate_kernel, 3, sizeof(cl_ulong),
+        &qubit_mask);
+    if(error < 0) {
+        perror("Couldn't set apply_dense_gate's qubit_mask argument");
+        exit(1);
+    }
+
+    // Unitaries on local qubits of a partitioned state run on each partition
+    if(simulation->num_partitions > 1 && !(qubit_mask >> simulation->local_qubits)) {
+        launch_partitions(simulation->apply_dense_gate_kernel, 0,
+            num_op/simulation->num_partitions,
+            get_local_size(num_op/simulation->num_partitions, simulation),
+            operation->qubits[0], simulation);
+        return;
+    }
+
+    enqueue_gate_kernel(simulation->apply_dense_gate_kernel, num_op, operation->qubits[0],
+        simulation);
+}
+
+/**
+ * Finds the kernel specialised to a gate configuration in the simulation's
+ * variant cache. Each configuration is counted, and the first time it has
+ * been used SPECIALISE_AFTER_USES times the program is built with its
+ * target, controls and class as constants, see apply_specialised_gate() in
+ * program.cl. Built binaries are cached on disk like the main program.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate_class The class of the gate, see classify_gate()
+ * @param simulation The simulation holding the variant cache
+ * @return The specialised kernel, or NULL until it is built or if the
+ * cache is full
+ */
+static cl_kernel get_specialised_kernel(int target, size_t control_mask,
+    GateClass gate_class, Simulation *simulation)
+{
+    KernelVariant *variant = NULL;
+    char build_options[128];
+    cl_int error;
+
+    for(int i=0; i<simulation->num_kernel_variants && !variant; i++)
+        if(simulation->kernel_variants[i].target == target &&
+            simulation->kernel_variants[i].control_mask == control_mask &&
+            simulation->kernel_variants[i].gate_class == gate_class)
+            variant = &simulation->kernel_variants[i];
+
+    if(!variant) {
+        if(simulation->num_kernel_variants == MAX_KERNEL_VARIANTS)
+            return NULL;
+
+        if(!simulation->kernel_variants) {
+            simulation->kernel_variants = (KernelVariant *) malloc(sizeof(KernelVariant)*
+                MAX_KERNEL_VARIANTS);
+            if(!simulation->kernel_variants) {
+                fprintf(stderr, "error: unable to allocate kernel variants.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        variant = &simulation->kernel_variants[simulation->num_kernel_variants++];
+        variant->target = target;
+        variant->control_mask = control_mask;
+        variant->gate_class = gate_class;
+        variant->uses = 0;
+        variant->program = NULL;
+        variant->kernel = NULL;
+    }
+
+    if(variant->kernel || ++variant->uses < SPECIALISE_AFTER_USES)
+        return variant->kernel;
+
+    snprintf(build_options, sizeof(build_options),
+        "-DSPECIALISED_GATE -DTARGET=%d -DCONTROL_MASK=%lluUL -DGATE_CLASS=%d%s", target,
+        (unsigned long long) control_mask, gate_class,
+        simulation->precision == PRECISION_DOUBLE ? " -DDOUBLE_PRECISION" : "");
+
+    variant->program = build_opencl_program(simulation->context,
+        simulation->num_partition_devices, simulation->partition_devices, build_options);
+
+    variant->kernel = clCreateKernel(variant->program, APPLY_SPECIALISED_GATE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply specialised gate kernel");
+        exit(1);
+    }
+
+    return variant->kernel;
+}
+
+/**
+ * Applies a gate with its specialised kernel if the variant cache holds one.
+ * Partitioned states and identity gates are never specialised.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param simulation The simulation on which to apply the gate
+ * @return true if the gate was applied, false if it must use a generic kernel
+ */
+static bool apply_specialised_gate(int target, size_t control_mask, const double gate[8],
+    Simulation *simulation)
+{
+    const GateClass gate_class = classify_gate(gate);
+    size_t num_op = simulation->num_amp/2;
+    cl_kernel kernel;
+    cl_int error;
+
+    if(!simulation->specialised_kernels || simulation->num_partitions > 1 ||
+        gate_class == GATE_IDENTITY)
+        return false;
+
+    kernel = get_specialised_kernel(target, control_mask, gate_class, simulation);
+    if(!kernel)
+        return false;
+
+    for(size_t bits=control_mask; bits; bits &= bits-1)
+        num_op /= 2;
+
+    error = clSetKernelArg(kernel, 0, sizeof(cl_mem), &simulation->state_vector_buffer);
+    for(int i=0; i<4; i++)
+        error |= set_complex_arg(kernel, 1+i, gate+2*i, simulation);
+    if(error < 0) {
+        perror("Couldn't set apply_specialised_gate's arguments");
+        exit(1);
+    }
+
+    enqueue_gate_kernel(kernel, num_op, target, simulation);
+
+    return true;
+}
+
+/**
+ * Applies a gate on a global qubit of a partitioned state with the
+ * apply_global_gate() kernel. The partitions differing only in the target
+ * are paired, and the update of each pair whose global controls are set is
+ * split between the devices of the two partitions, or run by the first if
+ * the devices do not share the host's memory.
+ * @param target The target qubit for the gate, a global qubit
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param simulation The simulation on which to apply the gate
+ */
+static void apply_global_gate(int target, size_t control_mask, const double gate[8],
+    Simulation *simulation)
+{
+    cl_kernel kernel = simulation->apply_global_gate_kernel;
+    const int local_qubits = simulation->local_qubits;
+    const size_t pair_bit = (size_t) 1 << (target - local_qubits);
+    const size_t global_controls = control_mask >> local_qubits;
+    cl_ulong mask = control_mask & (((size_t) 1 << local_qubits) - 1);
+    size_t num_op = (size_t) 1 << local_qubits, half;
+    cl_int error;
+
+    for(size_t bits=mask; bits; bits &= bits-1)
+        num_op /= 2;
+    half = simulation->unified_memory ? num_op/2 : 0;
+
+    error = clSetKernelArg(kernel, 2, sizeof(cl_ulong), &mask);
+    if(error < 0) {
+        perror("Couldn't set apply_global_gate's control_mask argument");
+        exit(1);
+    }
+
+    for(int i=0; i<4; i++) {
+        error = set_complex_arg(kernel, 3+i, gate+2*i, simulation);
+        if(error < 0) {
+            perror("Couldn't set apply_global_gate's gate arguments");
+            exit(1);
+        }
+    }
+
+    order_partitions(PARTITION_CROSS, simulation);
+
+    for(size_t p=0; p<(size_t) simulation->num_partitions; p++) {
+        if((p & pair_bit) || (p & global_controls) != global_controls)
+            continue;
+
+        error = clSetKernelArg(kernel, 0, sizeof(cl_mem), &simulation->partition_buffers[p]);
+        error |= clSetKernelArg(kernel, 1, sizeof(cl_mem),
+            &simulation->partition_buffers[p | pair_bit]);
+        error |= queue_kernel(simulation->partition_queues[p], kernel, 0, num_op - half,
+            get_local_size(num_op - half, simulation), target, simulation);
+        if(half)
+            error |= queue_kernel(simulation->partition_queues[p | pair_bit], kernel,
+                num_op - half, half, get_local_size(half, simulation), target, simulation);
+        if(error < 0) {
+            perror("Couldn't enqueue the apply global gate kernel");
+            exit(1);
+        }
+    }
+}
+
+/**
+ * Queues a gate kernel taking the state, target and control mask as its
+ * first arguments, with the rest of its arguments already set. On a
+ * partitioned state gates on local qubits run on each partition whose global
+ * controls are set, and gates on global qubits with apply_global_gate().
+ * @param kernel The kernel to queue
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param simulation The simulation on which to apply the gate
+ */
+static void enqueue_masked_gate(cl_kernel kernel, int target, size_t control_mask,
+    const double gate[8], Simulation *simulation)
+{
+    const bool partitioned = simulation->num_partitions > 1;
+    size_t num_op = simulation->num_amp/2, global_controls = 0;
+    cl_ulong mask = control_mask;
+    cl_int error;
+
+    if(apply_specialised_gate(target, control_mask, gate, simulation))
+        return;
+
+    if(partitioned && target >= simulation->local_qubits) {
+        apply_global_gate(target, control_mask, gate, simulation);
+        return;
+    }
+
+    if(partitioned) {
+        global_controls = control_mask >> simulation->local_qubits;
+        mask &= ((size_t) 1 << simulation->local_qubits) - 1;
+        num_op = (size_t) 1 << (simulation->local_qubits - 1);
+    }
+
+    for(size_t bits=mask; bits; bits &= bits-1)
+        num_op /= 2;
+
+    error = clSetKernelArg(kernel, 1, sizeof(int), &target);
+    error |= clSetKernelArg(kernel, 2, sizeof(cl_ulong), &mask);
+    if(error < 0) {
+        perror("Couldn't set a gate's target and control_mask arguments");
+        exit(1);
+    }
+
+    if(partitioned)
+        launch_partitions(kernel, global_controls, num_op,
+            get_local_size(num_op, simulation), target, simulation);
+    else
+        enqueue_gate_kernel(kernel, num_op, target, simulation);
+}
+
+/**
+ * Sets kernel arguments and queues the apply_multi_controlled_gate() kernel,
+ * which launches one work item per amplitude pair whose controls are set.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void opencl_apply_multi_controlled_gate(int target, size_t control_mask, double gate[8],
+    Simulation *simulation)
+{
+    cl_int error;
+
+    for(int i=0; i<4; i++) {
+        error = set_complex_arg(simulation->apply_multi_controlled_gate_kernel, 3+i,
+            gate+2*i, simulation);
+        if(error < 0) {
+            perror("Couldn't set apply_multi_controlled_gate's gate arguments");
+            exit(1);
+        }
+    }
+
+    enqueue_masked_gate(simulation->apply_multi_controlled_gate_kernel, target,
+        control_mask, gate, simulation);
+}
+
+/**
+ * Sets kernel arguments and queues the apply_diagonal_gate() kernel, which
+ * only scales the amplitudes the gate acts on.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate, zero off the diagonal
+ * @param simulation The simulation on which to apply the gate
+ */
+void opencl_apply_diagonal_gate(int target, size_t control_mask, double gate[8],
+    Simulation *simulation)
+{
+    cl_int error;
+
+    error = set_complex_arg(simulation->apply_diagonal_gate_kernel, 3, gate, simulation);
+    if(error < 0) {
+        perror("Couldn't set apply_diagonal_gate's a argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_diagonal_gate_kernel, 4, gate+6, simulation);
+    if(error < 0) {
+        perror("Couldn't set apply_diagonal_gate's d argument");
+        exit(1);
+    }
+
+    enqueue_masked_gate(simulation->apply_diagonal_gate_kernel, target, control_mask, gate,
+        simulation);
+}
+
+/**
+ * Sets kernel arguments and queues the apply_permutation_gate() kernel,
+ * which applies an X gate by swapping amplitudes.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param simulation The simulation on which to apply the gate
+ */
+void opencl_apply_permutation_gate(int target, size_t control_mask,
+    Simulation *simulation)
+{
+    const double not_gate[8] = {0, 0, 1, 0, 1, 0, 0, 0};
+
+    enqueue_masked_gate(simulation->apply_permutation_gate_kernel, target, control_mask,
+        not_gate, simulation);
+}
+
+/**
+ * Sets kernel arguments and queues the apply_double_controlled_gate() kernel
+ * over the quarter of the amplitude pairs whose controls are both set.
+ * May accept any gate type and applies the doubly controlled version of the
+ * gate on the specified target and control qubits. May be used with the
+ * NOT gate to apply a toffoli gate.
+ * @param target The target qubit for the gate
+ * @param control_1 The first control qubit for the gate
+ * @param control_2 The seccond control qubit for the gate
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void opencl_apply_double_controlled_gate(int target, int control_1, int control_2,
+    double gate[8], Simulation *simulation)
+{
+    cl_int error;
+    const size_t num_op = simulation->num_amp/8;
+
+    if(simulation->num_partitions > 1) {
+        opencl_apply_multi_controlled_gate(target,
+            ((size_t) 1 << control_1) | ((size_t) 1 << control_2), gate, simulation);
+        return;
+    }
+
+    if(apply_specialised_gate(target,
+        ((size_t) 1 << control_1) | ((size_t) 1 << control_2), gate, simulation))
+        return;
+
+    // Set kernel arguments for apply_controlled_gate
+    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 
+        1, sizeof(int), &control_1);
+
+    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 
+        2, sizeof(int), &control_2);
+    
+    if(error < 0) {
+        perror("Couldn't set apply_double_controlled_gate's controlled argument");
+        exit(1);
+    }
+    
+    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 
+        3, sizeof(int), &target);
+    
+    if(error < 0) {
+        perror("Couldn't set apply_double_controlled_gate's target argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_double_controlled_gate_kernel, 4, gate,
+        simulation);
+    
+    if(error < 0) {
+        perror("Couldn't set apply_double_controlled_gate's a argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_double_controlled_gate_kernel, 5, gate+2,
+        simulation);
+    
+    if(error < 0) {
+        perror("Couldn't set apply_double_controlled_gate's b argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_double_controlled_gate_kernel, 6, gate+4,
+        simulation);
+    
+    if(error < 0) {
+        perror("Couldn't set apply_double_controlled_gate's c argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_double_controlled_gate_kernel, 7, gate+6,
+        simulation);
+    if(error < 0) {
+        perror("Couldn't set apply_double_controlled_gate's d argument");
+        exit(1);
+    }
+
+    // queue the kernel
+    enqueue_gate_kernel(simulation->apply_double_controlled_gate_kernel, num_op, target,
+        simulation);
+}
+
+/**
+ * Sets kernel arguments and queues the apply_controlled_gate() kernel over
+ * the half of the amplitude pairs whose control is set.
+ * May accept any gate type and applies the controlled version of the
+ * gate on the specified target and control qubits. May be used with the
+ * NOT gate to apply a c-not gate for example.
+ * @param target The target qubit for the gate
+ * @param controlled The control qubit for the gate
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void opencl_apply_controlled_gate(int target, int controlled, double gate[8],
+    Simulation *simulation)
+{
+    cl_int error;
+    const size_t num_op = simulation->num_amp/4;
+
+    if(simulation->num_partitions > 1) {
+        opencl_apply_multi_controlled_gate(target, (size_t) 1 << controlled, gate,
+            simulation);
+        return;
+    }
+
+    if(apply_specialised_gate(target, (size_t) 1 << controlled, gate, simulation))
+        return;
+
+    // Set kernel arguments for apply_controlled_gate
+    error = clSetKernelArg(simulation->apply_controlled_gate_kernel, 
+        1, sizeof(int), &controlled);
+    
+    if(error < 0) {
+        perror("Couldn't set apply_controlled_gate's controlled argument");
+        exit(1);
+    }
+    
+    error = clSetKernelArg(simulation->apply_controlled_gate_kernel, 
+        2, sizeof(int), &target);
+    
+    if(error < 0) {
+        perror("Couldn't set apply_controlled_gate's target argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_controlled_gate_kernel, 3, gate,
+        simulation);
+    
+    if(error < 0) {
+        perror("Couldn't set apply_controlled_gate's a argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_controlled_gate_kernel, 4, gate+2,
+        simulation);
+    
+    if(error < 0) {
+        perror("Couldn't set apply_controlled_gate's b argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_controlled_gate_kernel, 5, gate+4,
+        simulation);
+    
+    if(error < 0) {
+        perror("Couldn't set apply_controlled_gate's c argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_controlled_gate_kernel, 6, gate+6,
+        simulation);
+    if(error < 0) {
+        perror("Couldn't set apply_controlled_gate's d argument");
+        exit(1);
+    }
+
+    // queue kerenel
+    enqueue_gate_kernel(simulation->apply_controlled_gate_kernel, num_op, target,
+        simulation);
+}
+
+/**
+ * Sets kernel arguments and queues the apply_gate() kernel.
+ * May accept any gate type and applies the gate on the specified target qubit.
+ * @param target The target qubit for the gate
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void opencl_apply_gate(int target, double gate[8], Simulation *simulation)
+{
+    cl_int error;
+    const size_t num_op = simulation->num_amp/2;
+
+    if(simulation->num_partitions > 1) {
+        opencl_apply_multi_controlled_gate(target, 0, gate, simulation);
+        return;
+    }
+
+    if(apply_specialised_gate(target, 0, gate, simulation))
+        return;
+
+    // Set kernel arguments for apply_gate
+    error = clSetKernelArg(simulation->apply_gate_kernel, 1, sizeof(int), &target);
+    if(error < 0) {
+        perror("Couldn't set apply_gate's target argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_gate_kernel, 2, gate, simulation);
+    if(error < 0) {
+        perror("Couldn't set apply_gate's a argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_gate_kernel, 3, gate+2, simulation);
+    if(error < 0) {
+        perror("Couldn't set apply_gate's b argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_gate_kernel, 4, gate+4, simulation);
+    if(error < 0) {
+        perror("Couldn't set apply_gate's c argument");
+        exit(1);
+    }
+
+    error = set_complex_arg(simulation->apply_gate_kernel, 5, gate+6, simulation);
+    if(error < 0) {
+        perror("Couldn't set apply_gate's d argument");
+        exit(1);
+    }
+
+    enqueue_gate_kernel(simulation->apply_gate_kernel, num_op, target, simulation);
+
+    return;
+}
+
+/**
+ * Creates a state vector buffer of appropriate size to store the simulation's
+ * amplitudes and sets it as a kernel argument to all required kernels.
+ * With more than one partition device the state is split into a power of two
+ * partitions, each a sub-buffer of at least 2^MIN_PARTITION_QUBITS amplitudes
+ * whose index is given by the highest (global) qubits.
+ * @param num_qubits The number of qubits to initialise
+ * @param simulation The simulation object to initialise
+ */
+void opencl_initialise_qubits(int num_qubits, Simulation *simulation)
+{
+    cl_int error;
+    const size_t real_size = precision_size(simulation->precision);
+    const cl_mem_flags host_flags = simulation->unified_memory ? CL_MEM_ALLOC_HOST_PTR : 0;
+    cl_buffer_region region;
+    cl_kernel kernels[7];
+
+    release_partitions(simulation);
+
+    // Release the buffers of any previous state, the back probability buffer
+    // is created again at the new size when first used
+    if(simulation->state_vector_buffer)
+        clReleaseMemObject(simulation->state_vector_buffer);
+    if(simulation->probability_buffer)
+        clReleaseMemObject(simulation->probability_buffer);
+    if(simulation->back_probability_buffer)
+        clReleaseMemObject(simulation->back_probability_buffer);
+    simulation->back_probability_buffer = NULL;
+
+    simulation->local_qubits = num_qubits;
+    while(2*simulation->num_partitions <= simulation->num_partition_devices &&
+        simulation->local_qubits > MIN_PARTITION_QUBITS) {
+        simulation->num_partitions *= 2;
+        simulation->local_qubits--;
+    }
+
+    // Create CL buffer to hold the state vector, in mappable host memory on
+    // devices which share the host's memory
+    simulation->state_vector_buffer = clCreateBuffer(simulation->context,
+        CL_MEM_READ_WRITE | host_flags, real_size*simulation->num_amp*2, NULL, &error);
+    if(error < 0) {
+        perror("Couldn't create a buffer object");
+        exit(1);
+    }
+
+    // Split the state vector into one sub-buffer per partition
+    region.size = 2*real_size << simulation->local_qubits;
+    for(int p=0; p<simulation->num_partitions && simulation->num_partitions > 1; p++) {
+        region.origin = p*region.size;
+        simulation->partition_buffers[p] = clCreateSubBuffer(
+            simulation->state_vector_buffer, CL_MEM_READ_WRITE,
+            CL_BUFFER_CREATE_TYPE_REGION, &region, &error);
+        if(error < 0) {
+            perror("Couldn't create a partition's sub-buffer");
+            exit(1);
+        }
+    }
+
+    // Create CL buffer to hold the measurement outcome, which is always read
+    // back, in mappable host memory
+    simulation->probability_buffer = clCreateBuffer(simulation->context,
+        CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, real_size*simulation->num_amp, NULL,
+        &error);
+    if(error < 0) {
+        perror("Couldn't create a buffer object");
+        exit(1);
+    }
+
+    // Set state vector buffer kernel arguments
+    error = clSetKernelArg(simulation->apply_gate_kernel, 0,
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_gate's state_vector argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_controlled_gate_kernel, 0,
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_controlled_gate's state_vector argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 0,
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_double_controlled_gate's state_vector argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_dense_gate_kernel, 0,
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_dense_gate's state_vector argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_multi_controlled_gate_kernel, 0,
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_multi_controlled_gate's state_vector argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_diagonal_gate_kernel, 0,
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_diagonal_gate's state_vector argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_permutation_gate_kernel, 0,
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_permutation_gate's state_vector argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_gate_list_kernel, 0,
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_gate_list's state_vector argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_gate_tile_kernel, 0,
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_gate_tile's state_vector argument");
+        exit(1);
+    }
+
+    // Set kernel arguments for measure
+    error = clSetKernelArg(simulation->measure_kernel, 0, 
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set measure's state_vector argument");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->measure_kernel, 1,
+        sizeof(cl_mem), &simulation->probability_buffer);
+    if(error < 0) {
+        perror("Couldn't set measure's probability argument");
+        exit(1);
+    }
+
+    // Set the state vector argument of the reduction kernels
+    kernels[0] = simulation->reduce_qubit_marginals_kernel;
+    kernels[1] = simulation->reduce_register_kernel;
+    kernels[2] = simulation->probability_histogram_kernel;
+    kernels[3] = simulation->select_top_k_kernel;
+    kernels[4] = simulation->sample_in_blocks_kernel;
+    kernels[5] = simulation->pauli_group_sums_kernel;
+    kernels[6] = simulation->sum_blocks_kernel;
+
+    for(int i=0; i<7; i++) {
+        error = clSetKernelArg(kernels[i], 0, sizeof(cl_mem),
+            &simulation->state_vector_buffer);
+        if(error < 0) {
+            perror("Couldn't set a reduction's state_vector argument");
+            exit(1);
+        }
+    }
+
+    // Set kernel argument for initialise_state
+    error = clSetKernelArg(simulation->initialise_state_kernel, 0,
+        sizeof(cl_mem), &simulation->state_vector_buffer);
+    if(error < 0) {
+        perror("Couldn't set initialise_state's state_vector argument");
+        exit(1);
+    }
+
+    // Initialise the state vector to |0....0> on the device
+    error = enqueue_kernel(simulation->initialise_state_kernel, simulation->num_amp,
+        simulation);
+    if(error < 0) {
+        perror("Couldn't enqueue the initialise state execution command");
+        exit(1);
+    }
+}
+/**
+ * @brief Finds the OpenCL device chosen by the simulation options.
+ * Devices of the requested type are counted across the chosen platform, or
+ * across every platform in order if the platform index is negative, and the
+ * one at the requested device index is used.
+ * @param options The options choosing the device type, platform and index
+ * @param simulation The simulation in which to store the device
+ * @return 0 on success, -1 if there is no such device
+ */
+static int select_device(SimulationOptions *options, Simulation *simulation)
+{
+    cl_platform_id platforms[MAX_PLATFORMS];
+    cl_device_id devices[MAX_DEVICES];
+    cl_uint num_platforms, num_devices;
+    cl_device_type type;
+    int index = options->device_index;
+
+    switch(options->device_type) {
+        case DEVICE_CPU:
+            type = CL_DEVICE_TYPE_CPU;
+            break;
+        case DEVICE_ACCELERATOR:
+            type = CL_DEVICE_TYPE_ACCELERATOR;
+            break;
+        case DEVICE_ALL:
+            type = CL_DEVICE_TYPE_ALL;
+            break;
+        default:
+            type = CL_DEVICE_TYPE_GPU;
+    }
+
+    if(clGetPlatformIDs(MAX_PLATFORMS, platforms, &num_platforms) < 0)
+        return -1;
+    if(num_platforms > MAX_PLATFORMS)
+        num_platforms = MAX_PLATFORMS;
+
+    for(int p=0; p<(int) num_platforms; p++) {
+        if(options->platform_index >= 0 && p != options->platform_index)
+            continue;
+
+        // Platforms without a device of the type return CL_DEVICE_NOT_FOUND
+        if(clGetDeviceIDs(platforms[p], type, MAX_DEVICES, devices, &num_devices) < 0)
+            continue;
+        if(num_devices > MAX_DEVICES)
+            num_devices = MAX_DEVICES;
+
+        if(index < (int) num_devices) {
+            simulation->device = devices[index];
+            return 0;
+        }
+        index -= num_devices;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Finds the devices a simulation's state is partitioned across.
+ * A device which can be partitioned by NUMA node, such as the CPU device of
+ * a multi-socket host, is split into one sub-device per node. Otherwise the
+ * chosen device is joined by the devices of the same type following it on
+ * its platform. The number of devices is rounded down to a power of two, and
+ * the first of them becomes simulation->device.
+ * @param num_partitions The largest number of partitions to use
+ * @param simulation The simulation holding the chosen device
+ */
+static void select_partitions(int num_partitions, Simulation *simulation)
+{
+    const cl_device_partition_property numa_nodes[3] = {
+        CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0};
+    cl_device_id devices[MAX_DEVICES];
+    cl_platform_id platform;
+    cl_device_type type;
+    cl_uint num_devices = 0;
+    int first = 0, count = 1;
+
+    if(num_partitions > 1 && clCreateSubDevices(simulation->device, numa_nodes,
+        MAX_DEVICES, devices, &num_devices) >= 0 && num_devices > 1) {
+        simulation->sub_devices = true;
+    } else if(num_partitions > 1) {
+        num_devices = 0;
+        if(clGetDeviceInfo(simulation->device, CL_DEVICE_PLATFORM, sizeof(cl_platform_id),
+            &platform, NULL) >= 0 && clGetDeviceInfo(simulation->device, CL_DEVICE_TYPE,
+            sizeof(cl_device_type), &type, NULL) >= 0 &&
+            clGetDeviceIDs(platform, type & ~(cl_device_type) CL_DEVICE_TYPE_DEFAULT,
+            MAX_DEVICES, devices, &num_devices) < 0)
+            num_devices = 0;
+        if(num_devices > MAX_DEVICES)
+            num_devices = MAX_DEVICES;
+        while(first < (int) num_devices && devices[first] != simulation->device)
+            first++;
+    }
+
+    while(2*count <= num_partitions && first + 2*count <= (int) num_devices)
+        count *= 2;
+
+    simulation->partition_devices = (cl_device_id *) malloc(sizeof(cl_device_id)*count);
+    simulation->partition_queues = (cl_command_queue *) calloc(count,
+        sizeof(cl_command_queue));
+    simulation->partition_buffers = (cl_mem *) calloc(count, sizeof(cl_mem));
+    if(!simulation->partition_devices || !simulation->partition_queues ||
+        !simulation->partition_buffers) {
+        fprintf(stderr, "error: unable to allocate partitions.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    simulation->partition_devices[0] = simulation->device;
+    for(int p=0; p<count && count > 1; p++)
+        simulation->partition_devices[p] = devices[first + p];
+
+    // Sub-devices beyond the power of two are not used
+    for(int p=count; p<(int) num_devices && simulation->sub_devices; p++)
+        clReleaseDevice(devices[p]);
+
+    simulation->num_partition_devices = count;
+    simulation->device = simulation->partition_devices[0];
+}
+
+/**
+ * @brief Sets up the OpenCL objects of a simulation.
+ * Builds the OpenCL program compiled into the library, see
+ * build_opencl_program(), creates all kernel function, defines
+ * context, creates command queue, sets known kernel arguments and
+ * verifies device capabilities. Double precision simulations build the
+ * program with DOUBLE_PRECISION defined. Any type of device may be used,
+ * including the CPU devices of runtimes such as pocl, and work groups are
+ * sized from the limits the device reports. The state may be partitioned
+ * across options.num_partitions devices, see select_partitions(), each with
+ * its own command queue.
+ * @param options The options choosing the device, see select_device()
+ * @param simulation The simulation in which to store all OpenCL objects
+ * @return 0 on success, -1 if no OpenCL platform or matching device is
+ * available, or the device lacks fp64 support for a double precision
+ * simulation
+ */
+int opencl_set_up(SimulationOptions *options, Simulation *simulation)
+{
+    // Data structures
+    cl_int error, max_work_item_dims;
+    cl_uint max_compute_units;
+    cl_ulong global_mem_size, max_alloc_size, local_mem_size;
+    cl_bool host_unified_memory;
+    char *tile_qubits = getenv("SIMULATION_BLOCK_QUBITS");
+    cl_device_fp_config double_fp_config = 0;
+    const char *build_options = NULL;
+    size_t max_work_group_size, kernel_work_group_size;
+    size_t *max_work_item_size;
+    cl_kernel kernels[17];
+
+    // Access the chosen device
+    if(select_device(options, simulation) < 0)
+        return -1;
+
+    // Check the GPU supports double precision if needed
+    if(simulation->precision == PRECISION_DOUBLE) {
+        clGetDeviceInfo(simulation->device, CL_DEVICE_DOUBLE_FP_CONFIG,
+            sizeof(cl_device_fp_config), &double_fp_config, NULL);
+        if(double_fp_config == 0)
+            return -1;
+        build_options = "-DDOUBLE_PRECISION";
+    }
+
+    // Check the GPU's maximum number of work dimensions
+    error = clGetDeviceInfo(simulation->device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS,
+        sizeof(cl_int), &max_work_item_dims, NULL);
+    if(error < 0) {
+        perror("Couldn't access GPU's max work item dimensions");
+        exit(1);
+    }
+    // printf("Maximum work item dimensions: %u\n", max_work_item_dims);
+
+    // Check the GPU's maximum number of work group size
+    error = clGetDeviceInfo(simulation->device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+        sizeof(size_t), &max_work_group_size, NULL);
+    if(error < 0) {
+        perror("Couldn't access GPU's max work group size");
+        exit(1);
+    }
+    // printf("Maximum work group size: %lu\n", max_work_group_size);
+
+    // Check the GPU's maximum number of work item sizes
+    max_work_item_size = (size_t *) malloc(max_work_item_dims*sizeof(size_t));
+    error = clGetDeviceInfo(simulation->device, CL_DEVICE_MAX_WORK_ITEM_SIZES,
+        sizeof(size_t)*max_work_item_dims, max_work_item_size, NULL);
+    if(error < 0) {
+        perror("Couldn't access GPU's max work item size");
+        exit(1);
+    }
+    // for(int i=0; i<max_work_item_dims; i++)
+    //     printf("Maximum work item %d size: %lu\n", i, max_work_item_size[i]);
+    free(max_work_item_size);
+
+    // Check the GPU's number of compute units
+    error = clGetDeviceInfo(simulation->device, CL_DEVICE_MAX_COMPUTE_UNITS,
+        sizeof(cl_uint), &max_compute_units, NULL);
+    if(error < 0) {
+        perror("Couldn't access GPU's number of compute units");
+        exit(1);
+    }
+    //printf("Maximum compute units: %d\n", max_compute_units);
+
+    // Check the GPU's global memory size
+    error = clGetDeviceInfo(simulation->device, CL_DEVICE_GLOBAL_MEM_SIZE,
+        sizeof(cl_ulong), &global_mem_size, NULL);
+    if(error < 0) {
+        perror("Couldn't access GPU's global memory size");
+        exit(1);
+    }
+    //printf("Global memory size: %llu bytes\n", global_mem_size);
+    simulation->global_mem_size = global_mem_size;
+
+    // Check whether the device's memory is the host's, as for CPU devices
+    error = clGetDeviceInfo(simulation->device, CL_DEVICE_HOST_UNIFIED_MEMORY,
+        sizeof(cl_bool), &host_unified_memory, NULL);
+    if(error < 0) {
+        perror("Couldn't access device's host unified memory");
+        exit(1);
+    }
+    simulation->unified_memory = host_unified_memory;
+
+    // Check the GPU's largest buffer size
+    error = clGetDeviceInfo(simulation->device, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+        sizeof(cl_ulong), &max_alloc_size, NULL);
+    if(error < 0) {
+        perror("Couldn't access GPU's max allocation size");
+        exit(1);
+    }
+    simulation->max_alloc_size = max_alloc_size;
+
+    simulation->specialised_kernels = options->specialised_kernels;
+    simulation->gate_list_qubits = options->gate_list_qubits < 0 ? 0 :
+        options->gate_list_qubits;
+
+    // Choose the devices the state is partitioned across
+    select_partitions(options->num_partitions, simulation);
+
+    // Create context
+    simulation->context = clCreateContext(NULL, simulation->num_partition_devices,
+        simulation->partition_devices, NULL, NULL, &error);
+    if(error < 0) {
+        perror("Couldn't create context");
+        exit(1);
+    }
+
+    // Build the program, or load it from the binary cache
+    simulation->program = build_opencl_program(simulation->context,
+        simulation->num_partition_devices, simulation->partition_devices, build_options);
+
+    // Create kernel for the apply_gate function
+    simulation->apply_gate_kernel = clCreateKernel(simulation->program, APPLY_GATE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply gate kernel");
+        exit(1);
+    }
+
+    // Create kernel for the apply_controlled_gate function
+    simulation->apply_controlled_gate_kernel = clCreateKernel(simulation->program, 
+        APPLY_CGATE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply controlled gate kernel");
+        exit(1);
+    }
+
+    // Create kernel for the apply_double_controlled_gate function
+    simulation->apply_double_controlled_gate_kernel = 
+        clCreateKernel(simulation->program, APPLY_CCGATE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply controlled controlled gate kernel");
+        exit(1);
+    }
+
+    // Create kernel for the measure function
+    simulation->measure_kernel = clCreateKernel(simulation->program, MEASURE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the measure kernel");
+        exit(1);
+    }
+
+    // Create kernel for the initialise_state function
+    simulation->initialise_state_kernel = clCreateKernel(simulation->program, INITIALISE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the initialise state kernel");
+        exit(1);
+    }
+
+    // Create kernel for the apply_dense_gate function
+    simulation->apply_dense_gate_kernel = clCreateKernel(simulation->program,
+        APPLY_DENSE_GATE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply dense gate kernel");
+        exit(1);
+    }
+
+    // Create kernel for the apply_multi_controlled_gate function
+    simulation->apply_multi_controlled_gate_kernel = clCreateKernel(simulation->program,
+        APPLY_MCGATE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply multi controlled gate kernel");
+        exit(1);
+    }
+
+    // Create kernel for the apply_diagonal_gate function
+    simulation->apply_diagonal_gate_kernel = clCreateKernel(simulation->program,
+        APPLY_DIAGONAL_GATE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply diagonal gate kernel");
+        exit(1);
+    }
+
+    // Create kernel for the apply_permutation_gate function
+    simulation->apply_permutation_gate_kernel = clCreateKernel(simulation->program,
+        APPLY_PERMUTATION_GATE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply permutation gate kernel");
+        exit(1);
+    }
+
+    // Create kernel for the reduce_qubit_marginals function
+    simulation->reduce_qubit_marginals_kernel = clCreateKernel(simulation->program,
+        REDUCE_QUBIT_MARGINALS_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the reduce qubit marginals kernel");
+        exit(1);
+    }
+
+    // Create kernel for the reduce_register function
+    simulation->reduce_register_kernel = clCreateKernel(simulation->program,
+        REDUCE_REGISTER_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the reduce register kernel");
+        exit(1);
+    }
+
+    // Create kernel for the sum_partials function
+    simulation->sum_partials_kernel = clCreateKernel(simulation->program,
+        SUM_PARTIALS_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the sum partials kernel");
+        exit(1);
+    }
+
+    // Create kernel for the probability_histogram function
+    simulation->probability_histogram_kernel = clCreateKernel(simulation->program,
+        PROBABILITY_HISTOGRAM_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the probability histogram kernel");
+        exit(1);
+    }
+
+    // Create kernel for the select_top_k function
+    simulation->select_top_k_kernel = clCreateKernel(simulation->program,
+        SELECT_TOP_K_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the select top k kernel");
+        exit(1);
+    }
+
+    // Create kernel for the sum_blocks function
+    simulation->sum_blocks_kernel = clCreateKernel(simulation->program,
+        SUM_BLOCKS_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the sum blocks kernel");
+        exit(1);
+    }
+
+    // Create kernel for the sample_in_blocks function
+    simulation->sample_in_blocks_kernel = clCreateKernel(simulation->program,
+        SAMPLE_IN_BLOCKS_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the sample in blocks kernel");
+        exit(1);
+    }
+
+    // Create kernel for the pauli_group_sums function
+    simulation->pauli_group_sums_kernel = clCreateKernel(simulation->program,
+        PAULI_GROUP_SUMS_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the pauli group sums kernel");
+        exit(1);
+    }
+
+    // Create kernel for the apply_global_gate function
+    simulation->apply_global_gate_kernel = clCreateKernel(simulation->program,
+        APPLY_GLOBAL_GATE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply global gate kernel");
+        exit(1);
+    }
+
+    // Size work groups to the largest power of two every gate kernel allows
+    kernels[0] = simulation->apply_gate_kernel;
+    kernels[1] = simulation->apply_controlled_gate_kernel;
+    kernels[2] = simulation->apply_double_controlled_gate_kernel;
+    kernels[3] = simulation->apply_multi_controlled_gate_kernel;
+    kernels[4] = simulation->apply_diagonal_gate_kernel;
+    kernels[5] = simulation->apply_permutation_gate_kernel;
+    kernels[6] = simulation->apply_dense_gate_kernel;
+    kernels[7] = simulation->measure_kernel;
+    kernels[8] = simulation->reduce_qubit_marginals_kernel;
+    kernels[9] = simulation->reduce_register_kernel;
+    kernels[10] = simulation->sum_partials_kernel;
+    kernels[11] = simulation->probability_histogram_kernel;
+    kernels[12] = simulation->select_top_k_kernel;
+    kernels[13] = simulation->apply_global_gate_kernel;
+    kernels[14] = simulation->sample_in_blocks_kernel;
+    kernels[15] = simulation->pauli_group_sums_kernel;
+    kernels[16] = simulation->sum_blocks_kernel;
+
+    for(int i=0; i<17; i++) {
+        error = clGetKernelWorkGroupInfo(kernels[i], simulation->device,
+            CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernel_work_group_size, NULL);
+        if(error < 0) {
+            perror("Couldn't access a kernel's work group size");
+            exit(1);
+        }
+        if(kernel_work_group_size < max_work_group_size)
+            max_work_group_size = kernel_work_group_size;
+    }
+
+    simulation->work_group_size = 1;
+    while(2*simulation->work_group_size <= max_work_group_size)
+        simulation->work_group_size *= 2;
+
+    // Create kernel for the apply_gate_list function
+    simulation->apply_gate_list_kernel = clCreateKernel(simulation->program,
+        APPLY_GATE_LIST_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply gate list kernel");
+        exit(1);
+    }
+
+    // Check the largest work group the apply_gate_list kernel can run as
+    error = clGetKernelWorkGroupInfo(simulation->apply_gate_list_kernel,
+        simulation->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t),
+        &simulation->gate_list_work_group_size, NULL);
+    if(error < 0) {
+        perror("Couldn't access apply gate list's work group size");
+        exit(1);
+    }
+
+    // Create kernel for the apply_gate_tile function
+    simulation->apply_gate_tile_kernel = clCreateKernel(simulation->program,
+        APPLY_GATE_TILE_FUNC, &error);
+    if(error < 0) {
+        perror("Couldn't create the apply gate tile kernel");
+        exit(1);
+    }
+
+    // Tiles take at most half the local memory so the kernel's own use fits
+    error = clGetDeviceInfo(simulation->device, CL_DEVICE_LOCAL_MEM_SIZE,
+        sizeof(cl_ulong), &local_mem_size, NULL);
+    if(error < 0) {
+        perror("Couldn't access GPU's local memory size");
+        exit(1);
+    }
+
+    // A tile of n qubits is 2^n amplitudes of two reals, grow it while the
+    // next size still fits
+    simulation->block_qubits = 1;
+    while(simulation->block_qubits < MAX_TILE_QUBITS &&
+        (2*precision_size(simulation->precision) << (simulation->block_qubits + 1))
+        <= local_mem_size/2)
+        simulation->block_qubits++;
+
+    if(tile_qubits && atoi(tile_qubits) > 0 && atoi(tile_qubits) < simulation->block_qubits)
+        simulation->block_qubits = atoi(tile_qubits);
+
+    error = clGetKernelWorkGroupInfo(simulation->apply_gate_tile_kernel,
+        simulation->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t),
+        &simulation->tile_work_group_size, NULL);
+    if(error < 0) {
+        perror("Couldn't access apply gate tile's work group size");
+        exit(1);
+    }
+
+    if(simulation->tile_work_group_size > (size_t) 1 << (simulation->block_qubits-1))
+        simulation->tile_work_group_size = (size_t) 1 << (simulation->block_qubits-1);
+
+    // Create CL buffer to hold the matrix of a fused gate
+    simulation->dense_matrix_buffer = clCreateBuffer(simulation->context,
+        CL_MEM_READ_ONLY, precision_size(simulation->precision)*2 << (2*MAX_FUSED_QUBITS),
+        NULL, &error);
+    if(error < 0) {
+        perror("Couldn't create a buffer object");
+        exit(1);
+    }
+
+    error = clSetKernelArg(simulation->apply_dense_gate_kernel, 1,
+        sizeof(cl_mem), &simulation->dense_matrix_buffer);
+    if(error < 0) {
+        perror("Couldn't set apply_dense_gate's matrix argument");
+        exit(1);
+    }
+
+    // Create command queue for the GPU
+    simulation->queue = clCreateCommandQueue(simulation->context, simulation->device,
+        options->profiling ? CL_QUEUE_PROFILING_ENABLE : 0, &error);
+    if(error < 0) {
+        perror("Couldn't create the command queue");
+        exit(1);
+    }
+
+    // Create a command queue for every other partition's device
+    simulation->partition_queues[0] = simulation->queue;
+    for(int p=1; p<simulation->num_partition_devices; p++) {
+        simulation->partition_queues[p] = clCreateCommandQueue(simulation->context,
+            simulation->partition_devices[p],
+            options->profiling ? CL_QUEUE_PROFILING_ENABLE : 0, &error);
+        if(error < 0) {
+            perror("Couldn't create a partition's command queue");
+            exit(1);
+        }
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,31 @@
+#ifndef _OPENCL_BACKEND_H
+#define _OPENCL_BACKEND_H
+
+#include "simulation.h"
+
+int opencl_set_up(SimulationOptions *, Simulation *);
+void opencl_initialise_qubits(int, Simulation *);
+void opencl_apply_gate(int, double[8], Simulation *);
+void opencl_apply_controlled_gate(int, int, double[8], Simulation *);
+void opencl_apply_double_controlled_gate(int, int, int, double[8], Simulation *);
+void opencl_apply_multi_controlled_gate(int, size_t, double[8], Simulation *);
+void opencl_apply_diagonal_gate(int, size_t, double[8], Simulation *);
+void opencl_apply_permutation_gate(int, size_t, Simulation *);
+void opencl_apply_dense_gate(Operation *, Simulation *);
+void opencl_apply_operation(Operation *, Simulation *);
+int opencl_apply_gate_list(OperationList *, Simulation *);
+void opencl_apply_operation_list(OperationList *, Simulation *);
+void opencl_measure(Simulation *);
+void opencl_measure_async(AsyncResult *, Simulation *);
+void opencl_read_state_async(AsyncResult *, Simulation *);
+void opencl_reduce_qubit_marginals(double *, Simulation *);
+void opencl_marginal(size_t, double *, Simulation *);
+void opencl_top_k(size_t, size_t *, double *, Simulation *);
+void opencl_sum_blocks(int, double *, Simulation *);
+void opencl_sample_blocks(int, size_t, size_t *, const double *, Simulation *);
+void opencl_pauli_group_sums(size_t, size_t, const size_t *, double *, Simulation *);
+void opencl_test_state_vector(double *, Simulation *);
+void opencl_collect_profile(Simulation *);
+void opencl_deallocate_resources(Simulation *);
+
+#endif
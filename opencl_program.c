@@ -0,0 +1,295 @@
+#define _POSIX_C_SOURCE 200809L
+#define CACHE_DIR_NAME "quantum-simulator"
+#define MAX_PATH_LENGTH 4096
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+#include "opencl_program.h"
+#include "program_source.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * @brief Adds bytes to a 64-bit FNV-1a hash.
+ * @param hash The hash so far
+ * @param data The bytes to add
+ * @param size The number of bytes
+ * @return The updated hash
+ */
+static unsigned long long hash_bytes(unsigned long long hash, const void *data,
+    size_t size)
+{
+    const unsigned char *bytes = (const unsigned char *) data;
+
+    for(size_t i=0; i<size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Adds a string property of a device to a hash.
+ * @param hash The hash so far
+ * @param device The device to query
+ * @param param The property to add, such as CL_DRIVER_VERSION
+ * @return The updated hash
+ */
+static unsigned long long hash_device_info(unsigned long long hash, cl_device_id device,
+    cl_device_info param)
+{
+    size_t size;
+    char *info;
+
+    if(clGetDeviceInfo(device, param, 0, NULL, &size) < 0)
+        return hash;
+
+    info = (char *) malloc(size);
+    if(!info) {
+        fprintf(stderr, "error: unable to allocate device info.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(clGetDeviceInfo(device, param, size, info, NULL) >= 0)
+        hash = hash_bytes(hash, info, size);
+
+    free(info);
+
+    return hash;
+}
+
+/**
+ * @brief Creates a directory and any missing parents.
+ * @param path The directory to create, modified while running
+ * @return 0 on success, -1 if a directory could not be created
+ */
+static int make_directories(char *path)
+{
+    for(char *separator=strchr(path+1, '/'); ; separator=strchr(separator+1, '/')) {
+        if(separator)
+            *separator = '\0';
+
+        if(mkdir(path, 0755) < 0 && errno != EEXIST)
+            return -1;
+
+        if(!separator)
+            return 0;
+        *separator = '/';
+    }
+}
+
+/**
+ * @brief Finds the cache file for a program binary, creating its directory.
+ * Binaries live in SIMULATION_CACHE_DIR, $XDG_CACHE_HOME/quantum-simulator
+ * or ~/.cache/quantum-simulator, and are named by a hash of the device, its
+ * driver version, the build options and the program source, so a change to
+ * any of them builds and caches a new binary. An empty SIMULATION_CACHE_DIR
+ * disables the cache.
+ * @param device The device the program is built for
+ * @param build_options The options the program is built with
+ * @param path The array in which to store the path, MAX_PATH_LENGTH long
+ * @return 0 on success, -1 if the cache is disabled or unavailable
+ */
+static int get_cache_path(cl_device_id device, const char *build_options, char *path)
+{
+    char *cache_dir = getenv("SIMULATION_CACHE_DIR");
+    char *base_dir;
+    unsigned long long hash = FNV_OFFSET_BASIS;
+    int length;
+
+    if(cache_dir) {
+        if(cache_dir[0] == '\0')
+            return -1;
+        length = snprintf(path, MAX_PATH_LENGTH, "%s", cache_dir);
+    } else if((base_dir = getenv("XDG_CACHE_HOME")) && base_dir[0] != '\0') {
+        length = snprintf(path, MAX_PATH_LENGTH, "%s/%s", base_dir, CACHE_DIR_NAME);
+    } else if((base_dir = getenv("HOME")) && base_dir[0] != '\0') {
+        length = snprintf(path, MAX_PATH_LENGTH, "%s/.cache/%s", base_dir, CACHE_DIR_NAME);
+    } else {
+        return -1;
+    }
+
+    if(length < 0 || length >= MAX_PATH_LENGTH - 32 || make_directories(path) < 0)
+        return -1;
+
+    hash = hash_device_info(hash, device, CL_DEVICE_VENDOR);
+    hash = hash_device_info(hash, device, CL_DEVICE_NAME);
+    hash = hash_device_info(hash, device, CL_DEVICE_VERSION);
+    hash = hash_device_info(hash, device, CL_DRIVER_VERSION);
+    if(build_options)
+        hash = hash_bytes(hash, build_options, strlen(build_options));
+    hash = hash_bytes(hash, program_source, sizeof(program_source));
+
+    snprintf(path + length, MAX_PATH_LENGTH - length, "/%016llx.bin", hash);
+
+    return 0;
+}
+
+/**
+ * @brief Loads and builds a cached program binary.
+ * @param context The context to create the program in
+ * @param device The device the program is built for
+ * @param build_options The options the program is built with
+ * @param path The cache file of the binary
+ * @return The built program, or NULL if there is no usable binary
+ */
+static cl_program load_program_binary(cl_context context, cl_device_id device,
+    const char *build_options, const char *path)
+{
+    cl_program program;
+    cl_int error, binary_status;
+    unsigned char *binary;
+    size_t size;
+    long file_size;
+    FILE *fp = fopen(path, "rb");
+
+    if(!fp)
+        return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    file_size = ftell(fp);
+    rewind(fp);
+    if(file_size <= 0) {
+        fclose(fp);
+        return NULL;
+    }
+
+    size = (size_t) file_size;
+    binary = (unsigned char *) malloc(size);
+    if(!binary) {
+        fprintf(stderr, "error: unable to allocate program binary.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(fread(binary, 1, size, fp) != size) {
+        fclose(fp);
+        free(binary);
+        return NULL;
+    }
+    fclose(fp);
+
+    program = clCreateProgramWithBinary(context, 1, &device, &size,
+        (const unsigned char **) &binary, &binary_status, &error);
+    free(binary);
+    if(error < 0 || binary_status < 0)
+        return NULL;
+
+    // A binary from an incompatible driver fails here and is rebuilt
+    if(clBuildProgram(program, 1, &device, build_options, NULL, NULL) < 0) {
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    return program;
+}
+
+/**
+ * @brief Writes the binary of a built program to the cache.
+ * The binary is written to a temporary file which is then renamed, so
+ * processes starting together never read a partial binary.
+ * @param program The built program
+ * @param path The cache file of the binary
+ */
+static void save_program_binary(cl_program program, const char *path)
+{
+    char temporary_path[MAX_PATH_LENGTH + 32];
+    unsigned char *binary;
+    size_t size;
+    bool written;
+    FILE *fp;
+
+    if(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size,
+        NULL) < 0 || size == 0)
+        return;
+
+    binary = (unsigned char *) malloc(size);
+    if(!binary) {
+        fprintf(stderr, "error: unable to allocate program binary.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char *), &binary,
+        NULL) < 0) {
+        free(binary);
+        return;
+    }
+
+    snprintf(temporary_path, sizeof(temporary_path), "%s.%ld", path, (long) getpid());
+    fp = fopen(temporary_path, "wb");
+    if(!fp) {
+        free(binary);
+        return;
+    }
+
+    written = fwrite(binary, 1, size, fp) == size;
+    written = fclose(fp) == 0 && written;
+    free(binary);
+
+    if(!written || rename(temporary_path, path) < 0)
+        remove(temporary_path);
+}
+
+/**
+ * @brief Builds the simulator's OpenCL program for the devices of a context.
+ * The kernel source is compiled into the library from program.cl. A binary
+ * cached by an earlier build for the same device, driver, options and source
+ * is used when available, otherwise the source is built and its binary
+ * cached, see get_cache_path(). Programs for several devices, such as the
+ * partitions of a simulation, are always built from source.
+ * @param context The context to create the program in
+ * @param num_devices The number of devices to build the program for
+ * @param devices The devices to build the program for
+ * @param build_options The options to build the program with, may be NULL
+ * @return The built program
+ */
+cl_program build_opencl_program(cl_context context, cl_uint num_devices,
+    const cl_device_id *devices, const char *build_options)
+{
+    const char *source = program_source;
+    const size_t source_size = sizeof(program_source) - 1;
+    char path[MAX_PATH_LENGTH], *program_log;
+    bool cached = num_devices == 1 && get_cache_path(devices[0], build_options, path) == 0;
+    cl_program program;
+    size_t log_size;
+    cl_int error;
+
+    if(cached && (program = load_program_binary(context, devices[0], build_options, path)))
+        return program;
+
+    // Create program
+    program = clCreateProgramWithSource(context, 1, &source, &source_size, &error);
+    if(error < 0) {
+        perror("Couldn't create program");
+        exit(1);
+    }
+
+    // Build program
+    error = clBuildProgram(program, num_devices, devices, build_options, NULL, NULL);
+    if(error < 0) {
+        // Determine size of log and allocate buffer space
+        clGetProgramBuildInfo(program, devices[0], CL_PROGRAM_BUILD_LOG, 0, NULL,
+            &log_size);
+        program_log = (char *) malloc(log_size + 1);
+        program_log[log_size] = '\0';
+
+        // Copy log into buffer and print
+        clGetProgramBuildInfo(program, devices[0], CL_PROGRAM_BUILD_LOG, log_size + 1,
+            program_log, NULL);
+        printf("%s\n", program_log);
+        free(program_log);
+        exit(1);
+    }
+
+    if(cached)
+        save_program_binary(program, path);
+
+    return program;
+}
@@ -0,0 +1,8 @@
+#ifndef _OPENCL_PROGRAM_H
+#define _OPENCL_PROGRAM_H
+
+#include "simulation.h"
+
+cl_program build_opencl_program(cl_context, cl_uint, const cl_device_id *, const char *);
+
+#endif
@@ -0,0 +1,191 @@
+#include "operation_list.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Initialises an empty list of operations.
+ * @return The initialised operation list
+ */
+OperationList *initialise_operation_list()
+{
+    OperationList *list = (OperationList *) malloc(sizeof(OperationList));
+    if(!list) {
+        fprintf(stderr, "error: unable to initialise OperationList.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    list->num_operations = 0;
+    list->capacity = 16;
+    list->operations = (Operation *) malloc(sizeof(Operation)*list->capacity);
+    if(!list->operations) {
+        fprintf(stderr, "error: unable to initialise OperationList.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return list;
+}
+
+/**
+ * @brief Removes every operation from a list, keeping its storage.
+ * @param list The operation list to be cleared
+ */
+void clear_operation_list(OperationList *list)
+{
+    for(int i=0; i<list->num_operations; i++)
+        free(list->operations[i].matrix);
+
+    list->num_operations = 0;
+}
+
+/**
+ * @brief Frees an operation list and the matrices of its operations.
+ * @param list The operation list to be freed
+ */
+void free_operation_list(OperationList *list)
+{
+    if(!list)
+        return;
+
+    clear_operation_list(list);
+    free(list->operations);
+    free(list);
+}
+
+/**
+ * @brief Returns a mask of every qubit an operation acts on.
+ * @param operation The operation
+ * @return The mask of the target, control or dense qubits
+ */
+size_t get_qubit_mask(Operation *operation)
+{
+    size_t mask = 0;
+
+    if(operation->type == DENSE_OPERATION) {
+        for(int i=0; i<operation->num_qubits; i++)
+            mask |= (size_t) 1 << operation->qubits[i];
+        return mask;
+    }
+
+    return operation->control_mask | ((size_t) 1 << operation->target);
+}
+
+/**
+ * @brief Classifies a single qubit gate by the structure of its matrix.
+ * Diagonal gates such as Z and phase gates only scale amplitudes and X only
+ * swaps them, so both have cheaper kernels than a general gate.
+ * @param gate An array containing the matrix of the gate
+ * @return GATE_IDENTITY, GATE_DIAGONAL, GATE_PERMUTATION for exactly X, or
+ * GATE_GENERAL
+ */
+GateClass classify_gate(const double gate[8])
+{
+    if(gate[2] == 0 && gate[3] == 0 && gate[4] == 0 && gate[5] == 0) {
+        if(gate[0] == 1 && gate[1] == 0 && gate[6] == 1 && gate[7] == 0)
+            return GATE_IDENTITY;
+        return GATE_DIAGONAL;
+    }
+
+    if(gate[0] == 0 && gate[1] == 0 && gate[6] == 0 && gate[7] == 0 &&
+        gate[2] == 1 && gate[3] == 0 && gate[4] == 1 && gate[5] == 0)
+        return GATE_PERMUTATION;
+
+    return GATE_GENERAL;
+}
+
+/**
+ * @brief Appends a copy of an operation to a list.
+ * The matrix of a dense operation is copied, so the list owns its own.
+ * @param operation The operation to be appended
+ * @param list The operation list to append to
+ */
+void append_operation(Operation *operation, OperationList *list)
+{
+    Operation *copy;
+    size_t size;
+
+    if(list->num_operations == list->capacity) {
+        list->capacity *= 2;
+        list->operations = (Operation *) realloc(list->operations,
+            sizeof(Operation)*list->capacity);
+        if(!list->operations) {
+            fprintf(stderr, "error: unable to grow OperationList.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    copy = &list->operations[list->num_operations++];
+    *copy = *operation;
+
+    if(operation->type == DENSE_OPERATION) {
+        size = (size_t) 1 << (2*operation->num_qubits);
+        copy->matrix = (double *) malloc(sizeof(double)*2*size);
+        memcpy(copy->matrix, operation->matrix, sizeof(double)*2*size);
+    } else {
+        copy->matrix = NULL;
+    }
+}
+
+/**
+ * @brief Appends a gate with any number of control qubits to a list.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param list The operation list to append to
+ */
+void append_multi_controlled_gate(int target, size_t control_mask, double gate[8],
+    OperationList *list)
+{
+    Operation operation;
+
+    operation.type = GATE_OPERATION;
+    operation.target = target;
+    operation.control_mask = control_mask;
+    operation.num_qubits = 0;
+    operation.matrix = NULL;
+
+    for(int i=0; i<8; i++)
+        operation.gate[i] = gate[i];
+
+    append_operation(&operation, list);
+}
+
+/**
+ * @brief Appends a single qubit gate to a list.
+ * @param target The target qubit for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param list The operation list to append to
+ */
+void append_gate(int target, double gate[8], OperationList *list)
+{
+    append_multi_controlled_gate(target, 0, gate, list);
+}
+
+/**
+ * @brief Appends a controlled gate to a list.
+ * @param target The target qubit for the gate
+ * @param control The control qubit for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param list The operation list to append to
+ */
+void append_controlled_gate(int target, int control, double gate[8],
+    OperationList *list)
+{
+    append_multi_controlled_gate(target, (size_t) 1 << control, gate, list);
+}
+
+/**
+ * @brief Appends a doubly controlled gate to a list.
+ * @param target The target qubit for the gate
+ * @param control_1 The first control qubit for the gate
+ * @param control_2 The second control qubit for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param list The operation list to append to
+ */
+void append_double_controlled_gate(int target, int control_1, int control_2,
+    double gate[8], OperationList *list)
+{
+    append_multi_controlled_gate(target, ((size_t) 1 << control_1) | ((size_t) 1 << control_2),
+        gate, list);
+}
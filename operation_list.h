@@ -0,0 +1,46 @@
+#ifndef _OPERATION_LIST_H
+#define _OPERATION_LIST_H
+
+#include <stddef.h>
+
+#define MAX_FUSED_QUBITS 5
+
+typedef enum {GATE_OPERATION, DENSE_OPERATION} OperationType;
+typedef enum {GATE_GENERAL, GATE_IDENTITY, GATE_DIAGONAL, GATE_PERMUTATION} GateClass;
+
+/**
+ * A gate to be applied to a state vector.
+ * GATE_OPERATION applies the 2x2 matrix gate to target when every qubit in
+ * control_mask is set. DENSE_OPERATION applies the (2^num_qubits)^2 complex
+ * matrix to the ascending qubits, with qubits[i] as bit i of the row index.
+ */
+typedef struct Operation
+{
+    OperationType type;
+    int target;
+    size_t control_mask;
+    double gate[8];
+    int num_qubits;
+    int qubits[MAX_FUSED_QUBITS];
+    double *matrix;
+} Operation;
+
+typedef struct OperationList
+{
+    int num_operations;
+    int capacity;
+    Operation *operations;
+} OperationList;
+
+OperationList *initialise_operation_list(void);
+void free_operation_list(OperationList *);
+void clear_operation_list(OperationList *);
+size_t get_qubit_mask(Operation *);
+GateClass classify_gate(const double[8]);
+void append_operation(Operation *, OperationList *);
+void append_gate(int, double[8], OperationList *);
+void append_controlled_gate(int, int, double[8], OperationList *);
+void append_double_controlled_gate(int, int, int, double[8], OperationList *);
+void append_multi_controlled_gate(int, size_t, double[8], OperationList *);
+
+#endif
@@ -0,0 +1,111 @@
+#include "profile.h"
+
+#include <string.h>
+
+static const char *kind_names[NUM_PROFILE_KINDS] = {"general", "diagonal",
+    "permutation", "dense", "gate list", "readout", "other"};
+
+/**
+ * @brief Clears the statistics of every kernel, gate kind and target.
+ * @param stats The statistics to clear
+ */
+void reset_profile_stats(ProfileStats *stats)
+{
+    memset(stats, 0, sizeof(ProfileStats));
+
+    for(int i=0; i<NUM_PROFILE_KINDS; i++)
+        stats->kinds[i].name = kind_names[i];
+}
+
+/**
+ * @brief Adds the times of one launch to an entry.
+ * @param times The queued, submit, start and end times of the launch
+ * @param entry The entry to add to
+ */
+static void add_times(const unsigned long long times[4], ProfileEntry *entry)
+{
+    entry->launches++;
+    entry->queued_time += times[1] - times[0];
+    entry->submit_time += times[2] - times[1];
+    entry->run_time += times[3] - times[2];
+}
+
+/**
+ * @brief Adds the times of one kernel launch to the statistics of its kernel,
+ * its gate kind and its target qubit.
+ * @param kernel The name of the kernel, which must outlive the statistics
+ * @param kind The kind of work the kernel did
+ * @param target The target qubit of the gate applied, or -1 for none
+ * @param times The device's queued, submit, start and end times of the launch
+ * in nanoseconds
+ * @param stats The statistics to add to
+ */
+void add_profile_sample(const char *kernel, ProfileKind kind, int target,
+    const unsigned long long times[4], ProfileStats *stats)
+{
+    int i;
+
+    for(i=0; i<stats->num_kernels; i++)
+        if(!strcmp(stats->kernels[i].name, kernel))
+            break;
+
+    if(i == stats->num_kernels) {
+        if(i == MAX_PROFILED_KERNELS)
+            return;
+        stats->kernels[stats->num_kernels++].name = kernel;
+    }
+
+    add_times(times, &stats->kernels[i]);
+    add_times(times, &stats->kinds[kind]);
+
+    if(target >= 0 && target < MAX_PROFILED_QUBITS)
+        add_times(times, &stats->targets[target]);
+}
+
+/**
+ * @brief Prints one row of the profile table.
+ * @param stream The stream to print to
+ * @param name The name of the row
+ * @param entry The entry to print
+ */
+static void dump_entry(FILE *stream, const char *name, ProfileEntry *entry)
+{
+    if(!entry->launches)
+        return;
+
+    fprintf(stream, "%-24s %9lu %11.3f %13.3f %13.3f\n", name, entry->launches,
+        entry->run_time*1e-6, entry->run_time*1e-3/entry->launches,
+        (entry->queued_time + entry->submit_time)*1e-3/entry->launches);
+}
+
+/**
+ * @brief Prints the statistics by kernel, gate kind and target qubit.
+ * A mean wait from queuing to starting which is long against the mean run
+ * time shows launches are bound by overhead rather than by the device.
+ * @param stream The stream to print to
+ * @param stats The statistics to print
+ */
+void dump_profile_stats(FILE *stream, ProfileStats *stats)
+{
+    const char *header = "%-24s %9s %11s %13s %13s\n";
+    char name[32];
+
+    fprintf(stream, header, "kernel", "launches", "run (ms)", "mean run (us)",
+        "mean wait (us)");
+    for(int i=0; i<stats->num_kernels; i++)
+        dump_entry(stream, stats->kernels[i].name, &stats->kernels[i]);
+
+    fprintf(stream, "\n");
+    fprintf(stream, header, "gate kind", "launches", "run (ms)", "mean run (us)",
+        "mean wait (us)");
+    for(int i=0; i<NUM_PROFILE_KINDS; i++)
+        dump_entry(stream, stats->kinds[i].name, &stats->kinds[i]);
+
+    fprintf(stream, "\n");
+    fprintf(stream, header, "target", "launches", "run (ms)", "mean run (us)",
+        "mean wait (us)");
+    for(int i=0; i<MAX_PROFILED_QUBITS; i++) {
+        sprintf(name, "%d", i);
+        dump_entry(stream, name, &stats->targets[i]);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stdio.h>
+
+#define MAX_PROFILED_KERNELS 32
+#define MAX_PROFILED_QUBITS 64
+#define NUM_PROFILE_KINDS 7
+
+typedef enum {PROFILE_GENERAL, PROFILE_DIAGONAL, PROFILE_PERMUTATION, PROFILE_DENSE,
+    PROFILE_GATE_LIST, PROFILE_READOUT, PROFILE_OTHER} ProfileKind;
+
+/** The summed times of a group of kernel launches, in nanoseconds */
+typedef struct ProfileEntry
+{
+    const char *name;
+    unsigned long launches;
+    double queued_time;
+    double submit_time;
+    double run_time;
+} ProfileEntry;
+
+typedef struct ProfileStats
+{
+    int num_kernels;
+    ProfileEntry kernels[MAX_PROFILED_KERNELS];
+    ProfileEntry kinds[NUM_PROFILE_KINDS];
+    ProfileEntry targets[MAX_PROFILED_QUBITS];
+} ProfileStats;
+
+void reset_profile_stats(ProfileStats *);
+void add_profile_sample(const char *, ProfileKind, int, const unsigned long long[4],
+    ProfileStats *);
+void dump_profile_stats(FILE *, ProfileStats *);
+
+#endif
@@ -1,8 +1,20 @@
-/** Defines complex numbers as a pair of floats.
- * The first float is the real part, the second float is
+/** Defines the precision of the state vector, double when the program is
+ * built with DOUBLE_PRECISION defined and float otherwise.
+ */
+#ifdef DOUBLE_PRECISION
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+typedef double2 real2;
+#else
+typedef float real;
+typedef float2 real2;
+#endif
+
+/** Defines complex numbers as a pair of reals.
+ * The first real is the real part, the second real is
  * the imaginary part.
  */
-typedef float2 cfloat;
+typedef real2 cfloat;
 
 /** Defines complex multiplication for cfloat
  */
@@ -12,28 +24,73 @@ inline cfloat cmult(cfloat a, cfloat b)
 }
 /** Defines absolute value for cfloat
  */
-inline float cabsolute(cfloat a)
+inline real cabsolute(cfloat a)
 {
     return sqrt((a.x * a.x) + (a.y * a.y));
 }
 
 /** Computes the index of the state vector to be modified
  */
-inline int get_index(int n, int target)
+inline ulong get_index(ulong n, int target)
 {
-    int mask = (1 << target) - 1;
+    ulong mask = (1UL << target) - 1;
     return (n & mask) | ((n & ~mask) << 1);
 }
 
+/** Computes the index with a zero bit inserted at every set bit of
+ * fixed_mask, so consecutive n enumerate the states whose fixed bits are zero
+ */
+inline ulong insert_zero_bits(ulong n, ulong fixed_mask)
+{
+    for(int q=0; (fixed_mask >> q) != 0; q++)
+        if((fixed_mask >> q) & 1)
+            n = get_index(n, q);
+    return n;
+}
+
+/** Kinds of gate in a gate list, numbered as GateClass on the host
+ */
+#define GATE_GENERAL 0
+#define GATE_DIAGONAL 2
+#define GATE_PERMUTATION 3
+
+#ifdef SPECIALISED_GATE
+/** Kernel to compute one gate whose TARGET, CONTROL_MASK and GATE_CLASS are
+ * defined when the program is built, so the index arithmetic folds into
+ * constants. Programs built with SPECIALISED_GATE hold only this kernel.
+ */
+__kernel void apply_specialised_gate(__global cfloat *state_vector,
+    cfloat A, cfloat B, cfloat C, cfloat D)
+{
+    ulong const zero_state = insert_zero_bits(get_global_id(0),
+        CONTROL_MASK | (1UL << TARGET)) | CONTROL_MASK;
+    ulong const one_state = zero_state | (1UL << TARGET);
+
+    cfloat const zero_amp = state_vector[zero_state];
+    cfloat const one_amp = state_vector[one_state];
+
+#if GATE_CLASS == GATE_PERMUTATION
+    state_vector[zero_state] = one_amp;
+    state_vector[one_state] = zero_amp;
+#elif GATE_CLASS == GATE_DIAGONAL
+    state_vector[zero_state] = cmult(A, zero_amp);
+    state_vector[one_state] = cmult(D, one_amp);
+#else
+    state_vector[zero_state] = cmult(A, zero_amp) + cmult(B, one_amp);
+    state_vector[one_state] = cmult(C, zero_amp) + cmult(D, one_amp);
+#endif
+}
+#else
+
 /** Kernel to compute gate application
  */
 __kernel void apply_gate(__global cfloat *state_vector, int target,
     cfloat A, cfloat B, cfloat C, cfloat D)
 {
-    int const global_id = get_global_id(0);
+    ulong const global_id = get_global_id(0);
 
-    int const zero_state = get_index(global_id, target);
-    int const one_state = zero_state | (1 << target);
+    ulong const zero_state = get_index(global_id, target);
+    ulong const one_state = zero_state | (1UL << target);
 
     cfloat const zero_amp = state_vector[zero_state];
     cfloat const one_amp = state_vector[one_state];
@@ -42,71 +99,548 @@ __kernel void apply_gate(__global cfloat *state_vector, int target,
     state_vector[one_state] = cmult(C, zero_amp) + cmult(D, one_amp);
 }
 
-/** Kernel to compute controlled gate application
+/** Kernel to compute controlled gate application, each work item updating
+ * one pair of the half of the state where the control is set
  */
 __kernel void apply_controlled_gate(__global cfloat *state_vector,
     int control, int target, cfloat A, cfloat B, cfloat C, cfloat D)
 {
-    int const global_id = get_global_id(0);
+    ulong const global_id = get_global_id(0);
 
-    int const zero_state = get_index(global_id, target);
-    int const one_state = zero_state | (1 << target);
-
-    int const control_val_zero = (((1 << control) & zero_state) > 0) ? 1 : 0;
-    int const control_val_one = (((1 << control) & one_state) > 0) ? 1 : 0;
+    ulong const zero_state = get_index(get_index(global_id, min(control, target)),
+        max(control, target)) | (1UL << control);
+    ulong const one_state = zero_state | (1UL << target);
 
     cfloat const zero_amp = state_vector[zero_state];
     cfloat const one_amp = state_vector[one_state];
 
-    if (control_val_zero == 1)
-        state_vector[zero_state] = cmult(A, zero_amp) + cmult(B, one_amp);
-    
-    if (control_val_one == 1)
-        state_vector[one_state] = cmult(C, zero_amp) + cmult(D, one_amp);
+    state_vector[zero_state] = cmult(A, zero_amp) + cmult(B, one_amp);
+    state_vector[one_state] = cmult(C, zero_amp) + cmult(D, one_amp);
 }
 
-/** Kernel to compute doubly controlled gate application
+/** Kernel to compute doubly controlled gate application, each work item
+ * updating one pair of the quarter of the state where both controls are set
  */
 __kernel void apply_double_controlled_gate(__global cfloat *state_vector,
     int control_1, int control_2, int target, cfloat A, cfloat B, cfloat C,
     cfloat D)
 {
-    int const global_id = get_global_id(0);
+    ulong const global_id = get_global_id(0);
 
-    int const zero_state = get_index(global_id, target);
-    int const one_state = zero_state | (1 << target);
+    ulong const control_mask = (1UL << control_1) | (1UL << control_2);
+    ulong const zero_state = insert_zero_bits(global_id,
+        control_mask | (1UL << target)) | control_mask;
+    ulong const one_state = zero_state | (1UL << target);
 
-    int const control_val_zero = (((1 << control_1) & zero_state) > 0) ? 1 : 0;
-    int const control_val_one = (((1 << control_1) & one_state) > 0) ? 1 : 0;
+    cfloat const zero_amp = state_vector[zero_state];
+    cfloat const one_amp = state_vector[one_state];
+
+    state_vector[zero_state] = cmult(A, zero_amp) + cmult(B, one_amp);
+    state_vector[one_state] = cmult(C, zero_amp) + cmult(D, one_amp);
+}
 
-    int const control_val_two_zero = (((1 << control_2) & zero_state) > 0) ? 1 : 0;
-    int const control_val_two_one = (((1 << control_2) & one_state) > 0) ? 1 : 0;
+/** Kernel to compute gate application with any number of controls, each
+ * work item updating one pair of the subspace where every control is set
+ */
+__kernel void apply_multi_controlled_gate(__global cfloat *state_vector,
+    int target, ulong control_mask, cfloat A, cfloat B, cfloat C, cfloat D)
+{
+    ulong const zero_state = insert_zero_bits(get_global_id(0),
+        control_mask | (1UL << target)) | control_mask;
+    ulong const one_state = zero_state | (1UL << target);
 
     cfloat const zero_amp = state_vector[zero_state];
     cfloat const one_amp = state_vector[one_state];
-    
-    if (control_val_zero == 1 && control_val_two_zero == 1)
-        state_vector[zero_state] = cmult(A, zero_amp) + cmult(B, one_amp);
-    
-    if (control_val_one == 1 && control_val_two_one == 1)
-        state_vector[one_state] = cmult(C, zero_amp) + cmult(D, one_amp);
+
+    state_vector[zero_state] = cmult(A, zero_amp) + cmult(B, one_amp);
+    state_vector[one_state] = cmult(C, zero_amp) + cmult(D, one_amp);
+}
+
+/** Kernel to compute diagonal gate application with any controls, which
+ * only scales the amplitudes of one pair of the control subspace
+ */
+__kernel void apply_diagonal_gate(__global cfloat *state_vector, int target,
+    ulong control_mask, cfloat A, cfloat D)
+{
+    ulong const zero_state = insert_zero_bits(get_global_id(0),
+        control_mask | (1UL << target)) | control_mask;
+    ulong const one_state = zero_state | (1UL << target);
+
+    if(A.x != 1 || A.y != 0)
+        state_vector[zero_state] = cmult(A, state_vector[zero_state]);
+
+    state_vector[one_state] = cmult(D, state_vector[one_state]);
+}
+
+/** Kernel to compute X gate application with any controls, which only
+ * swaps the amplitudes of one pair of the control subspace
+ */
+__kernel void apply_permutation_gate(__global cfloat *state_vector, int target,
+    ulong control_mask)
+{
+    ulong const zero_state = insert_zero_bits(get_global_id(0),
+        control_mask | (1UL << target)) | control_mask;
+    ulong const one_state = zero_state | (1UL << target);
+
+    cfloat const zero_amp = state_vector[zero_state];
+    state_vector[zero_state] = state_vector[one_state];
+    state_vector[one_state] = zero_amp;
+}
+
+/** Kernel to compute gate application on a global qubit of a partitioned
+ * state, each work item updating one pair whose amplitudes lie at the same
+ * index of the partitions where the target is zero and one
+ */
+__kernel void apply_global_gate(__global cfloat *zero_part, __global cfloat *one_part,
+    ulong control_mask, cfloat A, cfloat B, cfloat C, cfloat D)
+{
+    ulong const index = insert_zero_bits(get_global_id(0), control_mask) | control_mask;
+
+    cfloat const zero_amp = zero_part[index];
+    cfloat const one_amp = one_part[index];
+
+    zero_part[index] = cmult(A, zero_amp) + cmult(B, one_amp);
+    one_part[index] = cmult(C, zero_amp) + cmult(D, one_amp);
+}
+
+/** Describes one gate of a gate list, laid out as a GateDescriptorHeader
+ * followed by the 8 reals of the matrix on the host
+ */
+typedef struct GateDescriptor
+{
+    ulong control_mask;
+    int target;
+    int kind;
+    real matrix[8];
+} GateDescriptor;
+
+/** Applies the gate of a descriptor to one pair of amplitudes
+ */
+inline void apply_descriptor(__global const GateDescriptor *gate, cfloat *zero_amp,
+    cfloat *one_amp)
+{
+    __global const real *matrix = gate->matrix;
+    cfloat const zero = *zero_amp;
+    cfloat const one = *one_amp;
+
+    if(gate->kind == GATE_PERMUTATION) {
+        *zero_amp = one;
+        *one_amp = zero;
+    } else if(gate->kind == GATE_DIAGONAL) {
+        *zero_amp = cmult((cfloat)(matrix[0], matrix[1]), zero);
+        *one_amp = cmult((cfloat)(matrix[6], matrix[7]), one);
+    } else {
+        *zero_amp = cmult((cfloat)(matrix[0], matrix[1]), zero) +
+            cmult((cfloat)(matrix[2], matrix[3]), one);
+        *one_amp = cmult((cfloat)(matrix[4], matrix[5]), zero) +
+            cmult((cfloat)(matrix[6], matrix[7]), one);
+    }
+}
+
+/** Kernel to apply a list of gates in one launch. It runs as a single work
+ * group which shares the pairs of each gate between its work items and
+ * waits at a barrier before the next gate
+ */
+__kernel void apply_gate_list(__global cfloat *state_vector,
+    __global const GateDescriptor *gates, int num_gates, ulong num_pairs)
+{
+    for(int g=0; g<num_gates; g++) {
+        ulong const control_mask = gates[g].control_mask;
+        ulong const one_bit = 1UL << gates[g].target;
+        ulong const num_op = num_pairs >> popcount(control_mask);
+
+        for(ulong i=get_local_id(0); i<num_op; i+=get_local_size(0)) {
+            ulong const zero_state = insert_zero_bits(i, control_mask | one_bit) |
+                control_mask;
+            cfloat zero_amp = state_vector[zero_state];
+            cfloat one_amp = state_vector[zero_state | one_bit];
+
+            apply_descriptor(&gates[g], &zero_amp, &one_amp);
+            state_vector[zero_state] = zero_amp;
+            state_vector[zero_state | one_bit] = one_amp;
+        }
+
+        barrier(CLK_GLOBAL_MEM_FENCE);
+    }
+}
+
+/** Kernel to apply a run of gates acting only on qubits below tile_qubits.
+ * Each work group loads one tile of 2^tile_qubits amplitudes into local
+ * memory, applies every gate to it with barriers between gates and writes it
+ * back, so the whole run costs one pass over global memory
+ */
+__kernel void apply_gate_tile(__global cfloat *state_vector,
+    __global const GateDescriptor *gates, int num_gates, int tile_qubits,
+    __local cfloat *tile)
+{
+    ulong const tile_size = 1UL << tile_qubits;
+    ulong const base = (ulong) get_group_id(0) << tile_qubits;
+
+    for(ulong i=get_local_id(0); i<tile_size; i+=get_local_size(0))
+        tile[i] = state_vector[base + i];
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(int g=0; g<num_gates; g++) {
+        ulong const control_mask = gates[g].control_mask;
+        ulong const one_bit = 1UL << gates[g].target;
+        ulong const num_op = (tile_size/2) >> popcount(control_mask);
+
+        for(ulong i=get_local_id(0); i<num_op; i+=get_local_size(0)) {
+            ulong const zero_state = insert_zero_bits(i, control_mask | one_bit) |
+                control_mask;
+            cfloat zero_amp = tile[zero_state];
+            cfloat one_amp = tile[zero_state | one_bit];
+
+            apply_descriptor(&gates[g], &zero_amp, &one_amp);
+            tile[zero_state] = zero_amp;
+            tile[zero_state | one_bit] = one_amp;
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    for(ulong i=get_local_id(0); i<tile_size; i+=get_local_size(0))
+        state_vector[base + i] = tile[i];
+}
+
+/** Kernel to apply a dense unitary on up to 5 qubits, each work item
+ * updating the group of amplitudes which share every other bit
+ */
+__kernel void apply_dense_gate(__global cfloat *state_vector,
+    __global const cfloat *matrix, int num_qubits, ulong qubit_mask)
+{
+    int const size = 1 << num_qubits;
+    int qubits[5];
+    ulong offsets[32];
+    cfloat amps[32];
+    ulong base = get_global_id(0);
+    int k = 0;
+
+    for(int q=0; k<num_qubits; q++)
+        if((qubit_mask >> q) & 1)
+            qubits[k++] = q;
+
+    for(int i=0; i<num_qubits; i++)
+        base = get_index(base, qubits[i]);
+
+    for(int j=0; j<size; j++) {
+        offsets[j] = base;
+        for(int i=0; i<num_qubits; i++)
+            if((j >> i) & 1)
+                offsets[j] |= 1UL << qubits[i];
+        amps[j] = state_vector[offsets[j]];
+    }
+
+    for(int row=0; row<size; row++) {
+        cfloat sum = (cfloat)(0, 0);
+        for(int col=0; col<size; col++)
+            sum += cmult(matrix[row*size+col], amps[col]);
+        state_vector[offsets[row]] = sum;
+    }
 }
 
 /** Kernel to apply measurement to state vector
  */
 __kernel void measure(__global cfloat *const state_vector,
-                      __global float *probabilities)
+                      __global real *probabilities)
 {
-    int const index = get_global_id(0);
+    ulong const index = get_global_id(0);
     cfloat amp = state_vector[index];
     probabilities[index] = cabsolute(cmult(amp, amp));
 }
 
+/** Number of qubits of the amplitudes each work item of reduce_qubit_marginals
+ * sums, at most
+ */
+#define REDUCE_ITEM_QUBITS 8
+
+/** Number of bins of the probability histogram, one per 8 bit digit of a key
+ */
+#define HISTOGRAM_BINS 256
+
+/** Sums a value over the work group, whose size must be a power of two.
+ * Every work item of the group must call it.
+ */
+inline real work_group_sum(real value, __local real *scratch)
+{
+    uint const local_id = get_local_id(0);
+
+    scratch[local_id] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(uint stride=get_local_size(0)/2; stride>0; stride/=2) {
+        if(local_id < stride)
+            scratch[local_id] += scratch[local_id + stride];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    value = scratch[0];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    return value;
+}
+
+/** Kernel to sum the probability of every state and of each qubit being one.
+ * Work item i sums the amplitudes i + k*global_size, so the bits of k are the
+ * highest qubits, the bits of the local id the lowest and the bits of the
+ * group id those in between. Each work group writes a row of num_qubits+1
+ * partial sums: the total followed by the sum for each qubit.
+ */
+__kernel void reduce_qubit_marginals(__global cfloat *const state_vector,
+    __global real *partials, int num_qubits, int item_qubits, __local real *scratch)
+{
+    ulong const global_id = get_global_id(0);
+    ulong const global_size = get_global_size(0);
+    ulong const group_id = get_group_id(0);
+    uint const local_id = get_local_id(0);
+    int const local_qubits = popcount((uint) get_local_size(0) - 1);
+    int const global_qubits = num_qubits - item_qubits;
+    __global real *row = partials + group_id*(num_qubits+1);
+    real total = 0, high[REDUCE_ITEM_QUBITS], sum;
+
+    for(int j=0; j<REDUCE_ITEM_QUBITS; j++)
+        high[j] = 0;
+
+    for(ulong k=0; k<(1UL << item_qubits); k++) {
+        cfloat amp = state_vector[global_id + k*global_size];
+        real const probability = amp.x*amp.x + amp.y*amp.y;
+        total += probability;
+        for(int j=0; j<item_qubits; j++)
+            if((k >> j) & 1)
+                high[j] += probability;
+    }
+
+    sum = work_group_sum(total, scratch);
+    if(local_id == 0) {
+        row[0] = sum;
+        for(int q=local_qubits; q<global_qubits; q++)
+            row[1+q] = ((group_id >> (q-local_qubits)) & 1) ? sum : 0;
+    }
+
+    for(int q=0; q<local_qubits; q++) {
+        sum = work_group_sum(((local_id >> q) & 1) ? total : 0, scratch);
+        if(local_id == 0)
+            row[1+q] = sum;
+    }
+
+    for(int j=0; j<item_qubits; j++) {
+        sum = work_group_sum(high[j], scratch);
+        if(local_id == 0)
+            row[1+global_qubits+j] = sum;
+    }
+}
+
+/** Scatters the low bits of value to the set bits of mask, the lowest bit of
+ * value going to the lowest bit of mask
+ */
+inline ulong deposit_bits(ulong value, ulong mask)
+{
+    ulong result = 0;
+
+    for(; value && mask; mask &= mask-1, value >>= 1)
+        if(value & 1)
+            result |= mask & (~mask + 1);
+
+    return result;
+}
+
+/** Kernel to sum the probabilities of each value of the register of the
+ * qubits in qubit_mask, bit j of a value being the j-th lowest qubit of the
+ * register. Work item i sums value i % 2^k over every num_rows-th state of the
+ * other qubits, and writes it to partials[i], so the partial sums form
+ * num_rows rows, each a private histogram of its share of the state.
+ */
+__kernel void reduce_register(__global cfloat *const state_vector,
+    __global real *partials, ulong qubit_mask, ulong num_rest, ulong num_rows)
+{
+    ulong const global_id = get_global_id(0);
+    int const register_qubits = popcount(qubit_mask);
+    ulong const rest_mask = ((num_rest << register_qubits) - 1) & ~qubit_mask;
+    ulong const value_bits = deposit_bits(global_id & ((1UL << register_qubits) - 1),
+        qubit_mask);
+    real sum = 0;
+
+    for(ulong rest=global_id >> register_qubits; rest<num_rest; rest+=num_rows) {
+        cfloat amp = state_vector[deposit_bits(rest, rest_mask) | value_bits];
+        sum += amp.x*amp.x + amp.y*amp.y;
+    }
+
+    partials[global_id] = sum;
+}
+
+/** Kernel to sum the rows of partial sums written by a reduction, one work
+ * item per column
+ */
+__kernel void sum_partials(__global real *const partials, __global real *sums,
+    ulong num_rows, int num_columns)
+{
+    int const column = get_global_id(0);
+    real sum = 0;
+
+    for(ulong row=0; row<num_rows; row++)
+        sum += partials[row*num_columns + column];
+
+    sums[column] = sum;
+}
+
+/** Kernel to sum the probabilities of each block of 2^block_qubits
+ * consecutive states, work item i summing block i into sums[i]
+ */
+__kernel void sum_blocks(__global cfloat *const state_vector, __global real *sums,
+    int block_qubits)
+{
+    ulong const block = get_global_id(0);
+    ulong const first = block << block_qubits;
+    real sum = 0;
+
+    for(ulong i=first; i<first + (1UL << block_qubits); i++) {
+        cfloat amp = state_vector[i];
+        sum += amp.x*amp.x + amp.y*amp.y;
+    }
+
+    sums[block] = sum;
+}
+
+/** Kernel to resolve shots drawn within blocks of 2^block_qubits states. Shot
+ * i lies residuals[i] into the probability of block indices[i], and takes the
+ * first state at which the block's sum passes it, or the block's last state of
+ * non-zero probability if rounding leaves it unreached.
+ */
+__kernel void sample_in_blocks(__global cfloat *const state_vector,
+    __global ulong *indices, __global real *const residuals, int block_qubits,
+    ulong num_shots)
+{
+    ulong const shot = get_global_id(0);
+    ulong first, chosen;
+    real residual, sum = 0;
+
+    if(shot >= num_shots)
+        return;
+
+    first = indices[shot] << block_qubits;
+    residual = residuals[shot];
+    chosen = first;
+
+    for(ulong i=first; i<first + (1UL << block_qubits); i++) {
+        cfloat amp = state_vector[i];
+        real const probability = amp.x*amp.x + amp.y*amp.y;
+        if(probability > 0)
+            chosen = i;
+        sum += probability;
+        if(sum > residual)
+            break;
+    }
+
+    indices[shot] = chosen;
+}
+
+/** Kernel to sum the Pauli strings sharing the X mask x_mask. Each pair of
+ * states j and j^x_mask is visited once, from the j whose lowest bit of x_mask
+ * is clear, as is every state when x_mask is zero. Work item i sums term
+ * i % num_terms over every num_rows-th pair, taking the real part of
+ * conj(state[j^x_mask])*state[j] for strings with an even number of Y and the
+ * imaginary part otherwise, with sign (-1)^popcount(j & z_masks[term]). It
+ * writes partials[i], so the partial sums form num_rows rows.
+ */
+__kernel void pauli_group_sums(__global cfloat *const state_vector,
+    __global real *partials, ulong x_mask, __global ulong *const z_masks,
+    ulong num_terms, ulong num_pairs, ulong num_rows)
+{
+    ulong const global_id = get_global_id(0);
+    ulong const z_mask = z_masks[global_id % num_terms];
+    ulong const low_mask = (x_mask & (~x_mask + 1)) - 1;
+    bool const imaginary = popcount(x_mask & z_mask) & 1;
+    real sum = 0;
+
+    for(ulong pair=global_id/num_terms; pair<num_pairs; pair+=num_rows) {
+        ulong const index = x_mask ? ((pair & ~low_mask) << 1) | (pair & low_mask) : pair;
+        cfloat const amp = state_vector[index];
+        cfloat const partner = state_vector[index ^ x_mask];
+        real const value = imaginary ? partner.x*amp.y - partner.y*amp.x :
+            partner.x*amp.x + partner.y*amp.y;
+        sum += (popcount(index & z_mask) & 1) ? -value : value;
+    }
+
+    partials[global_id] = sum;
+}
+
+/** Computes a key ordering probabilities as unsigned integers, since the bits
+ * of non-negative IEEE floats sort in the same order as their values
+ */
+inline ulong probability_key(cfloat amp)
+{
+#ifdef DOUBLE_PRECISION
+    return as_ulong(amp.x*amp.x + amp.y*amp.y);
+#else
+    return as_uint(amp.x*amp.x + amp.y*amp.y);
+#endif
+}
+
+/** Kernel to count the probability keys in each bin of the 8 bit digit at
+ * shift, among the keys whose higher digits equal prefix. Each count is 64 bits
+ * kept as a low and a high 32 bit atomic.
+ */
+__kernel void probability_histogram(__global cfloat *const state_vector,
+    __global uint *counts, ulong num_amp, ulong prefix, int shift)
+{
+    __local uint local_counts[HISTOGRAM_BINS];
+    uint count;
+
+    for(uint bin=get_local_id(0); bin<HISTOGRAM_BINS; bin+=get_local_size(0))
+        local_counts[bin] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(ulong index=get_global_id(0); index<num_amp; index+=get_global_size(0)) {
+        ulong const key = probability_key(state_vector[index]);
+        if(shift + 8 == 64 || (key >> (shift + 8)) == prefix)
+            atomic_inc(&local_counts[(key >> shift) & (HISTOGRAM_BINS - 1)]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(uint bin=get_local_id(0); bin<HISTOGRAM_BINS; bin+=get_local_size(0)) {
+        count = local_counts[bin];
+        if(count && atomic_add(&counts[2*bin], count) > UINT_MAX - count)
+            atomic_inc(&counts[2*bin+1]);
+    }
+}
+
+/** Kernel to gather the states whose key shifted by shift is above prefix,
+ * of which there are num_above, and the first num_ties states whose key equals
+ * it, with their probabilities
+ */
+__kernel void select_top_k(__global cfloat *const state_vector,
+    __global ulong *indices, __global real *probabilities, __global uint *counters,
+    ulong num_amp, ulong prefix, int shift, uint num_above, uint num_ties)
+{
+    ulong key;
+    uint slot;
+
+    for(ulong index=get_global_id(0); index<num_amp; index+=get_global_size(0)) {
+        cfloat amp = state_vector[index];
+        key = probability_key(amp) >> shift;
+
+        if(key > prefix) {
+            slot = atomic_inc(&counters[0]);
+        } else if(key == prefix && *(volatile __global uint *) &counters[1] < num_ties) {
+            slot = atomic_inc(&counters[1]);
+            if(slot >= num_ties)
+                continue;
+            slot += num_above;
+        } else {
+            continue;
+        }
+
+        indices[slot] = index;
+        probabilities[slot] = amp.x*amp.x + amp.y*amp.y;
+    }
+}
+
 /** Kernel to initialise state vector to |0...0>
  */
 __kernel void initialise_state(__global cfloat *state_vector)
 {
-    int const index = get_global_id(0);
-    state_vector[index][0] = 0;
-    state_vector[index][1] = 0;
-}
\ No newline at end of file
+    ulong const index = get_global_id(0);
+    state_vector[index] = (cfloat)(index == 0 ? 1 : 0, 0);
+}
+#endif
@@ -0,0 +1,220 @@
+#define RESULT_CHUNK ((size_t) 1 << 12)
+#define RESULT_CHUNKS_PER_THREAD 2
+#define MAX_PROBABILITY_CHARS 32
+
+#include "result_writer.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Results are written in batches of chunks of RESULT_CHUNK entries. The
+ * chunks of a batch are formatted into their own buffers in parallel and then
+ * written to the file in order, so the output is the same as a serial loop.
+ */
+typedef struct WriteTask
+{
+    const ResultOptions *options;
+    int num_qubits;
+    const size_t *indices;
+    const double *probabilities;
+    size_t first;
+    size_t end;
+    char **buffers;
+    size_t *lengths;
+    size_t *counts;
+} WriteTask;
+
+/**
+ * @brief Returns the default options of write_results(): every state as
+ * text, since a threshold of 0 keeps states of zero probability too.
+ * @return The default result options
+ */
+ResultOptions default_result_options()
+{
+    ResultOptions options;
+
+    options.format = RESULT_TEXT;
+    options.selection = RESULT_THRESHOLD;
+    options.threshold = 0;
+    options.k = 0;
+
+    return options;
+}
+
+/**
+ * @brief Writes the bitstring of a state, character i holding qubit i.
+ * @param index The state
+ * @param num_qubits The number of qubits
+ * @param string An array to hold the bitstring, must be at least of size
+ * num_qubits+1
+ */
+void format_bitstring(size_t index, int num_qubits, char *string)
+{
+    for(int i=0; i<num_qubits; i++)
+        string[i] = (char) ('0' + ((index >> i) & 1));
+
+    string[num_qubits] = '\0';
+}
+
+/**
+ * @brief Writes one result in the format of a write.
+ * Text records are the bitstring alone, CSV records the bitstring and the
+ * probability, and binary records the state as a 64 bit integer followed by
+ * the probability as a double, both in the host's byte order.
+ * @param index The state
+ * @param probability The probability of the state
+ * @param task The WriteTask holding the options
+ * @param record An array to hold the record, must be at least of size
+ * num_qubits+1+MAX_PROBABILITY_CHARS
+ * @return The length of the record in bytes
+ */
+static size_t format_record(size_t index, double probability, WriteTask *task,
+    char *record)
+{
+    const int num_qubits = task->num_qubits;
+    uint64_t packed_index = index;
+
+    switch(task->options->format) {
+        case RESULT_BINARY:
+            memcpy(record, &packed_index, sizeof(uint64_t));
+            memcpy(record + sizeof(uint64_t), &probability, sizeof(double));
+            return sizeof(uint64_t) + sizeof(double);
+        case RESULT_CSV:
+            format_bitstring(index, num_qubits, record);
+            record[num_qubits] = ',';
+            return num_qubits + 1 + snprintf(record + num_qubits + 1,
+                MAX_PROBABILITY_CHARS, "%.17g\n", probability);
+        default:
+            format_bitstring(index, num_qubits, record);
+            record[num_qubits] = '\n';
+            return num_qubits + 1;
+    }
+}
+
+/**
+ * @brief Formats the chunks in [start, end) of a batch into their buffers.
+ * Without a list of indices every state is an entry and those below the
+ * threshold are skipped.
+ * @param start The first chunk of the batch to format
+ * @param end One past the last chunk to format
+ * @param data The WriteTask holding the entries and the buffers
+ */
+static void format_chunks_task(size_t start, size_t end, void *data)
+{
+    WriteTask *task = (WriteTask *) data;
+    size_t first, last, length, count;
+
+    for(size_t chunk=start; chunk<end; chunk++) {
+        first = task->first + chunk*RESULT_CHUNK;
+        last = task->end - first < RESULT_CHUNK ? task->end : first + RESULT_CHUNK;
+        length = 0;
+        count = 0;
+
+        for(size_t i=first; i<last; i++) {
+            if(!task->indices && task->probabilities[i] < task->options->threshold)
+                continue;
+            length += format_record(task->indices ? task->indices[i] : i,
+                task->probabilities[i], task, task->buffers[chunk] + length);
+            count++;
+        }
+
+        task->lengths[chunk] = length;
+        task->counts[chunk] = count;
+    }
+}
+
+/**
+ * Writes the results of a simulation to a file as they are formatted.
+ * In threshold mode every state whose probability is at least the threshold
+ * is written in order, from the probabilities of the last measure(), which is
+ * called if the simulation has not been measured. In top k mode the k most
+ * probable states are found by top_k_states() without reading every
+ * probability, and written from the most probable. CSV output starts with a
+ * header line.
+ * @param file The file to write to
+ * @param options The selection and format of the results
+ * @param simulation The simulation whose results are written
+ * @return The number of states written
+ */
+size_t write_results(FILE *file, const ResultOptions *options, Simulation *simulation)
+{
+    WriteTask task;
+    const int num_threads = simulation->thread_pool ?
+        simulation->thread_pool->num_threads : 1;
+    const size_t batch_chunks = (size_t) RESULT_CHUNKS_PER_THREAD*num_threads;
+    size_t *indices = NULL, num_entries, num_chunks, written = 0, record_size;
+    double *selected = NULL;
+
+    task.options = options;
+    task.num_qubits = 0;
+    while(((size_t) 1 << task.num_qubits) < simulation->num_amp)
+        task.num_qubits++;
+    record_size = task.num_qubits + 1 + MAX_PROBABILITY_CHARS;
+
+    if(options->selection == RESULT_TOP_K) {
+        num_entries = options->k < simulation->num_amp ? options->k : simulation->num_amp;
+        indices = (size_t *) malloc(sizeof(size_t)*(num_entries + 1));
+        selected = (double *) malloc(sizeof(double)*(num_entries + 1));
+        if(!indices || !selected) {
+            fprintf(stderr, "error: unable to allocate top k results.\n");
+            exit(EXIT_FAILURE);
+        }
+        num_entries = top_k_states(num_entries, indices, selected, simulation);
+        task.indices = indices;
+        task.probabilities = selected;
+    } else {
+        if(!simulation->probabilities)
+            measure(simulation);
+        num_entries = simulation->num_amp;
+        task.indices = NULL;
+        task.probabilities = simulation->probabilities;
+    }
+
+    task.buffers = (char **) malloc(sizeof(char *)*batch_chunks);
+    task.lengths = (size_t *) malloc(sizeof(size_t)*batch_chunks);
+    task.counts = (size_t *) malloc(sizeof(size_t)*batch_chunks);
+    if(!task.buffers || !task.lengths || !task.counts) {
+        fprintf(stderr, "error: unable to allocate result buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+    for(size_t chunk=0; chunk<batch_chunks; chunk++) {
+        task.buffers[chunk] = (char *) malloc(record_size*RESULT_CHUNK);
+        if(!task.buffers[chunk]) {
+            fprintf(stderr, "error: unable to allocate result buffers.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(options->format == RESULT_CSV)
+        fputs("state,probability\n", file);
+
+    for(task.first=0; task.first<num_entries; task.first=task.end) {
+        task.end = num_entries - task.first < batch_chunks*RESULT_CHUNK ? num_entries :
+            task.first + batch_chunks*RESULT_CHUNK;
+        num_chunks = (task.end - task.first + RESULT_CHUNK - 1)/RESULT_CHUNK;
+
+        run_parallel_blocks(simulation->thread_pool, format_chunks_task, num_chunks,
+            &task);
+
+        for(size_t chunk=0; chunk<num_chunks; chunk++) {
+            if(fwrite(task.buffers[chunk], 1, task.lengths[chunk], file) !=
+                task.lengths[chunk]) {
+                perror("Couldn't write the results");
+                exit(1);
+            }
+            written += task.counts[chunk];
+        }
+    }
+
+    for(size_t chunk=0; chunk<batch_chunks; chunk++)
+        free(task.buffers[chunk]);
+    free(task.buffers);
+    free(task.lengths);
+    free(task.counts);
+    free(indices);
+    free(selected);
+
+    return written;
+}
@@ -0,0 +1,24 @@
+#ifndef _RESULT_WRITER_H
+#define _RESULT_WRITER_H
+
+#include "simulation.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef enum {RESULT_TEXT, RESULT_CSV, RESULT_BINARY} ResultFormat;
+typedef enum {RESULT_THRESHOLD, RESULT_TOP_K} ResultSelection;
+
+typedef struct ResultOptions
+{
+    ResultFormat format;
+    ResultSelection selection;
+    double threshold;
+    size_t k;
+} ResultOptions;
+
+ResultOptions default_result_options(void);
+void format_bitstring(size_t, int, char *);
+size_t write_results(FILE *, const ResultOptions *, Simulation *);
+
+#endif
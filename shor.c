@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <math.h>
+#include <time.h>
 
 #define QUBITS 5
 
@@ -115,9 +116,9 @@ int mod_inverse(int a, int n)
     return x_1;
 }
 
-void phase_gate(float k, float gate[8])
+void phase_gate(double k, double gate[8])
 {   
-    float values[8] = { 1, 0, 0, 0, 0, 0, cosf(k), sinf(k)};
+    double values[8] = { 1, 0, 0, 0, 0, 0, cos(k), sin(k)};
     
     for(int i=0; i<8; i++)
         gate[i] = values[i];
@@ -138,7 +139,7 @@ void apply_multi_swap(Simulation *simulation)
 
 void apply_qft(int size, Simulation *simulation)
 {
-    float gate[8];
+    double gate[8];
 
     for(int i=0; i<size; i++) {
         for(int j=size; j>i; j--) {
@@ -158,7 +159,7 @@ void apply_qft(int size, Simulation *simulation)
 
 void apply_inv_qft(int size, Simulation *simulation)
 {
-    float gate[8];
+    double gate[8];
 
     for(int i=0; i<size/2; i++) {
         apply_swap(i, size-i-1, simulation);
@@ -178,7 +179,7 @@ void apply_inv_qft(int size, Simulation *simulation)
 
 void apply_add(int a, Simulation *simulation)
 {
-    float gate[8];
+    double gate[8];
     int binary_a[8];
     int_to_binary(a, binary_a);
 
@@ -194,7 +195,7 @@ void apply_add(int a, Simulation *simulation)
 
 void apply_inv_add(int a, Simulation *simulation)
 {
-    float gate[8];
+    double gate[8];
     int binary_a[8];
     int_to_binary(a, binary_a);
 
@@ -210,7 +211,7 @@ void apply_inv_add(int a, Simulation *simulation)
 
 void apply_add_c(int a, int c, Simulation *simulation)
 {
-    float gate[8];
+    double gate[8];
     int binary_a[8];
     int_to_binary(a, binary_a);
 
@@ -226,7 +227,7 @@ void apply_add_c(int a, int c, Simulation *simulation)
 
 void apply_inv_add_c(int a, int c, Simulation *simulation)
 {
-    float gate[8];
+    double gate[8];
     int binary_a[8];
     int_to_binary(a, binary_a);
 
@@ -242,7 +243,7 @@ void apply_inv_add_c(int a, int c, Simulation *simulation)
 
 void apply_add_c_c(int a, int c1, int c2, Simulation *simulation)
 {
-    float gate[8];
+    double gate[8];
     int binary_a[8];
     int_to_binary(a, binary_a);
 
@@ -258,7 +259,7 @@ void apply_add_c_c(int a, int c1, int c2, Simulation *simulation)
 
 void apply_inv_add_c_c(int a, int c1, int c2, Simulation *simulation)
 {
-    float gate[8];
+    double gate[8];
     int binary_a[8];
     int_to_binary(a, binary_a);
 
@@ -328,17 +329,6 @@ void apply_u_a(int a, int n, int c, int zero, Simulation *simulation)
     inv_mult_a_mod_n_c(mod_inverse(a, n), n, c, zero, simulation);
 }
 
-int read_qubit(int n, Simulation *simulation)
-{
-    float state_vector[simulation->num_amp*2];
-    test_state_vector(state_vector, simulation);
-
-    for(int i=0; i<simulation->num_amp*2; i++)
-        state_vector[i] *= state_vector[i];
-    
-    return 1;
-}
-
 int find_period(int a, int N)
 {
     Simulation *simulation = set_up_simulation();
@@ -348,13 +338,15 @@ int find_period(int a, int N)
     int ancilla = QUBITS*2-1;
     int answer = QUBITS*2;
     int answer_register[QUBITS-1];
+    double distribution[1 << (QUBITS-1)];
+    unsigned long long rng_state = (unsigned long long) time(NULL);
 
     apply_gate(0, x, simulation);
 
     for(int i=0; i<QUBITS-1; i++) {
         apply_gate(answer, hadamard, simulation);
         apply_u_a((int) pow(a, pow(2, i)) % N, N, answer, ancilla, simulation);
-        answer_register[i] = read_qubit(answer, simulation);
+        answer_register[i] = measure_qubit(answer, &rng_state, simulation);
         apply_gate(answer, hadamard, simulation);
         if(answer_register[i] == 1)
             apply_gate(answer, x, simulation);
@@ -374,10 +366,10 @@ int find_period(int a, int N)
 
     apply_qft(QUBITS-1, simulation);
 
-    measure(simulation);
+    marginal(((size_t) 1 << (QUBITS-1)) - 1, distribution, simulation);
     
-    for(int i=0; i<simulation->num_amp; i++)
-        if((simulation->probabilities[i]*100) > simulation->epsilon)
+    for(size_t i=0; i<((size_t) 1 << (QUBITS-1)); i++)
+        if((distribution[i]*100) > simulation->epsilon)
             phase = i;
 
     deallocate_resources(simulation);
@@ -1,115 +1,138 @@
-#define _CRT_SECURE_NO_WARNINGS
-#define PROGRAM_FILE "program.cl"
-#define APPLY_GATE_FUNC "apply_gate"
-#define APPLY_CGATE_FUNC "apply_controlled_gate"
-#define APPLY_CCGATE_FUNC "apply_double_controlled_gate"
-#define MEASURE_FUNC "measure"
-#define INITIALISE_FUNC "initialise_state"
-
 #include "simulation.h"
-
+#include "cpu_backend.h"
+#include "gate_fusion.h"
+#include "result_writer.h"
+#ifdef OPENCL
+#include "opencl_backend.h"
+#endif
+
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/types.h>
-#include <OpenCL/cl.h>
+#include <string.h>
 #include <math.h>
+#include <unistd.h>
 
-const float sqrt_2 = 1.414214;
-float x[8] = {0,0,1,0,1,0,0,0};
-float z[8] = {1,0,0,0,0,0,1,0};
-float hadamard[8] = {1/sqrt_2,0,1/sqrt_2,0,1/sqrt_2,0,-1/sqrt_2,0};
+#define SAMPLE_BLOCK_QUBITS 6
+#define SAMPLE_CHUNK ((size_t) 1 << 16)
 
-/**
- * Sets a given array of size n to the binary representation of k
- * @param k An integer to be converted into binary
- * @param n The size of the array containing the binary representation
- * @param array The array in which to store the binary representation
- */
-void int_to_bin(int k, int n, char *array) {
-    for(int i=n-1; i>=0; i--)
-        if(k >= (int) pow((double) 2, (double) i)) {
-            array[i] = '1';
-            k -= (int) pow((double) 2, (double) i);
-        } else
-            array[i] = '0';
+const double sqrt_2 = 1.4142135623730951;
+double x[8] = {0,0,1,0,1,0,0,0};
+double z[8] = {1,0,0,0,0,0,1,0};
+double hadamard[8] = {1/sqrt_2,0,1/sqrt_2,0,1/sqrt_2,0,-1/sqrt_2,0};
 
-    array[n] = '\0';
-}
 /**
- * Prints the results of a given simulation.
+ * Prints the results of a given simulation, one bitstring per line.
  * To chose the threshold for which to print a value, set simulation's epsilon value.
+ * The states are written by write_results(), see result_writer.c.
  * @param simulation The current simulation object to print from
  */
 void print_results(Simulation *simulation)
 {
-    char array[(int) log2(simulation->num_amp)+1];
+    ResultOptions options = default_result_options();
 
-    for(int i=0; i<simulation->num_amp; i++)
-        if(simulation->probabilities[i] >= simulation->epsilon) {
-            int_to_bin(i, log2(simulation->num_amp), array);
-            //printf("%s: %f %%\n", array, simulation->probabilities[i]*100);
-            printf("%s\n", array);
-        }
+    options.threshold = simulation->epsilon;
+    write_results(stdout, &options, simulation);
+}
+
+/**
+ * Returns the size of one real number at the given precision.
+ * @param precision The precision of the state vector
+ * @return The size in bytes of a float or a double
+ */
+size_t precision_size(Precision precision)
+{
+    return precision == PRECISION_DOUBLE ? sizeof(double) : sizeof(float);
 }
 
 /**
- * Reads the state vector from the GPU'memory and stores it in the state array.
- * Useful for debugging quantum algorithms.
+ * Reads the state vector from the backend's memory and stores it in the
+ * state array. Useful for debugging quantum algorithms.
  * @param state An array to hold the state buffer, must be at least of size
  * simulation->num_amplitudes * 2
  * @param simulation The simulation to test
  */
-void test_state_vector(float *state, Simulation *simulation)
+void test_state_vector(double *state, Simulation *simulation)
 {
-    cl_int error;
+    flush_operations(simulation);
 
-    error = clEnqueueReadBuffer(simulation->queue, simulation->state_vector_buffer,
-        CL_TRUE, 0, sizeof(float)*simulation->num_amp*2, state, 0, NULL, NULL);
-    if(error < 0) {
-        printf("error: %d\n", error);
-        perror("Couldn't enqueue the read state command");
-        exit(1);   
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_test_state_vector(state, simulation);
+        return;
     }
-    
-    return;
+#endif
+    cpu_test_state_vector(state, simulation);
 }
 
 /**
- * Deallocates all resources associated with a simulation.
- * Run before exiting program to avoid memory leaks.
- * @param simulation A simulation object which is no longer in use
+ * @brief Blocks until an asynchronous read has completed, whether or not it
+ * succeeded.
+ * @param result The result to wait for
  */
-void deallocate_resources(Simulation *simulation)
+static void wait_for_completion(AsyncResult *result)
 {
-    if(simulation->apply_gate_kernel)
-        clReleaseKernel(simulation->apply_gate_kernel);
-    
-    if(simulation->apply_controlled_gate_kernel)
-        clReleaseKernel(simulation->apply_controlled_gate_kernel);
-    
-    if(simulation->apply_double_controlled_gate_kernel)
-        clReleaseKernel(simulation->apply_double_controlled_gate_kernel);
+    pthread_mutex_lock(&result->lock);
+    while(!result->complete)
+        pthread_cond_wait(&result->done, &result->lock);
+    pthread_mutex_unlock(&result->lock);
+}
 
-    if(simulation->measure_kernel)
-        clReleaseKernel(simulation->measure_kernel);
+/**
+ * @brief Frees the host arrays of probabilities once every measurement into
+ * them has completed.
+ * @param simulation The simulation owning the probabilities
+ */
+static void release_probabilities(Simulation *simulation)
+{
+    for(int slot=0; slot<2; slot++)
+        if(simulation->probability_results[slot]) {
+            wait_for_completion(simulation->probability_results[slot]);
+            simulation->probability_results[slot]->simulation = NULL;
+            simulation->probability_results[slot] = NULL;
+        }
 
-    if(simulation->initialise_state_kernel)
-        clReleaseKernel(simulation->initialise_state_kernel);
+    free(simulation->probabilities);
+    free(simulation->back_probabilities);
+    simulation->probabilities = NULL;
+    simulation->back_probabilities = NULL;
+}
 
-    if(simulation->queue)
-        clReleaseCommandQueue(simulation->queue);
+/**
+ * @brief Allocates a host array of probabilities the first time it is needed.
+ * @param probabilities The array to allocate if it is NULL
+ * @param simulation The simulation whose probabilities it holds
+ */
+static void allocate_probabilities(double **probabilities, Simulation *simulation)
+{
+    if(*probabilities)
+        return;
 
-    if(clReleaseProgram(simulation->program))
-        clReleaseProgram(simulation->program);
+    *probabilities = (double *) malloc(sizeof(double)*simulation->num_amp);
+    if(!*probabilities) {
+        fprintf(stderr, "error: unable to allocate probabilities.\n");
+        exit(EXIT_FAILURE);
+    }
+}
 
-    if(clReleaseContext(simulation->context))
-        clReleaseContext(simulation->context);
+/**
+ * Deallocates all resources associated with a simulation.
+ * Run before exiting program to avoid memory leaks.
+ * @param simulation A simulation object which is no longer in use
+ */
+void deallocate_resources(Simulation *simulation)
+{
+    release_probabilities(simulation);
 
-    if(simulation->state_vector)
-        free(simulation->state_vector);
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL)
+        opencl_deallocate_resources(simulation);
+#endif
+    if(simulation->backend == BACKEND_CPU)
+        cpu_deallocate_resources(simulation);
 
-    if(simulation->probabilities)
-        free(simulation->probabilities);
+    free_operation_list(simulation->pending_operations);
+    free(simulation->profile_stats);
     
     free(simulation);
     
@@ -123,560 +146,1203 @@ void deallocate_resources(Simulation *simulation)
  */
 void measure(Simulation *simulation)
 {
-    const size_t num_op = simulation->num_amp;
-    cl_int error;
+    flush_operations(simulation);
 
-    error = clEnqueueNDRangeKernel(simulation->queue, simulation->measure_kernel, 
-        1, NULL, &num_op, NULL, 0, NULL, NULL);
-    
-    if(error < 0) {
-        perror("Couldn't enqueue the measure execution command");
-        exit(1); 
+    if(simulation->probability_results[0])
+        wait_for_completion(simulation->probability_results[0]);
+    allocate_probabilities(&simulation->probabilities, simulation);
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_measure(simulation);
+        return;
     }
+#endif
+    cpu_measure(simulation);
+}
 
-    error = clEnqueueReadBuffer(simulation->queue, simulation->probability_buffer,
-        CL_TRUE, 0, sizeof(float)*simulation->num_amp, simulation->probabilities,
-        0, NULL, NULL);
-    
-    if(error < 0) {
-        perror("Couldn't enqueue the read buffer command");
-        exit(1);   
+/**
+ * @brief Sums the probability of every state and of each qubit being one on the
+ * backend, so only the sums are read back.
+ * @param sums An array to hold the total followed by the probability of each
+ * qubit being one
+ * @param simulation The simulation to reduce
+ */
+static void reduce_qubit_marginals(double *sums, Simulation *simulation)
+{
+    flush_operations(simulation);
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_reduce_qubit_marginals(sums, simulation);
+        return;
     }
-    
-    return;
+#endif
+    cpu_reduce_qubit_marginals(sums, simulation);
 }
 
 /**
- * Sets kernel arguments and queues the apply_double_controlled_gate() kernel.
- * May accept any gate type and applies the doubly controlled version of the
- * gate on the specified target and control qubits. May be used with the
- * NOT gate to apply a toffoli gate.
- * @param target The target qubit for the gate
- * @param control_1 The first control qubit for the gate
- * @param control_2 The seccond control qubit for the gate
- * @param gate An array containing the matrix of the gate to be applied on the
- * target qubit
- * @param simulation The simulation on which to apply the gate
+ * @brief Sums the probabilities of every state.
+ * @param simulation The simulation to reduce
+ * @return The squared norm of the state, 1 up to rounding errors
  */
-void apply_double_controlled_gate(int target, int control_1, int control_2,
-    float gate[8], Simulation *simulation)
+double state_norm(Simulation *simulation)
 {
-    cl_int error;
-    float *a, *b, *c, *d;
-    const size_t num_op = simulation->num_amp;
+    double sums[8*sizeof(size_t)+1];
 
-    a = (float *) malloc(sizeof(float)*2);
-    a[0] = gate[0];
-    a[1] = gate[1];
+    reduce_qubit_marginals(sums, simulation);
 
-    b = (float *) malloc(sizeof(float)*2);
-    b[0] = gate[2];
-    b[1] = gate[3];
-    
-    c = (float *) malloc(sizeof(float)*2);
-    c[0] = gate[4];
-    c[1] = gate[5];
+    return sums[0];
+}
 
-    d = (float *) malloc(sizeof(float)*2);
-    d[0] = gate[6];
-    d[1] = gate[7];
-    
-    // Set kernel arguments for apply_controlled_gate
-    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 
-        1, sizeof(int), &control_1);
+/**
+ * @brief Computes the probability of each qubit being measured as one.
+ * @param probabilities An array to hold one probability per qubit
+ * @param simulation The simulation to reduce
+ */
+void qubit_marginals(double *probabilities, Simulation *simulation)
+{
+    double sums[8*sizeof(size_t)+1];
 
-    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 
-        2, sizeof(int), &control_2);
-    
-    if(error < 0) {
-        perror("Couldn't set apply_double_controlled_gate's controlled argument");
-        exit(1);
-    }
-    
-    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 
-        3, sizeof(int), &target);
-    
-    if(error < 0) {
-        perror("Couldn't set apply_double_controlled_gate's target argument");
-        exit(1);
-    }
+    reduce_qubit_marginals(sums, simulation);
+    memcpy(probabilities, sums+1, sizeof(double)*(int) log2(simulation->num_amp));
+}
 
-    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 
-        4, sizeof(float)*2, a);
-    
-    if(error < 0) {
-        perror("Couldn't set apply_double_controlled_gate's a argument");
-        exit(1);
+/**
+ * @brief Computes the probability distribution of a register of consecutive
+ * qubits, summed over every other qubit on the backend, see marginal().
+ * @param first The lowest qubit of the register
+ * @param register_qubits The number of qubits in the register
+ * @param probabilities An array to hold the probability of each of the
+ * 2^register_qubits values of the register
+ * @param simulation The simulation to reduce
+ */
+void register_marginal(int first, int register_qubits, double *probabilities,
+    Simulation *simulation)
+{
+    if(first < 0 || register_qubits < 0 ||
+        first + register_qubits > (int) log2(simulation->num_amp)) {
+        fprintf(stderr, "error: invalid register of qubits %d to %d.\n", first,
+            first + register_qubits - 1);
+        exit(EXIT_FAILURE);
     }
 
-    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 
-        5, sizeof(float)*2, b);
-    
-    if(error < 0) {
-        perror("Couldn't set apply_double_controlled_gate's b argument");
-        exit(1);
-    }
+    marginal((((size_t) 1 << register_qubits) - 1) << first, probabilities, simulation);
+}
 
-    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 
-        6, sizeof(float)*2, c);
-    
-    if(error < 0) {
-        perror("Couldn't set apply_double_controlled_gate's c argument");
-        exit(1);
+/**
+ * @brief Computes the probability distribution of any subset of the qubits.
+ * The distribution is reduced where the state lives into private histograms,
+ * per CPU thread or per row of work items on OpenCL, so the 2^n
+ * probabilities are never stored and only the 2^k values are read back.
+ * @param qubit_mask A mask of the k qubits
+ * @param probabilities An array to hold the probability of each of the 2^k
+ * values, bit j of a value being the j-th lowest qubit of the mask
+ * @param simulation The simulation to reduce
+ */
+void marginal(size_t qubit_mask, double *probabilities, Simulation *simulation)
+{
+    if(qubit_mask >= simulation->num_amp) {
+        fprintf(stderr, "error: invalid mask of qubits %zx.\n", qubit_mask);
+        exit(EXIT_FAILURE);
     }
 
-    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 
-        7, sizeof(float)*2, d);
-    if(error < 0) {
-        perror("Couldn't set apply_double_controlled_gate's d argument");
-        exit(1);
+    flush_operations(simulation);
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_marginal(qubit_mask, probabilities, simulation);
+        return;
     }
+#endif
+    cpu_marginal(qubit_mask, probabilities, simulation);
+}
+
+/** A state and its probability, as sorted by top_k_states() */
+typedef struct StateProbability
+{
+    size_t index;
+    double probability;
+} StateProbability;
 
-    // queue the kernel
-    clEnqueueNDRangeKernel(simulation->queue, 
-        simulation->apply_double_controlled_gate_kernel, 
-        1, NULL, &num_op, NULL, 0, NULL, NULL);
+/**
+ * @brief Orders states by decreasing probability and then by increasing index.
+ * @param a The first StateProbability
+ * @param b The second StateProbability
+ * @return A negative number if a comes first, positive if b does
+ */
+static int compare_state_probabilities(const void *a, const void *b)
+{
+    const StateProbability *first = a, *second = b;
+
+    if(first->probability != second->probability)
+        return first->probability > second->probability ? -1 : 1;
 
-    free(a);
-    free(b);
-    free(c);
-    free(d);
+    return first->index < second->index ? -1 : first->index > second->index;
 }
 
 /**
- * Sets kernel arguments and queues the apply_controlled_gate() kernel.
- * May accept any gate type and applies the controlled version of the
- * gate on the specified target and control qubits. May be used with the
- * NOT gate to apply a c-not gate for example.
- * @param target The target qubit for the gate
- * @param controlled The control qubit for the gate
- * @param gate An array containing the matrix of the gate to be applied on the
- * target qubit
- * @param simulation The simulation on which to apply the gate
+ * @brief Finds the k most probable states without reading every probability
+ * back from the backend. States of equal probability may be chosen in any
+ * order on OpenCL.
+ * @param k The number of states to find
+ * @param indices An array to hold the states, from the most probable
+ * @param probabilities An array to hold the probability of each state
+ * @param simulation The simulation to search
+ * @return The number of states found, the smaller of k and simulation->num_amp
  */
-void apply_controlled_gate(int target, int controlled, float gate[8],
+size_t top_k_states(size_t k, size_t *indices, double *probabilities,
     Simulation *simulation)
 {
-    cl_int error;
-    float *a, *b, *c, *d;
-    const size_t num_op = simulation->num_amp;
+    StateProbability *states;
 
-    a = (float *) malloc(sizeof(float)*2);
-    a[0] = gate[0];
-    a[1] = gate[1];
+    if(k > simulation->num_amp)
+        k = simulation->num_amp;
+    if(k == 0)
+        return 0;
 
-    b = (float *) malloc(sizeof(float)*2);
-    b[0] = gate[2];
-    b[1] = gate[3];
-    
-    c = (float *) malloc(sizeof(float)*2);
-    c[0] = gate[4];
-    c[1] = gate[5];
+    flush_operations(simulation);
 
-    d = (float *) malloc(sizeof(float)*2);
-    d[0] = gate[6];
-    d[1] = gate[7];
-    
-    // Set kernel arguments for apply_controlled_gate
-    error = clSetKernelArg(simulation->apply_controlled_gate_kernel, 
-        1, sizeof(int), &controlled);
-    
-    if(error < 0) {
-        perror("Couldn't set apply_controlled_gate's controlled argument");
-        exit(1);
-    }
-    
-    error = clSetKernelArg(simulation->apply_controlled_gate_kernel, 
-        2, sizeof(int), &target);
-    
-    if(error < 0) {
-        perror("Couldn't set apply_controlled_gate's target argument");
-        exit(1);
-    }
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL)
+        opencl_top_k(k, indices, probabilities, simulation);
+    else
+#endif
+    cpu_top_k(k, indices, probabilities, simulation);
 
-    error = clSetKernelArg(simulation->apply_controlled_gate_kernel, 
-        3, sizeof(float)*2, a);
-    
-    if(error < 0) {
-        perror("Couldn't set apply_controlled_gate's a argument");
-        exit(1);
+    states = (StateProbability *) malloc(sizeof(StateProbability)*k);
+    if(!states) {
+        fprintf(stderr, "error: unable to allocate top k states.\n");
+        exit(EXIT_FAILURE);
     }
 
-    error = clSetKernelArg(simulation->apply_controlled_gate_kernel, 
-        4, sizeof(float)*2, b);
-    
-    if(error < 0) {
-        perror("Couldn't set apply_controlled_gate's b argument");
-        exit(1);
+    for(size_t i=0; i<k; i++) {
+        states[i].index = indices[i];
+        states[i].probability = probabilities[i];
     }
 
-    error = clSetKernelArg(simulation->apply_controlled_gate_kernel, 
-        5, sizeof(float)*2, c);
-    
-    if(error < 0) {
-        perror("Couldn't set apply_controlled_gate's c argument");
-        exit(1);
-    }
+    qsort(states, k, sizeof(StateProbability), compare_state_probabilities);
 
-    error = clSetKernelArg(simulation->apply_controlled_gate_kernel, 
-        6, sizeof(float)*2, d);
-    if(error < 0) {
-        perror("Couldn't set apply_controlled_gate's d argument");
-        exit(1);
+    for(size_t i=0; i<k; i++) {
+        indices[i] = states[i].index;
+        probabilities[i] = states[i].probability;
     }
 
-    // queue kerenel
-    clEnqueueNDRangeKernel(simulation->queue, 
-        simulation->apply_controlled_gate_kernel, 
-        1, NULL, &num_op, NULL, 0, NULL, NULL);
+    free(states);
 
-    free(a);
-    free(b);
-    free(c);
-    free(d);
+    return k;
 }
 
 /**
- * Sets kernel arguments and queues the apply_gate() kernel.
- * May accept any gate type and applies the gate on the specified target qubit.
- * @param target The target qubit for the gate
- * @param gate An array containing the matrix of the gate to be applied on the
- * target qubit
- * @param simulation The simulation on which to apply the gate
+ * @brief Draws a uniform random number with the splitmix64 generator.
+ * @param state The state of the generator, advanced by each draw
+ * @return A random number in [0, 1)
  */
-void apply_gate(int target, float gate[8], Simulation *simulation)
+static double random_uniform(unsigned long long *state)
 {
-    cl_int error;
-    float *a, *b, *c, *d;
-    const size_t num_op = simulation->num_amp;
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
 
-    a = (float *) malloc(sizeof(float)*2);
-    a[0] = gate[0];
-    a[1] = gate[1];
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+    z ^= z >> 31;
 
-    b = (float *) malloc(sizeof(float)*2);
-    b[0] = gate[2];
-    b[1] = gate[3];
-    
-    c = (float *) malloc(sizeof(float)*2);
-    c[0] = gate[4];
-    c[1] = gate[5];
-
-    d = (float *) malloc(sizeof(float)*2);
-    d[0] = gate[6];
-    d[1] = gate[7];
-
-    // Set kernel arguments for apply_gate
-    error = clSetKernelArg(simulation->apply_gate_kernel, 1, sizeof(int), &target);
-    if(error < 0) {
-        perror("Couldn't set apply_gate's target argument");
-        exit(1);
-    }
+    return (z >> 11)*(1.0/9007199254740992.0);
+}
 
-    error = clSetKernelArg(simulation->apply_gate_kernel, 2, sizeof(float)*2, a);
-    if(error < 0) {
-        perror("Couldn't set apply_gate's a argument");
-        exit(1);
+/**
+ * @brief Orders sample counts by increasing state for qsort().
+ */
+static int compare_sample_counts(const void *a, const void *b)
+{
+    const SampleCount *first = a, *second = b;
+
+    return first->index < second->index ? -1 : first->index > second->index;
+}
+
+/**
+ * @brief Draws measurement shots of every qubit and counts each outcome.
+ * The probabilities of blocks of 2^SAMPLE_BLOCK_QUBITS consecutive states are
+ * summed directly where the state lives, one sum per block, and prefix summed
+ * on the host. Each shot binary searches the prefix sums for its block, and
+ * the backend resolves every shot's state within its block in parallel, so
+ * only the block sums and the outcomes are read back. The outcomes are then
+ * sorted and counted, so the memory used grows with the shots and not the
+ * state. The same seed draws the same shots on either backend, up to
+ * rounding of the probabilities.
+ * @param shots The number of shots to draw
+ * @param rng_seed The seed of the random number generator
+ * @param counts An array to hold each state drawn and its number of shots, in
+ * increasing order of state, must be at least of size shots
+ * @param simulation The simulation to sample
+ * @return The number of distinct states drawn
+ */
+size_t sample(size_t shots, unsigned long long rng_seed, SampleCount *counts,
+    Simulation *simulation)
+{
+    const int num_qubits = (int) log2(simulation->num_amp);
+    const int block_qubits = num_qubits < SAMPLE_BLOCK_QUBITS ? num_qubits :
+        SAMPLE_BLOCK_QUBITS;
+    const size_t num_blocks = simulation->num_amp >> block_qubits;
+    double *cumulative, *residuals, total, point;
+    size_t *indices, num_shots, low, high, middle, num_states = 0;
+
+    if(shots == 0)
+        return 0;
+
+    flush_operations(simulation);
+
+    cumulative = (double *) malloc(sizeof(double)*num_blocks);
+    residuals = (double *) malloc(sizeof(double)*SAMPLE_CHUNK);
+    indices = (size_t *) malloc(sizeof(size_t)*SAMPLE_CHUNK);
+    if(!cumulative || !residuals || !indices) {
+        fprintf(stderr, "error: unable to allocate sampler.\n");
+        exit(EXIT_FAILURE);
     }
 
-    error = clSetKernelArg(simulation->apply_gate_kernel, 3, sizeof(float)*2, b);
-    if(error < 0) {
-        perror("Couldn't set apply_gate's b argument");
-        exit(1);
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL)
+        opencl_sum_blocks(block_qubits, cumulative, simulation);
+    else
+#endif
+    cpu_sum_blocks(block_qubits, cumulative, simulation);
+
+    for(size_t block=1; block<num_blocks; block++)
+        cumulative[block] += cumulative[block-1];
+    total = cumulative[num_blocks-1];
+
+    for(size_t first=0; first<shots; first+=SAMPLE_CHUNK) {
+        num_shots = shots - first < SAMPLE_CHUNK ? shots - first : SAMPLE_CHUNK;
+
+        // Find the first block whose prefix sum passes each shot's point
+        for(size_t i=0; i<num_shots; i++) {
+            point = random_uniform(&rng_seed)*total;
+            for(low=0, high=num_blocks-1; low<high; ) {
+                middle = (low + high)/2;
+                if(cumulative[middle] > point)
+                    high = middle;
+                else
+                    low = middle + 1;
+            }
+            indices[i] = low;
+            residuals[i] = point - (low ? cumulative[low-1] : 0);
+        }
+
+#ifdef OPENCL
+        if(simulation->backend == BACKEND_OPENCL)
+            opencl_sample_blocks(block_qubits, num_shots, indices, residuals, simulation);
+        else
+#endif
+        cpu_sample_blocks(block_qubits, num_shots, indices, residuals, simulation);
+
+        for(size_t i=0; i<num_shots; i++)
+            counts[first+i].index = indices[i];
     }
 
-    error = clSetKernelArg(simulation->apply_gate_kernel, 4, sizeof(float)*2, c);
-    if(error < 0) {
-        perror("Couldn't set apply_gate's c argument");
-        exit(1);
+    // Count the runs of each state in place, as there are never more runs
+    // than shots read so far
+    qsort(counts, shots, sizeof(SampleCount), compare_sample_counts);
+    for(size_t i=0; i<shots; i++) {
+        if(num_states && counts[num_states-1].index == counts[i].index) {
+            counts[num_states-1].count++;
+            continue;
+        }
+        counts[num_states].index = counts[i].index;
+        counts[num_states].count = 1;
+        num_states++;
     }
 
-    error = clSetKernelArg(simulation->apply_gate_kernel, 5, sizeof(float)*2, d);
-    if(error < 0) {
-        perror("Couldn't set apply_gate's d argument");
-        exit(1);
+    free(cumulative);
+    free(residuals);
+    free(indices);
+
+    return num_states;
+}
+
+/**
+ * @brief Reads a Pauli string such as "XIZY" into its X and Z masks.
+ * Character i acts on qubit i, so the first character is the lowest qubit as
+ * in the bitstrings of format_bitstring(), and Y sets both masks.
+ * @param string The Pauli string of 'I', 'X', 'Y' and 'Z'
+ * @return The Pauli term
+ */
+PauliTerm pauli_term(const char *string)
+{
+    PauliTerm term = {0, 0};
+
+    for(size_t i=0; string[i]; i++) {
+        if(string[i] == 'X' || string[i] == 'Y')
+            term.x_mask |= (size_t) 1 << i;
+        if(string[i] == 'Z' || string[i] == 'Y')
+            term.z_mask |= (size_t) 1 << i;
+        if(!strchr("IXYZ", string[i])) {
+            fprintf(stderr, "error: invalid Pauli string %s.\n", string);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    clEnqueueNDRangeKernel(simulation->queue, simulation->apply_gate_kernel, 1, NULL,
-        &num_op, NULL, 0, NULL, NULL);
+    return term;
+}
 
-    free(a);
-    free(b);
-    free(c);
-    free(d);
+/** A Pauli term and its coefficient, as grouped by expectation() */
+typedef struct WeightedPauli
+{
+    PauliTerm term;
+    double coefficient;
+} WeightedPauli;
 
-    return;
+/**
+ * @brief Orders weighted Pauli terms by their X mask.
+ * @param a The first WeightedPauli
+ * @param b The second WeightedPauli
+ * @return A negative number if a comes first, positive if b does
+ */
+static int compare_x_masks(const void *a, const void *b)
+{
+    const WeightedPauli *first = a, *second = b;
+
+    return first->term.x_mask < second->term.x_mask ? -1 :
+        first->term.x_mask > second->term.x_mask;
 }
 
 /**
- * Call to initialise qubits.
- * Creates a state vector of appropriate size to store the simulation's
- * amplitudes and sets it as a kernel argument to all required kernels
- * @param num_qubits The number of qubits to initialise
- * @param simulation The simulation object to initialise
+ * @brief Computes the expectation value of a weighted sum of Pauli strings.
+ * A string with masks x and z is i^|x&z| X^x Z^z, so its expectation is
+ * i^|x&z| times the sum over states j of
+ * conj(state[j^x])*state[j]*(-1)^|j&z|. Terms sharing an X mask read the
+ * same pairs of amplitudes, so they are grouped and each group is summed by
+ * the backend in one read-only pass over the state. Pairing j with j^x
+ * leaves half the states to visit and only the real or the imaginary part of
+ * each product to sum.
+ * @param num_terms The number of terms
+ * @param terms The Pauli string of each term, see pauli_term()
+ * @param coefficients The real coefficient of each term
+ * @param simulation The simulation to measure
+ * @return The expectation value
  */
-void initialise_qubits(int num_qubits, Simulation *simulation)
+double expectation(size_t num_terms, const PauliTerm *terms, const double *coefficients,
+    Simulation *simulation)
 {
-    cl_int error;
+    WeightedPauli *sorted = (WeightedPauli *) malloc(sizeof(WeightedPauli)*num_terms);
+    size_t *z_masks = (size_t *) malloc(sizeof(size_t)*num_terms);
+    double *sums = (double *) malloc(sizeof(double)*num_terms);
+    double result = 0, factor;
+    size_t first, last, x_mask;
+    int num_y;
+
+    if(!sorted || !z_masks || !sums) {
+        fprintf(stderr, "error: unable to allocate Pauli terms.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // Check the GPU has enough global memory for the number of qubits
-    if(num_qubits > log2(simulation->global_mem_size/8) | num_qubits < 0) {
-        printf("Invalid number of qubits: Maximum %d\n",
-            (int) log2(simulation->global_mem_size/8));
-        exit(1);
+    for(size_t i=0; i<num_terms; i++) {
+        sorted[i].term = terms[i];
+        sorted[i].coefficient = coefficients[i];
+    }
+    qsort(sorted, num_terms, sizeof(WeightedPauli), compare_x_masks);
+
+    flush_operations(simulation);
+
+    for(first=0; first<num_terms; first=last) {
+        x_mask = sorted[first].term.x_mask;
+        for(last=first; last<num_terms && sorted[last].term.x_mask == x_mask; last++)
+            z_masks[last-first] = sorted[last].term.z_mask;
+
+#ifdef OPENCL
+        if(simulation->backend == BACKEND_OPENCL)
+            opencl_pauli_group_sums(x_mask, last - first, z_masks, sums, simulation);
+        else
+#endif
+        cpu_pauli_group_sums(x_mask, last - first, z_masks, sums, simulation);
+
+        // A pair stands for both its states, and an odd number of Y sums i times the product
+        for(size_t i=first; i<last; i++) {
+            num_y = 0;
+            for(size_t y_mask=x_mask & sorted[i].term.z_mask; y_mask; y_mask &= y_mask-1)
+                num_y++;
+            factor = ((num_y + (num_y & 1)) % 4 ? -1 : 1)*(x_mask ? 2 : 1);
+            result += sorted[i].coefficient*factor*sums[i-first];
+        }
     }
 
-    // Initialise state_vector data to |0....0>
-    simulation->num_amp = pow(2, num_qubits);
-    simulation->state_vector = (float *) calloc(simulation->num_amp*2, sizeof(float));
-    simulation->state_vector[0] = 1;
+    free(sorted);
+    free(z_masks);
+    free(sums);
 
-    // Initialise probabilities buffer
-    simulation->probabilities = (float *) malloc(sizeof(float)*simulation->num_amp);
+    return result;
+}
 
-    // Create CL buffer to hold the state vector
-    simulation->state_vector_buffer = clCreateBuffer(simulation->context, CL_MEM_READ_WRITE |
-        CL_MEM_COPY_HOST_PTR, sizeof(float)*simulation->num_amp*2, simulation->state_vector, &error);
-    if(error < 0) {
-        perror("Couldn't create a buffer object");
-        exit(1);
+/**
+ * @brief Creates the handle of an asynchronous read.
+ * @param values The array which will hold the values, or NULL to allocate one
+ * owned by the result
+ * @param size The number of values to be read
+ * @param callback The function to call once the values are on the host, or NULL
+ * @param user_data The last argument passed to the callback
+ * @return The incomplete result
+ */
+static AsyncResult *create_result(double *values, size_t size, ResultCallback callback,
+    void *user_data)
+{
+    AsyncResult *result = (AsyncResult *) calloc(1, sizeof(AsyncResult));
+    if(!result) {
+        fprintf(stderr, "error: unable to initialise AsyncResult.\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Create CL buffer to hold the measurement outcome
-    simulation->probability_buffer = clCreateBuffer(simulation->context, CL_MEM_READ_ONLY,
-        sizeof(float)*simulation->num_amp, NULL, &error);
-    if(error < 0) {
-        perror("Couldn't create a buffer object");
-        exit(1);
+    result->owns_values = !values;
+    if(!values)
+        values = (double *) malloc(sizeof(double)*size);
+    if(!values) {
+        fprintf(stderr, "error: unable to allocate AsyncResult values.\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Set state vector buffer kernel arguments
-    error = clSetKernelArg(simulation->apply_gate_kernel, 0,
-        sizeof(cl_mem), &simulation->state_vector_buffer);
-    if(error < 0) {
-        perror("Couldn't set apply_gate's state_vector argument");
-        exit(1);
-    }
+    result->slot = -1;
+    result->values = values;
+    result->size = size;
+    result->callback = callback;
+    result->user_data = user_data;
+    pthread_mutex_init(&result->lock, NULL);
+    pthread_cond_init(&result->done, NULL);
 
-    error = clSetKernelArg(simulation->apply_controlled_gate_kernel, 0,
-        sizeof(cl_mem), &simulation->state_vector_buffer);
-    if(error < 0) {
-        perror("Couldn't set apply_controlled_gate's state_vector argument");
-        exit(1);
-    }
+    return result;
+}
 
-    error = clSetKernelArg(simulation->apply_double_controlled_gate_kernel, 0,
-        sizeof(cl_mem), &simulation->state_vector_buffer);
-    if(error < 0) {
-        perror("Couldn't set apply_double_controlled_gate's state_vector argument");
-        exit(1);
-    }
+/**
+ * @brief Measures all registers of a simulation without waiting for the result.
+ * The probabilities alternate between two buffers, the first of which is the
+ * simulation's probabilities array, so the host can process one measurement
+ * while the device computes the next. They stay valid until two more calls of
+ * measure_async(), a call of measure() for the first buffer, or the simulation
+ * is deallocated. On the CPU backend the measurement completes before this
+ * returns.
+ * @param callback The function to call with the probabilities once they are on
+ * the host, or NULL. On OpenCL it runs on a thread of the OpenCL runtime.
+ * @param user_data The last argument passed to the callback
+ * @param simulation The simulation to be measured
+ * @return The result of the measurement, to be released with free_result()
+ */
+AsyncResult *measure_async(ResultCallback callback, void *user_data, Simulation *simulation)
+{
+    const int slot = simulation->next_probability_slot;
+    AsyncResult *result;
 
-    // Set kernel arguments for measure
-    error = clSetKernelArg(simulation->measure_kernel, 0, 
-        sizeof(cl_mem), &simulation->state_vector_buffer);
-    if(error < 0) {
-        perror("Couldn't set measure's state_vector argument");
-        exit(1);
+    flush_operations(simulation);
+
+    // The previous measurement into this buffer has to reach the host first
+    if(simulation->probability_results[slot]) {
+        wait_for_completion(simulation->probability_results[slot]);
+        simulation->probability_results[slot]->slot = -1;
     }
 
-    error = clSetKernelArg(simulation->measure_kernel, 1,
-        sizeof(cl_mem), &simulation->probability_buffer);
-    if(error < 0) {
-        perror("Couldn't set measure's probability argument");
-        exit(1);
+    allocate_probabilities(slot ? &simulation->back_probabilities :
+        &simulation->probabilities, simulation);
+
+    result = create_result(slot ? simulation->back_probabilities : simulation->probabilities,
+        simulation->num_amp, callback, user_data);
+    result->simulation = simulation;
+    result->slot = slot;
+    simulation->probability_results[slot] = result;
+    simulation->next_probability_slot = 1 - slot;
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_measure_async(result, simulation);
+        return result;
     }
+#endif
+    cpu_compute_probabilities(result->values, simulation);
+    complete_result(result);
 
-    // Set kernel argument for initialise_state
-    error = clSetKernelArg(simulation->initialise_state_kernel, 0,
-        sizeof(cl_mem), &simulation->state_vector_buffer);
-    if(error < 0) {
-        perror("Couldn't set initialise_state's state_vector argument");
-        exit(1);
+    return result;
+}
+
+/**
+ * @brief Reads the state vector without waiting for the result.
+ * The values are interleaved as in test_state_vector(). On the CPU backend the
+ * read completes before this returns.
+ * @param callback The function to call with the state once it is on the host,
+ * or NULL. On OpenCL it runs on a thread of the OpenCL runtime.
+ * @param user_data The last argument passed to the callback
+ * @param simulation The simulation to read
+ * @return The result of the read, to be released with free_result()
+ */
+AsyncResult *read_state_async(ResultCallback callback, void *user_data,
+    Simulation *simulation)
+{
+    AsyncResult *result;
+
+    flush_operations(simulation);
+
+    result = create_result(NULL, simulation->num_amp*2, callback, user_data);
+    result->simulation = simulation;
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_read_state_async(result, simulation);
+        return result;
     }
+#endif
+    cpu_test_state_vector(result->values, simulation);
+    complete_result(result);
+
+    return result;
 }
+
 /**
- * @brief Set the up simulation object.
- * Complies the OpenCL program, creates all kernel function, defines
- * context, creates command queue, sets known kernel arguments and
- * verifies GPU capabilities.
- * @return simulation object containing all OpenCL objects
+ * @brief Marks an asynchronous read as complete once its values are on the host.
+ * Runs the result's callback before waking any thread waiting for it, unless
+ * the read failed and set a negative status.
+ * @param result The result whose values have been read
  */
-Simulation *set_up_simulation()
+void complete_result(AsyncResult *result)
 {
-    // Data structures
-    Simulation *simulation;
-    cl_int error, max_work_item_dims;
-    cl_uint max_compute_units;
-    cl_platform_id platform;
-    char *program_buffer, *program_log;
-    size_t program_size, log_size, max_work_group_size;
-    size_t *max_work_item_size;
-    FILE *fp;
+    if(result->callback && result->status >= 0)
+        result->callback(result->values, result->size, result->user_data);
 
-    // Initialise Simulation struct
-    simulation = (Simulation *) malloc(sizeof(Simulation));
-    if(!simulation) {
-        fprintf(stderr, "error: unable to initialise Simulation.\n");
+    pthread_mutex_lock(&result->lock);
+    result->complete = true;
+    pthread_cond_broadcast(&result->done);
+    pthread_mutex_unlock(&result->lock);
+}
+
+/**
+ * @brief Checks whether an asynchronous read has completed without blocking.
+ * @param result The result to check
+ * @return true if the values of the result are on the host
+ */
+bool result_ready(AsyncResult *result)
+{
+    bool complete;
+
+    pthread_mutex_lock(&result->lock);
+    complete = result->complete;
+    pthread_mutex_unlock(&result->lock);
+
+    return complete;
+}
+
+/**
+ * @brief Waits for an asynchronous read to complete.
+ * A read which failed on the device is reported here, on the waiting thread.
+ * @param result The result to wait for
+ * @return The values of the result
+ */
+const double *wait_result(AsyncResult *result)
+{
+    wait_for_completion(result);
+
+    if(result->status < 0) {
+        fprintf(stderr, "error: asynchronous read failed with status %d.\n",
+            result->status);
         exit(EXIT_FAILURE);
     }
 
-    // Identify a platform
-    error = clGetPlatformIDs(1, &platform, NULL);
-    if(error < 0) {
-        perror("No platforms found");
-        exit(1);
+    return result->values;
+}
+
+/**
+ * @brief Waits for an asynchronous read to complete and frees its handle.
+ * The probabilities of a measurement belong to the simulation and are not freed.
+ * @param result The result to be freed
+ */
+void free_result(AsyncResult *result)
+{
+    if(!result)
+        return;
+
+    wait_for_completion(result);
+
+    if(result->simulation && result->slot >= 0)
+        result->simulation->probability_results[result->slot] = NULL;
+
+#ifdef OPENCL
+    if(result->event)
+        clReleaseEvent(result->event);
+#endif
+    if(result->owns_values)
+        free(result->values);
+    free(result->staging);
+    pthread_mutex_destroy(&result->lock);
+    pthread_cond_destroy(&result->done);
+    free(result);
+}
+
+/**
+ * @brief Queues a gate instead of applying it if the simulation is deferred.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param simulation The simulation on which to apply the gate
+ * @return true if the gate was queued
+ */
+static bool defer_gate(int target, size_t control_mask, double gate[8],
+    Simulation *simulation)
+{
+    if(!simulation->deferred)
+        return false;
+
+    append_multi_controlled_gate(target, control_mask, gate,
+        simulation->pending_operations);
+
+    return true;
+}
+
+/**
+ * @brief Applies a gate through a specialised kernel if it has one.
+ * Diagonal gates such as Z, phase and controlled phase gates only scale
+ * amplitudes and X, CNOT and Toffoli gates only swap them, which is cheaper
+ * than the four complex multiplies per pair of a general gate.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate
+ * @param gate An array containing the matrix of the gate
+ * @param simulation The simulation on which to apply the gate
+ * @return true if the gate was applied, false if it needs a general kernel
+ */
+static bool apply_special_gate(int target, size_t control_mask, double gate[8],
+    Simulation *simulation)
+{
+    switch(classify_gate(gate)) {
+        case GATE_IDENTITY:
+            return true;
+        case GATE_DIAGONAL:
+#ifdef OPENCL
+            if(simulation->backend == BACKEND_OPENCL) {
+                opencl_apply_diagonal_gate(target, control_mask, gate, simulation);
+                return true;
+            }
+#endif
+            cpu_apply_diagonal_gate(target, control_mask, gate, simulation);
+            return true;
+        case GATE_PERMUTATION:
+#ifdef OPENCL
+            if(simulation->backend == BACKEND_OPENCL) {
+                opencl_apply_permutation_gate(target, control_mask, simulation);
+                return true;
+            }
+#endif
+            cpu_apply_permutation_gate(target, control_mask, simulation);
+            return true;
+        default:
+            return false;
     }
+}
 
-    // Access a GPU
-    error = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1,
-        &simulation->device, NULL);
-    if(error < 0) {
-        perror("No GPU found");
-        exit(1);
+/**
+ * @brief Measures one qubit, collapsing the state onto the outcome.
+ * The probability of each outcome is reduced where the state lives by
+ * register_marginal(). The collapse and renormalisation are then one pass of
+ * a diagonal gate, zero for the other outcome and 1/sqrt(p) for the one
+ * drawn, so the state is never copied to the host.
+ * @param qubit The qubit to measure
+ * @param rng_state The state of the random number generator, advanced by the
+ * draw as by sample()
+ * @param simulation The simulation to measure
+ * @return The outcome, 0 or 1
+ */
+int measure_qubit(int qubit, unsigned long long *rng_state, Simulation *simulation)
+{
+    double probabilities[2], collapse[8] = {0};
+    int outcome;
+
+    register_marginal(qubit, 1, probabilities, simulation);
+
+    outcome = random_uniform(rng_state)*(probabilities[0] + probabilities[1]) <
+        probabilities[1];
+
+    collapse[outcome ? 6 : 0] = 1/sqrt(probabilities[outcome]);
+    apply_special_gate(qubit, 0, collapse, simulation);
+
+    return outcome;
+}
+
+/**
+ * Applies a gate controlled by any number of qubits on the specified target
+ * qubit in one pass, which only visits the amplitudes whose controls are
+ * all set. May be used with the NOT gate to apply an n-controlled NOT.
+ * @param target The target qubit for the gate
+ * @param control_mask A mask of the control qubits for the gate, which must
+ * not include the target
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void apply_multi_controlled_gate(int target, size_t control_mask, double gate[8],
+    Simulation *simulation)
+{
+    if(control_mask & ((size_t) 1 << target)) {
+        fprintf(stderr, "error: the target of a gate cannot also be a control.\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Check the GPU's maximum number of work dimensions
-    error = clGetDeviceInfo(simulation->device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS,
-        sizeof(cl_int), &max_work_item_dims, NULL);
-    if(error < 0) {
-        perror("Couldn't access GPU's max work item dimensions");
-        exit(1);
+    if(defer_gate(target, control_mask, gate, simulation) ||
+        apply_special_gate(target, control_mask, gate, simulation))
+        return;
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_apply_multi_controlled_gate(target, control_mask, gate, simulation);
+        return;
     }
-    // printf("Maximum work item dimensions: %u\n", max_work_item_dims);
+#endif
+    cpu_apply_multi_controlled_gate(target, control_mask, gate, simulation);
+}
 
-    // Check the GPU's maximum number of work group size
-    error = clGetDeviceInfo(simulation->device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
-        sizeof(size_t), &max_work_group_size, NULL);
-    if(error < 0) {
-        perror("Couldn't access GPU's max work group size");
-        exit(1);
+/**
+ * Applies the doubly controlled version of a gate on the specified target
+ * and control qubits. May accept any gate type and may be used with the
+ * NOT gate to apply a toffoli gate.
+ * @param target The target qubit for the gate
+ * @param control_1 The first control qubit for the gate
+ * @param control_2 The seccond control qubit for the gate
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void apply_double_controlled_gate(int target, int control_1, int control_2,
+    double gate[8], Simulation *simulation)
+{
+    const size_t control_mask = ((size_t) 1 << control_1) | ((size_t) 1 << control_2);
+
+    if(defer_gate(target, control_mask, gate, simulation) ||
+        apply_special_gate(target, control_mask, gate, simulation))
+        return;
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_apply_double_controlled_gate(target, control_1, control_2, gate,
+            simulation);
+        return;
     }
-    // printf("Maximum work group size: %lu\n", max_work_group_size);
+#endif
+    cpu_apply_double_controlled_gate(target, control_1, control_2, gate, simulation);
+}
 
-    // Check the GPU's maximum number of work item sizes
-    max_work_item_size = (size_t *) malloc(max_work_item_dims*sizeof(size_t));
-    error = clGetDeviceInfo(simulation->device, CL_DEVICE_MAX_WORK_ITEM_SIZES,
-        sizeof(size_t)*max_work_item_dims, max_work_item_size, NULL);
-    if(error < 0) {
-        perror("Couldn't access GPU's max work item size");
-        exit(1);
+/**
+ * Applies the controlled version of a gate on the specified target and
+ * control qubits. May accept any gate type and may be used with the
+ * NOT gate to apply a c-not gate for example.
+ * @param target The target qubit for the gate
+ * @param controlled The control qubit for the gate
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void apply_controlled_gate(int target, int controlled, double gate[8],
+    Simulation *simulation)
+{
+    if(defer_gate(target, (size_t) 1 << controlled, gate, simulation) ||
+        apply_special_gate(target, (size_t) 1 << controlled, gate, simulation))
+        return;
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_apply_controlled_gate(target, controlled, gate, simulation);
+        return;
     }
-    // for(int i=0; i<max_work_item_dims; i++)
-    //     printf("Maximum work item %d size: %lu\n", i, max_work_item_size[i]);
-    free(max_work_item_size);
+#endif
+    cpu_apply_controlled_gate(target, controlled, gate, simulation);
+}
 
-    // Check the GPU's number of compute units
-    error = clGetDeviceInfo(simulation->device, CL_DEVICE_MAX_COMPUTE_UNITS,
-        sizeof(cl_uint), &max_compute_units, NULL);
-    if(error < 0) {
-        perror("Couldn't access GPU's number of compute units");
-        exit(1);
+/**
+ * Applies a gate on the specified target qubit.
+ * May accept any gate type.
+ * @param target The target qubit for the gate
+ * @param gate An array containing the matrix of the gate to be applied on the
+ * target qubit
+ * @param simulation The simulation on which to apply the gate
+ */
+void apply_gate(int target, double gate[8], Simulation *simulation)
+{
+    if(defer_gate(target, 0, gate, simulation) ||
+        apply_special_gate(target, 0, gate, simulation))
+        return;
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_apply_gate(target, gate, simulation);
+        return;
     }
-    //printf("Maximum compute units: %d\n", max_compute_units);
+#endif
+    cpu_apply_gate(target, gate, simulation);
+}
 
-    // Check the GPU's global memory size
-    error = clGetDeviceInfo(simulation->device, CL_DEVICE_GLOBAL_MEM_SIZE,
-        sizeof(cl_ulong), &simulation->global_mem_size, NULL);
-    if(error < 0) {
-        perror("Couldn't access GPU's global memory size");
-        exit(1);
+/**
+ * Applies a single operation, as built by the operation list functions.
+ * @param operation The operation to apply
+ * @param simulation The simulation on which to apply the operation
+ */
+void apply_operation(Operation *operation, Simulation *simulation)
+{
+    int controls[2], num_controls = 0;
+
+    if(simulation->deferred) {
+        append_operation(operation, simulation->pending_operations);
+        return;
     }
-    //printf("Global memory size: %llu bytes\n", simulation->global_mem_size);
 
-    // Create context
-    simulation->context = clCreateContext(NULL, 1, &simulation->device, NULL, NULL, &error);
-    if(error < 0) {
-        perror("Couldn't create context");
-        exit(1);
+    if(operation->type == DENSE_OPERATION) {
+#ifdef OPENCL
+        if(simulation->backend == BACKEND_OPENCL) {
+            opencl_apply_dense_gate(operation, simulation);
+            return;
+        }
+#endif
+        cpu_apply_dense_gate(operation, simulation);
+        return;
     }
 
-    // Open program file
-    fp = fopen(PROGRAM_FILE, "r");
-    if(fp == NULL) {
-        perror("Couldn't find program file");
-        exit(1);
+    if(apply_special_gate(operation->target, operation->control_mask, operation->gate,
+        simulation))
+        return;
+
+    for(int q=0; q<(int) sizeof(size_t)*8; q++)
+        if((operation->control_mask >> q) & 1) {
+            if(num_controls == 2) {
+                apply_multi_controlled_gate(operation->target, operation->control_mask,
+                    operation->gate, simulation);
+                return;
+            }
+            controls[num_controls++] = q;
+        }
+
+    if(num_controls == 0)
+        apply_gate(operation->target, operation->gate, simulation);
+    else if(num_controls == 1)
+        apply_controlled_gate(operation->target, controls[0], operation->gate, simulation);
+    else
+        apply_double_controlled_gate(operation->target, controls[0], controls[1],
+            operation->gate, simulation);
+}
+
+/**
+ * Fuses a list of operations and applies the result.
+ * Consecutive gates with the same target and controls are merged, dropping
+ * those which cancel out, and neighbouring gates on at most
+ * simulation->max_fused_qubits qubits are applied as one dense unitary, so
+ * the state vector is passed over fewer times. On the CPU backend only blocks
+ * whose dense unitary is cheaper than their gates are fused, by the costs of
+ * cpu_fusion_costs(), and runs of gates on low qubits are applied one
+ * cache block at a time. OpenCL applies the whole list of a small state with
+ * one kernel launch, and otherwise runs of gates on low qubits one local
+ * memory tile at a time, see opencl_apply_operation_list(). A deferred
+ * simulation queues the operations instead.
+ * @param list The operations to apply, left unchanged
+ * @param simulation The simulation on which to apply the operations
+ */
+void apply_operation_list(OperationList *list, Simulation *simulation)
+{
+    OperationList *simplified, *fused;
+
+    if(simulation->deferred) {
+        for(int i=0; i<list->num_operations; i++)
+            append_operation(&list->operations[i], simulation->pending_operations);
+        return;
     }
-    
-    // Determine size of program and allocate buffer space
-    fseek(fp, 0, SEEK_END);
-    program_size = ftell(fp);
-    program_buffer = (char *) malloc(program_size + 1);
-    program_buffer[program_size] = '\0';
-    
-    // Read program file into buffer
-    rewind(fp);
-    fread(program_buffer, sizeof(char), program_size, fp);
-    fclose(fp);
-
-    // Create program
-    simulation->program = clCreateProgramWithSource(simulation->context, 1,
-        (const char **) &program_buffer, &program_size, &error);
-    if(error < 0) {
-        perror("Couldn't create program");
-        exit(1);
+
+    simplified = simplify_operations(list);
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_apply_operation_list(simplified, simulation);
+        free_operation_list(simplified);
+        return;
     }
-    free(program_buffer);
-
-    // Build program
-    error = clBuildProgram(simulation->program, 0, NULL, NULL, NULL, NULL);
-    if(error < 0) {
-        // Determine size of log and allocate buffer space
-        clGetProgramBuildInfo(simulation->program, simulation->device,
-            CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-        program_log = (char *) malloc(log_size + 1);
-        program_log[log_size] = '\0';
-        
-        // Copy log into buffer and print
-        clGetProgramBuildInfo(simulation->program, simulation->device,
-            CL_PROGRAM_BUILD_LOG, log_size + 1, program_log, NULL);
-        printf("%s\n", program_log);
-        free(program_log);
-        exit(1);
+#endif
+
+    fused = fuse_operations(simplified, simulation->max_fused_qubits,
+        cpu_fusion_costs(simulation->precision));
+    free_operation_list(simplified);
+
+    cpu_apply_operation_list(fused, simulation);
+
+    free_operation_list(fused);
+}
+
+/**
+ * Applies every operation queued by a deferred simulation as one list, see
+ * apply_operation_list(). Called by measure() and test_state_vector(), so it
+ * only needs calling directly to time the gates or overlap other work.
+ * @param simulation The simulation whose queue to apply
+ */
+void flush_operations(Simulation *simulation)
+{
+    if(!simulation->deferred || simulation->pending_operations->num_operations == 0)
+        return;
+
+    simulation->deferred = false;
+    apply_operation_list(simulation->pending_operations, simulation);
+    clear_operation_list(simulation->pending_operations);
+    simulation->deferred = true;
+}
+
+/**
+ * @brief Copies the profile of every kernel launched so far.
+ * Waits for the launches still running. Only OpenCL launches are profiled, so
+ * the statistics are empty on the CPU backend or without options.profiling.
+ * @param stats The statistics to fill by kernel, gate kind and target qubit
+ * @param simulation The simulation to profile
+ */
+void get_profile_stats(ProfileStats *stats, Simulation *simulation)
+{
+    if(!simulation->profile_stats) {
+        reset_profile_stats(stats);
+        return;
     }
 
-    // Create kernel for the apply_gate function
-    simulation->apply_gate_kernel = clCreateKernel(simulation->program, APPLY_GATE_FUNC, &error);
-    if(error < 0) {
-        perror("Couldn't create the apply gate kernel");
-        exit(1);
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL)
+        opencl_collect_profile(simulation);
+#endif
+
+    *stats = *simulation->profile_stats;
+}
+
+/**
+ * @brief Clears the profile, so a phase of a program can be profiled alone.
+ * @param simulation The simulation to profile
+ */
+void reset_profile(Simulation *simulation)
+{
+    if(!simulation->profile_stats)
+        return;
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL)
+        opencl_collect_profile(simulation);
+#endif
+
+    reset_profile_stats(simulation->profile_stats);
+}
+
+/**
+ * @brief Prints the profile of every kernel launched so far as tables by
+ * kernel, gate kind and target qubit.
+ * @param stream The stream to print to
+ * @param simulation The simulation to profile
+ */
+void dump_profile(FILE *stream, Simulation *simulation)
+{
+    ProfileStats stats;
+
+    if(!simulation->profile_stats) {
+        fprintf(stream, "Profiling is disabled, set options.profiling or SIMULATION_PROFILE=1.\n");
+        return;
     }
 
-    // Create kernel for the apply_controlled_gate function
-    simulation->apply_controlled_gate_kernel = clCreateKernel(simulation->program, 
-        APPLY_CGATE_FUNC, &error);
-    if(error < 0) {
-        perror("Couldn't create the apply controlled gate kernel");
+    get_profile_stats(&stats, simulation);
+    dump_profile_stats(stream, &stats);
+}
+
+/**
+ * @brief Checks every buffer needed for a number of qubits fits in memory.
+ * The CPU backend keeps the real and imaginary amplitudes and both arrays of
+ * double buffered probabilities, see measure_async(), in host memory. The
+ * OpenCL backend keeps the state vector and both probability buffers on the
+ * device, each within the device's largest allocation, and only the
+ * probabilities in host memory. Devices such as CPUs whose memory is the
+ * host's must fit both in host memory.
+ * @param num_qubits The number of qubits
+ * @param simulation The simulation to check
+ * @return true if every buffer fits
+ */
+static bool fits_in_memory(int num_qubits, Simulation *simulation)
+{
+    const unsigned long long real_size = precision_size(simulation->precision);
+    unsigned long long num_amp;
+
+    if(num_qubits < 0 || num_qubits >= (int) sizeof(size_t)*8)
+        return false;
+
+    num_amp = 1ULL << num_qubits;
+
+    if(simulation->backend == BACKEND_OPENCL && simulation->unified_memory)
+        return num_amp <= simulation->host_mem_size/(2*sizeof(double) + 4*real_size) &&
+            num_amp <= simulation->max_alloc_size/(2*real_size);
+
+    if(simulation->backend == BACKEND_OPENCL)
+        return num_amp <= simulation->host_mem_size/(2*sizeof(double)) &&
+            num_amp <= simulation->global_mem_size/(4*real_size) &&
+            num_amp <= simulation->max_alloc_size/(2*real_size);
+
+    return num_amp <= simulation->host_mem_size/(2*sizeof(double) + 2*real_size);
+}
+
+/**
+ * Returns the largest number of qubits whose buffers all fit in the memory
+ * of the simulation's backend and host.
+ * @param simulation The simulation to check
+ * @return The maximum number of qubits
+ */
+int max_qubits(Simulation *simulation)
+{
+    int num_qubits = 0;
+
+    while(fits_in_memory(num_qubits + 1, simulation))
+        num_qubits++;
+
+    return num_qubits;
+}
+
+/**
+ * Call to initialise qubits.
+ * Creates a state vector of appropriate size to store the simulation's
+ * amplitudes on the simulation's backend
+ * @param num_qubits The number of qubits to initialise
+ * @param simulation The simulation object to initialise
+ */
+void initialise_qubits(int num_qubits, Simulation *simulation)
+{
+    // Check the backend and host have enough memory for the number of qubits
+    if(!fits_in_memory(num_qubits, simulation)) {
+        printf("Invalid number of qubits: Maximum %d\n", max_qubits(simulation));
         exit(1);
     }
 
-    // Create kernel for the apply_double_controlled_gate function
-    simulation->apply_double_controlled_gate_kernel = 
-        clCreateKernel(simulation->program, APPLY_CCGATE_FUNC, &error);
-    if(error < 0) {
-        perror("Couldn't create the apply controlled controlled gate kernel");
-        exit(1);
+    // The probabilities are allocated at the new size when first measured
+    release_probabilities(simulation);
+    // Queued gates belong to the old state, which is discarded
+    if(simulation->deferred)
+        clear_operation_list(simulation->pending_operations);
+    simulation->num_amp = (size_t) 1 << num_qubits;
+
+#ifdef OPENCL
+    if(simulation->backend == BACKEND_OPENCL) {
+        opencl_initialise_qubits(num_qubits, simulation);
+        return;
     }
+#endif
+    cpu_initialise_qubits(num_qubits, simulation);
+}
 
-    // Create kernel for the measure function
-    simulation->measure_kernel = clCreateKernel(simulation->program, MEASURE_FUNC, &error);
-    if(error < 0) {
-        perror("Couldn't create the measure kernel");
-        exit(1);
+/**
+ * @brief Reads the default simulation options.
+ * The backend may be chosen with the SIMULATION_BACKEND environment
+ * variable ("cpu" or "opencl"), the precision of the state vector with
+ * SIMULATION_PRECISION ("single" or "double"), the number of CPU threads with
+ * SIMULATION_THREADS, the largest fused gate with SIMULATION_FUSED_QUBITS and
+ * deferred execution with SIMULATION_DEFERRED=1. The OpenCL device is chosen
+ * by SIMULATION_DEVICE ("gpu", "cpu", "accelerator" or "all"),
+ * SIMULATION_PLATFORM, the index of the platform to search or every platform
+ * if unset, and SIMULATION_DEVICE_INDEX, the index among matching devices.
+ * SIMULATION_PROFILE=1 profiles every OpenCL kernel launch and
+ * SIMULATION_PARTITIONS splits the state across that many OpenCL devices.
+ * SIMULATION_SPECIALISE=0 stops OpenCL building gate kernels specialised to
+ * their target and controls, and SIMULATION_GATE_LIST_QUBITS sets the largest
+ * state OpenCL applies a list to with one kernel launch (0 never does).
+ * @return The default options
+ */
+SimulationOptions default_simulation_options()
+{
+    SimulationOptions options;
+    char *backend = getenv("SIMULATION_BACKEND");
+    char *precision = getenv("SIMULATION_PRECISION");
+    char *threads = getenv("SIMULATION_THREADS");
+    char *fused_qubits = getenv("SIMULATION_FUSED_QUBITS");
+    char *deferred = getenv("SIMULATION_DEFERRED");
+    char *device = getenv("SIMULATION_DEVICE");
+    char *platform_index = getenv("SIMULATION_PLATFORM");
+    char *device_index = getenv("SIMULATION_DEVICE_INDEX");
+    char *profiling = getenv("SIMULATION_PROFILE");
+    char *partitions = getenv("SIMULATION_PARTITIONS");
+    char *specialise = getenv("SIMULATION_SPECIALISE");
+    char *gate_list_qubits = getenv("SIMULATION_GATE_LIST_QUBITS");
+
+    options.backend = BACKEND_DEFAULT;
+    if(backend && strcmp(backend, "cpu") == 0)
+        options.backend = BACKEND_CPU;
+    else if(backend && strcmp(backend, "opencl") == 0)
+        options.backend = BACKEND_OPENCL;
+
+    options.precision = PRECISION_SINGLE;
+    if(precision && strcmp(precision, "double") == 0)
+        options.precision = PRECISION_DOUBLE;
+
+    options.num_threads = threads ? atoi(threads) : 0;
+    options.max_fused_qubits = fused_qubits ? atoi(fused_qubits) : 3;
+    options.deferred = deferred && strcmp(deferred, "1") == 0;
+
+    options.device_type = DEVICE_GPU;
+    if(device && strcmp(device, "cpu") == 0)
+        options.device_type = DEVICE_CPU;
+    else if(device && strcmp(device, "accelerator") == 0)
+        options.device_type = DEVICE_ACCELERATOR;
+    else if(device && strcmp(device, "all") == 0)
+        options.device_type = DEVICE_ALL;
+
+    options.platform_index = platform_index ? atoi(platform_index) : -1;
+    options.device_index = device_index ? atoi(device_index) : 0;
+    options.profiling = profiling && strcmp(profiling, "1") == 0;
+    options.num_partitions = partitions ? atoi(partitions) : 1;
+    options.specialised_kernels = !specialise || strcmp(specialise, "0") != 0;
+    options.gate_list_qubits = gate_list_qubits ? atoi(gate_list_qubits) : 16;
+
+    return options;
+}
+
+/**
+ * @brief Set the up simulation object with the given options.
+ * The default backend is OpenCL if the library was built with it and the
+ * chosen device, a GPU unless options.device_type says otherwise, is
+ * available, otherwise the native multithreaded CPU backend. Double
+ * precision simulations need a device with fp64 support to run on OpenCL.
+ * A deferred simulation queues every gate until measure(),
+ * test_state_vector() or flush_operations() needs the state, so the whole
+ * queue is simplified and fused together. A profiling simulation records the
+ * device times of every OpenCL kernel launch, see dump_profile(). On
+ * OpenCL options.num_partitions > 1 splits the state across several devices
+ * or NUMA sub-devices.
+ * @param options The options choosing the backend and precision of the
+ * simulation
+ * @return simulation object containing all backend objects
+ */
+Simulation *set_up_simulation_with_options(SimulationOptions *options)
+{
+    Simulation *simulation;
+
+    // Initialise Simulation struct
+    simulation = (Simulation *) calloc(1, sizeof(Simulation));
+    if(!simulation) {
+        fprintf(stderr, "error: unable to initialise Simulation.\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Create kernel for the initialise_state function
-    simulation->initialise_state_kernel = clCreateKernel(simulation->program, INITIALISE_FUNC, &error);
-    if(error < 0) {
-        perror("Couldn't create the initialise state kernel");
-        exit(1);
+    simulation->backend = options->backend;
+    simulation->precision = options->precision;
+    simulation->max_fused_qubits = options->max_fused_qubits;
+    simulation->deferred = options->deferred;
+    if(simulation->deferred)
+        simulation->pending_operations = initialise_operation_list();
+    if(options->profiling) {
+        simulation->profile_stats = (ProfileStats *) malloc(sizeof(ProfileStats));
+        if(!simulation->profile_stats) {
+            fprintf(stderr, "error: unable to initialise ProfileStats.\n");
+            exit(EXIT_FAILURE);
+        }
+        reset_profile_stats(simulation->profile_stats);
     }
+    simulation->host_mem_size = (unsigned long long) sysconf(_SC_PHYS_PAGES) *
+        (unsigned long long) sysconf(_SC_PAGESIZE);
+
+#ifdef OPENCL
+    if(simulation->backend != BACKEND_CPU) {
+        if(opencl_set_up(options, simulation) == 0) {
+            simulation->backend = BACKEND_OPENCL;
+        } else if(simulation->backend == BACKEND_OPENCL) {
+            perror("No OpenCL device found");
+            exit(1);
+        }
+    }
+#else
+    if(simulation->backend == BACKEND_OPENCL) {
+        fprintf(stderr, "error: simulation was built without OpenCL.\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
 
-    // Create command queue for the GPU
-    simulation->queue = clCreateCommandQueue(simulation->context, simulation->device, 0, &error);
-    if(error < 0) {
-        perror("Couldn't create the command queue");
-        exit(1);
+    if(simulation->backend != BACKEND_OPENCL) {
+        simulation->backend = BACKEND_CPU;
+        cpu_set_up(options->num_threads, simulation);
     }
 
     // Initialise epsilon
@@ -684,3 +1350,15 @@ Simulation *set_up_simulation()
 
     return simulation;
 }
+
+/**
+ * @brief Set the up simulation object.
+ * Uses the default options, see default_simulation_options().
+ * @return simulation object containing all backend objects
+ */
+Simulation *set_up_simulation()
+{
+    SimulationOptions options = default_simulation_options();
+
+    return set_up_simulation_with_options(&options);
+}
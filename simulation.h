@@ -1,41 +1,191 @@
 #ifndef _SIMULATION_H
 #define _SIMULATION_H
 
+#ifdef OPENCL
+#ifdef MAC
 #include <OpenCL/cl.h>
+#else
+#define CL_TARGET_OPENCL_VERSION 120
+#include <CL/cl.h>
+#endif
+#endif
+
+#include "cpu_kernels.h"
+#include "operation_list.h"
+#include "profile.h"
+#include "thread_pool.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+extern const double sqrt_2;
+extern double x[8];
+extern double z[8];
+extern double hadamard[8];
+
+typedef enum {BACKEND_DEFAULT, BACKEND_OPENCL, BACKEND_CPU} Backend;
+typedef enum {PRECISION_SINGLE, PRECISION_DOUBLE} Precision;
+typedef enum {DEVICE_GPU, DEVICE_CPU, DEVICE_ACCELERATOR, DEVICE_ALL} DeviceType;
+
+typedef struct SimulationOptions
+{
+    Backend backend;
+    Precision precision;
+    int num_threads;
+    int max_fused_qubits;
+    bool deferred;
+    DeviceType device_type;
+    int platform_index;
+    int device_index;
+    bool profiling;
+    int num_partitions;
+    bool specialised_kernels;
+    int gate_list_qubits;
+} SimulationOptions;
+
+/** A Pauli string, X on the qubits of x_mask and Z on those of z_mask, Y on both */
+typedef struct PauliTerm
+{
+    size_t x_mask;
+    size_t z_mask;
+} PauliTerm;
+
+/** A state drawn by sample() and the number of shots which landed on it */
+typedef struct SampleCount
+{
+    size_t index;
+    size_t count;
+} SampleCount;
 
-extern const float sqrt_2;
-extern float x[8];
-extern float z[8];
-extern float hadamard[8];
+/** Called with the values of an asynchronous read once they reach the host */
+typedef void (*ResultCallback)(const double *, size_t, void *);
+
+typedef struct AsyncResult
+{
+    struct Simulation *simulation;
+    int slot;
+    double *values;
+    size_t size;
+    bool owns_values;
+    void *staging;
+    int status;
+    bool complete;
+    ResultCallback callback;
+    void *user_data;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+#ifdef OPENCL
+    cl_event event;
+#endif
+} AsyncResult;
 
 typedef struct Simulation
 {
+    Backend backend;
+    Precision precision;
+#ifdef OPENCL
     cl_context context;
     cl_device_id device;
     cl_command_queue queue;
     cl_program program;
-    cl_ulong global_mem_size;
     cl_kernel apply_gate_kernel;
     cl_kernel apply_controlled_gate_kernel;
     cl_kernel apply_double_controlled_gate_kernel;
     cl_kernel measure_kernel;
     cl_kernel initialise_state_kernel;
-    float *state_vector;
-    float *probabilities;
-    size_t num_amp;
-    float epsilon;
+    cl_kernel apply_dense_gate_kernel;
+    cl_kernel apply_multi_controlled_gate_kernel;
+    cl_kernel apply_diagonal_gate_kernel;
+    cl_kernel apply_permutation_gate_kernel;
+    cl_kernel apply_gate_list_kernel;
+    cl_kernel apply_gate_tile_kernel;
+    cl_kernel reduce_qubit_marginals_kernel;
+    cl_kernel reduce_register_kernel;
+    cl_kernel sum_partials_kernel;
+    cl_kernel probability_histogram_kernel;
+    cl_kernel select_top_k_kernel;
+    cl_kernel apply_global_gate_kernel;
+    cl_kernel sum_blocks_kernel;
+    cl_kernel sample_in_blocks_kernel;
+    cl_kernel pauli_group_sums_kernel;
+    size_t work_group_size;
+    size_t gate_list_work_group_size;
+    int gate_list_qubits;
+    size_t tile_work_group_size;
     cl_mem probability_buffer;
+    cl_mem back_probability_buffer;
     cl_mem state_vector_buffer;
+    cl_mem dense_matrix_buffer;
+    struct ProfiledLaunch *profiled_launches;
+    int num_profiled_launches;
+    int num_partition_devices;
+    int num_partitions;
+    int local_qubits;
+    int partition_work;
+    bool sub_devices;
+    cl_device_id *partition_devices;
+    cl_command_queue *partition_queues;
+    cl_mem *partition_buffers;
+    bool specialised_kernels;
+    struct KernelVariant *kernel_variants;
+    int num_kernel_variants;
+#endif
+    ThreadPool *thread_pool;
+    SimdLevel simd_level;
+    int block_qubits;
+    void *real_amplitudes;
+    void *imag_amplitudes;
+    unsigned long long global_mem_size;
+    unsigned long long max_alloc_size;
+    unsigned long long host_mem_size;
+    bool unified_memory;
+    double *probabilities;
+    double *back_probabilities;
+    AsyncResult *probability_results[2];
+    int next_probability_slot;
+    size_t num_amp;
+    int max_fused_qubits;
+    bool deferred;
+    OperationList *pending_operations;
+    ProfileStats *profile_stats;
+    double epsilon;
 } Simulation;
 
 void print_results(Simulation *);
-void test_state_vector(float *, Simulation *);
+size_t precision_size(Precision);
+void test_state_vector(double *, Simulation *);
 void deallocate_resources(Simulation *);
 void measure(Simulation *);
-void apply_gate(int, float[8], Simulation *);
-void apply_controlled_gate(int, int, float[8], Simulation *);
-void apply_double_controlled_gate(int, int, int, float[8], Simulation *);
+AsyncResult *measure_async(ResultCallback, void *, Simulation *);
+AsyncResult *read_state_async(ResultCallback, void *, Simulation *);
+double state_norm(Simulation *);
+void qubit_marginals(double *, Simulation *);
+void register_marginal(int, int, double *, Simulation *);
+void marginal(size_t, double *, Simulation *);
+size_t top_k_states(size_t, size_t *, double *, Simulation *);
+size_t sample(size_t, unsigned long long, SampleCount *, Simulation *);
+int measure_qubit(int, unsigned long long *, Simulation *);
+PauliTerm pauli_term(const char *);
+double expectation(size_t, const PauliTerm *, const double *, Simulation *);
+void complete_result(AsyncResult *);
+bool result_ready(AsyncResult *);
+const double *wait_result(AsyncResult *);
+void free_result(AsyncResult *);
+void apply_gate(int, double[8], Simulation *);
+void apply_controlled_gate(int, int, double[8], Simulation *);
+void apply_double_controlled_gate(int, int, int, double[8], Simulation *);
+void apply_multi_controlled_gate(int, size_t, double[8], Simulation *);
+void apply_operation(Operation *, Simulation *);
+void apply_operation_list(OperationList *, Simulation *);
+void flush_operations(Simulation *);
+void get_profile_stats(ProfileStats *, Simulation *);
+void reset_profile(Simulation *);
+void dump_profile(FILE *, Simulation *);
+int max_qubits(Simulation *);
 void initialise_qubits(int, Simulation *);
+SimulationOptions default_simulation_options(void);
+Simulation *set_up_simulation_with_options(SimulationOptions *);
 Simulation *set_up_simulation(void);
 
 #endif
@@ -100,8 +100,8 @@ void test_set_binary()
     set_binary(y, y_size, y_array);
 
     // then
-    int x_array_test[x_size] = {0,1,1,0,0,0};
-    int y_array_test[y_size] = {1,1,0,1,1};
+    int x_array_test[6] = {0,1,1,0,0,0};
+    int y_array_test[5] = {1,1,0,1,1};
 
     for(int i=0; i<x_size; i++)
         assert(x_array[i] == x_array_test[i]);
@@ -118,10 +118,10 @@ void test_sum()
 
     // given
     const int x_size = 6;
-    int x_array[x_size] = {0,1,1,0,0,0};
+    int x_array[6] = {0,1,1,0,0,0};
     
     const int y_size = 5;
-    int y_array[y_size] = {1,1,0,1,1};
+    int y_array[5] = {1,1,0,1,1};
 
     // when
     int x = get_sum(x_array, x_size);
@@ -0,0 +1,223 @@
+#include "cpu_kernels.h"
+#include "simulation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+void assert(int status)
+{
+    if(status == 1)
+        return;
+
+    printf("\033[1;31mFailed\n \033[0m");
+    exit(EXIT_FAILURE);
+}
+
+void test_simd_block_size()
+{
+    printf("Testing simd_block_size: ");
+
+    // then
+    assert(simd_block_size(SIMD_SCALAR) == 1);
+    assert(simd_block_size(SIMD_AVX2) == 8);
+    assert(simd_block_size(SIMD_AVX512) == 16);
+
+    printf("Pass\n");
+}
+
+void test_apply_gate_kernel()
+{
+    printf("Testing apply_gate_kernel: ");
+
+    // given
+    const int qubits = 8;
+    const int num_amp = 1 << qubits;
+    double gate[8] = {0.6, 0.1, -0.3, 0.7, 0.2, -0.5, 0.9, 0.4};
+    float real[num_amp], imag[num_amp], simd_real[num_amp], simd_imag[num_amp];
+    SimdLevel level = detect_simd_level();
+
+    srand(1);
+
+    for(int l=SIMD_AVX2; l<=level; l++)
+        for(int target=0; target<qubits; target++) {
+            for(int i=0; i<num_amp; i++) {
+                real[i] = simd_real[i] = (float) rand()/RAND_MAX - 0.5;
+                imag[i] = simd_imag[i] = (float) rand()/RAND_MAX - 0.5;
+            }
+
+            // when
+            apply_gate_kernel(SIMD_SCALAR, real, imag, 0, num_amp/2, target, gate);
+            apply_gate_kernel(l, simd_real, simd_imag, 0, num_amp/2, target, gate);
+
+            // then
+            for(int i=0; i<num_amp; i++) {
+                assert(fabs(real[i] - simd_real[i]) < 1e-5);
+                assert(fabs(imag[i] - simd_imag[i]) < 1e-5);
+            }
+        }
+
+    printf("Pass\n");
+}
+
+void test_apply_gate_kernel_hadamard()
+{
+    printf("Testing apply_gate_kernel hadamard: ");
+
+    // given
+    float real[32] = {1}, imag[32] = {0};
+    SimdLevel level = detect_simd_level();
+
+    // when
+    for(int target=0; target<5; target++)
+        apply_gate_kernel(level, real, imag, 0, 16, target, hadamard);
+
+    // then
+    for(int i=0; i<32; i++) {
+        assert(fabs(real[i] - 1/sqrt(32)) < 1e-5);
+        assert(imag[i] == 0);
+    }
+
+    printf("Pass\n");
+}
+
+void test_apply_gate_kernel_double()
+{
+    printf("Testing apply_gate_kernel_double hadamard: ");
+
+    // given
+    double real[32] = {1}, imag[32] = {0};
+
+    // when
+    for(int target=0; target<5; target++)
+        apply_gate_kernel_double(real, imag, 0, 16, target, hadamard);
+
+    // then
+    for(int i=0; i<32; i++) {
+        assert(fabs(real[i] - 1/sqrt(32)) < 1e-15);
+        assert(imag[i] == 0);
+    }
+
+    printf("Pass\n");
+}
+
+void test_apply_controlled_gate_kernel()
+{
+    printf("Testing apply_controlled_gate_kernel: ");
+
+    // given
+    const int qubits = 7, target = 2;
+    const int num_amp = 1 << qubits;
+    const size_t control_mask = (1 << 0) | (1 << 5);
+    double gate[8] = {0.6, 0.1, -0.3, 0.7, 0.2, -0.5, 0.9, 0.4};
+    float real[num_amp], imag[num_amp], expected_real[num_amp], expected_imag[num_amp];
+    int zero_state, one_state;
+
+    srand(4);
+    for(int i=0; i<num_amp; i++) {
+        real[i] = expected_real[i] = (float) rand()/RAND_MAX - 0.5;
+        imag[i] = expected_imag[i] = (float) rand()/RAND_MAX - 0.5;
+    }
+
+    for(int i=0; i<num_amp; i++) {
+        if(((i >> target) & 1) || (i & control_mask) != control_mask)
+            continue;
+        zero_state = i;
+        one_state = i | (1 << target);
+        expected_real[zero_state] = gate[0]*real[zero_state] - gate[1]*imag[zero_state] +
+            gate[2]*real[one_state] - gate[3]*imag[one_state];
+        expected_imag[zero_state] = gate[0]*imag[zero_state] + gate[1]*real[zero_state] +
+            gate[2]*imag[one_state] + gate[3]*real[one_state];
+        expected_real[one_state] = gate[4]*real[zero_state] - gate[5]*imag[zero_state] +
+            gate[6]*real[one_state] - gate[7]*imag[one_state];
+        expected_imag[one_state] = gate[4]*imag[zero_state] + gate[5]*real[zero_state] +
+            gate[6]*imag[one_state] + gate[7]*real[one_state];
+    }
+
+    // when
+    apply_controlled_gate_kernel(real, imag, 0, num_amp/8, target, control_mask, gate);
+
+    // then
+    for(int i=0; i<num_amp; i++) {
+        assert(fabs(real[i] - expected_real[i]) < 1e-6);
+        assert(fabs(imag[i] - expected_imag[i]) < 1e-6);
+    }
+
+    printf("Pass\n");
+}
+
+void test_classify_gate()
+{
+    printf("Testing classify_gate: ");
+
+    // given
+    double identity[8] = {1, 0, 0, 0, 0, 0, 1, 0};
+    double phase[8] = {1, 0, 0, 0, 0, 0, 0.6, 0.8};
+    double y[8] = {0, 0, 0, -1, 0, 1, 0, 0};
+
+    // then
+    assert(classify_gate(identity) == GATE_IDENTITY);
+    assert(classify_gate(phase) == GATE_DIAGONAL);
+    assert(classify_gate(x) == GATE_PERMUTATION);
+    assert(classify_gate(y) == GATE_GENERAL);
+    assert(classify_gate(hadamard) == GATE_GENERAL);
+
+    printf("Pass\n");
+}
+
+void test_special_gate_kernels()
+{
+    printf("Testing diagonal and permutation kernels: ");
+
+    // given
+    const int qubits = 6;
+    const int num_amp = 1 << qubits;
+    const size_t control_mask = (1 << 1) | (1 << 4);
+    double phase[8] = {0.8, -0.6, 0, 0, 0, 0, 0.6, 0.8};
+    float real[num_amp], imag[num_amp], special_real[num_amp], special_imag[num_amp];
+
+    srand(3);
+
+    for(int target=0; target<qubits; target++) {
+        size_t mask = control_mask & ~((size_t) 1 << target);
+        int controls = (mask == control_mask) ? 2 : 1;
+
+        for(int i=0; i<num_amp; i++) {
+            real[i] = special_real[i] = (float) rand()/RAND_MAX - 0.5;
+            imag[i] = special_imag[i] = (float) rand()/RAND_MAX - 0.5;
+        }
+
+        // when
+        apply_controlled_gate_kernel(real, imag, 0, num_amp/2 >> controls, target,
+            mask, phase);
+        apply_controlled_gate_kernel(real, imag, 0, num_amp/2 >> controls, target,
+            mask, x);
+        apply_diagonal_gate_kernel(special_real, special_imag, 0, num_amp/2 >> controls,
+            target, mask, phase);
+        apply_permutation_gate_kernel(special_real, special_imag, 0, num_amp/2 >> controls,
+            target, mask);
+
+        // then
+        for(int i=0; i<num_amp; i++) {
+            assert(fabs(real[i] - special_real[i]) < 1e-6);
+            assert(fabs(imag[i] - special_imag[i]) < 1e-6);
+        }
+    }
+
+    printf("Pass\n");
+}
+
+int main()
+{
+    printf("\033[1;32m");
+
+    test_simd_block_size();
+    test_apply_gate_kernel();
+    test_apply_gate_kernel_hadamard();
+    test_apply_gate_kernel_double();
+    test_apply_controlled_gate_kernel();
+    test_classify_gate();
+    test_special_gate_kernels();
+
+    printf("\033[0m");
+}
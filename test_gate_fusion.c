@@ -0,0 +1,284 @@
+#include "gate_fusion.h"
+#include "simulation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+void assert(int status)
+{
+    if(status == 1)
+        return;
+
+    printf("\033[1;31mFailed\n \033[0m");
+    exit(EXIT_FAILURE);
+}
+
+void phase_gate(double k, double gate[8])
+{
+    double values[8] = {1, 0, 0, 0, 0, 0, cos(k), sin(k)};
+
+    for(int i=0; i<8; i++)
+        gate[i] = values[i];
+}
+
+void append_qft(int size, OperationList *list)
+{
+    double gate[8];
+
+    for(int i=0; i<size; i++) {
+        append_gate(i, hadamard, list);
+        for(int j=i+1; j<size; j++) {
+            phase_gate(M_PI/pow(2, j-i), gate);
+            append_controlled_gate(i, j, gate, list);
+        }
+    }
+
+    for(int i=0; i<size/2; i++) {
+        append_controlled_gate(i, size-i-1, x, list);
+        append_controlled_gate(size-i-1, i, x, list);
+        append_controlled_gate(i, size-i-1, x, list);
+    }
+}
+
+void test_multiply_gates()
+{
+    printf("Testing multiply_gates: ");
+
+    // given
+    double h[8], identity[8];
+
+    for(int i=0; i<8; i++)
+        h[i] = hadamard[i];
+
+    // when
+    multiply_gates(h, h, identity);
+
+    // then
+    assert(fabs(identity[0] - 1) < 1e-6);
+    assert(fabs(identity[2]) < 1e-6);
+    assert(fabs(identity[4]) < 1e-6);
+    assert(fabs(identity[6] - 1) < 1e-6);
+
+    printf("Pass\n");
+}
+
+void test_simplify_operations()
+{
+    printf("Testing simplify_operations: ");
+
+    // given
+    double phase_1[8], phase_2[8];
+    phase_gate(0.3, phase_1);
+    phase_gate(0.4, phase_2);
+
+    OperationList *list = initialise_operation_list();
+    append_gate(0, hadamard, list);
+    append_controlled_gate(2, 1, x, list);
+    append_gate(0, hadamard, list);
+    append_controlled_gate(2, 1, x, list);
+    append_controlled_gate(3, 0, phase_1, list);
+    append_controlled_gate(3, 0, phase_2, list);
+    append_gate(1, x, list);
+    append_controlled_gate(1, 2, x, list);
+    append_gate(1, x, list);
+
+    // when
+    OperationList *simplified = simplify_operations(list);
+
+    // then
+    assert(simplified->num_operations == 4);
+    assert(simplified->operations[0].target == 3);
+    assert(simplified->operations[0].control_mask == 1);
+    assert(fabs(simplified->operations[0].gate[6] - cos(0.7)) < 1e-9);
+    assert(fabs(simplified->operations[0].gate[7] - sin(0.7)) < 1e-9);
+    assert(simplified->operations[1].target == 1);
+    assert(simplified->operations[2].control_mask == 4);
+    assert(simplified->operations[3].target == 1);
+
+    free_operation_list(list);
+    free_operation_list(simplified);
+
+    printf("Pass\n");
+}
+
+void test_fold_single_qubit_gates()
+{
+    printf("Testing fold_single_qubit_gates: ");
+
+    // given
+    OperationList *list = initialise_operation_list();
+    append_gate(0, hadamard, list);
+    append_gate(1, x, list);
+    append_gate(0, hadamard, list);
+    append_controlled_gate(1, 0, x, list);
+    append_gate(1, hadamard, list);
+
+    // when
+    OperationList *folded = fold_single_qubit_gates(list);
+
+    // then
+    assert(folded->num_operations == 4);
+    assert(folded->operations[0].target == 0);
+    assert(fabs(folded->operations[0].gate[0] - 1) < 1e-6);
+    assert(fabs(folded->operations[0].gate[2]) < 1e-6);
+    assert(folded->operations[1].target == 1);
+    assert(folded->operations[2].control_mask == 1);
+    assert(folded->operations[3].gate[6] < 0);
+
+    free_operation_list(list);
+    free_operation_list(folded);
+
+    printf("Pass\n");
+}
+
+void test_fuse_operations()
+{
+    printf("Testing fuse_operations: ");
+
+    // given
+    const int qubits = 8;
+    double gate[8], fused_state[2 << qubits], dense_state[2 << qubits], state[2 << qubits];
+    OperationList *list = initialise_operation_list();
+
+    srand(2);
+    for(int i=0; i<200; i++) {
+        int target = rand() % qubits;
+        int control_1 = (target + 1 + rand() % (qubits-1)) % qubits;
+        int control_2 = (control_1 + 1 + rand() % (qubits-1)) % qubits;
+
+        phase_gate((double) rand()/RAND_MAX, gate);
+
+        switch(rand() % 5) {
+            case 0:
+                append_gate(target, hadamard, list);
+                break;
+            case 1:
+                append_gate(target, gate, list);
+                break;
+            case 2:
+                append_controlled_gate(target, control_1, x, list);
+                break;
+            case 3:
+                append_controlled_gate(target, control_1, gate, list);
+                break;
+            default:
+                if(control_2 != target)
+                    append_double_controlled_gate(target, control_1, control_2, x, list);
+        }
+    }
+
+    for(int k=1; k<=MAX_FUSED_QUBITS; k++) {
+        SimulationOptions options = default_simulation_options();
+        options.backend = BACKEND_CPU;
+        options.max_fused_qubits = k;
+        Simulation *simulation = set_up_simulation_with_options(&options);
+        Simulation *fused = set_up_simulation_with_options(&options);
+        Simulation *dense = set_up_simulation_with_options(&options);
+        OperationList *dense_list = fuse_operations(list, k, NULL);
+        initialise_qubits(qubits, simulation);
+        initialise_qubits(qubits, fused);
+        initialise_qubits(qubits, dense);
+
+        // when
+        for(int i=0; i<list->num_operations; i++)
+            apply_operation(&list->operations[i], simulation);
+        apply_operation_list(list, fused);
+        for(int i=0; i<dense_list->num_operations; i++)
+            apply_operation(&dense_list->operations[i], dense);
+
+        // then
+        test_state_vector(state, simulation);
+        test_state_vector(fused_state, fused);
+        test_state_vector(dense_state, dense);
+
+        for(int i=0; i<2 << qubits; i++) {
+            assert(fabs(state[i] - fused_state[i]) < 1e-4);
+            assert(fabs(state[i] - dense_state[i]) < 1e-4);
+        }
+
+        free_operation_list(dense_list);
+        deallocate_resources(simulation);
+        deallocate_resources(fused);
+        deallocate_resources(dense);
+    }
+
+    free_operation_list(list);
+
+    printf("Pass\n");
+}
+
+void test_fuse_qft()
+{
+    printf("Testing fuse_operations on qft: ");
+
+    // given
+    OperationList *list = initialise_operation_list();
+    append_qft(12, list);
+
+    // when
+    OperationList *fused = fuse_operations(list, 5, NULL);
+
+    // then
+    for(int i=0; i<fused->num_operations; i++)
+        assert(fused->operations[i].type == GATE_OPERATION ||
+            fused->operations[i].num_qubits <= 5);
+    assert(fused->num_operations*3 <= list->num_operations);
+
+    free_operation_list(list);
+    free_operation_list(fused);
+
+    printf("Pass\n");
+}
+
+void test_fusion_costs()
+{
+    printf("Testing fuse_operations with costs: ");
+
+    // given
+    const FusionCosts costs = {{1, 0, 1, 1}, {1, 0, 1, 1}, {0, 0, 4, 8, 16, 32}};
+    OperationList *cheap = initialise_operation_list();
+    OperationList *costly = initialise_operation_list();
+
+    append_controlled_gate(1, 0, x, cheap);
+    append_gate(0, hadamard, cheap);
+    append_controlled_gate(1, 0, x, cheap);
+
+    for(int i=0; i<3; i++) {
+        append_gate(0, hadamard, costly);
+        append_controlled_gate(1, 0, hadamard, costly);
+    }
+
+    // when
+    OperationList *separate = fuse_operations(cheap, 2, &costs);
+    OperationList *fused = fuse_operations(costly, 2, &costs);
+
+    // then
+    assert(separate->num_operations == 3);
+    for(int i=0; i<3; i++)
+        assert(separate->operations[i].type == GATE_OPERATION);
+    assert(separate->operations[1].target == 0);
+    assert(fused->num_operations == 1);
+    assert(fused->operations[0].type == DENSE_OPERATION);
+
+    free_operation_list(cheap);
+    free_operation_list(costly);
+    free_operation_list(separate);
+    free_operation_list(fused);
+
+    printf("Pass\n");
+}
+
+int main()
+{
+    printf("\033[1;32m");
+
+    test_multiply_gates();
+    test_simplify_operations();
+    test_fold_single_qubit_gates();
+    test_fuse_operations();
+    test_fuse_qft();
+    test_fusion_costs();
+
+    printf("\033[0m");
+}
@@ -0,0 +1,95 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void assert(int status)
+{
+    if(status == 1)
+        return;
+
+    printf("\033[1;31mFailed\n \033[0m");
+    exit(EXIT_FAILURE);
+}
+
+void test_add_profile_sample()
+{
+    printf("Testing add_profile_sample: ");
+
+    // given
+    ProfileStats stats;
+    const unsigned long long first[4] = {0, 100, 300, 1300};
+    const unsigned long long second[4] = {2000, 2050, 2100, 5100};
+    const unsigned long long third[4] = {6000, 6010, 6020, 6520};
+
+    reset_profile_stats(&stats);
+
+    // when
+    add_profile_sample("apply_gate", PROFILE_GENERAL, 3, first, &stats);
+    add_profile_sample("apply_gate", PROFILE_GENERAL, 5, second, &stats);
+    add_profile_sample("measure", PROFILE_READOUT, -1, third, &stats);
+
+    // then
+    assert(stats.num_kernels == 2);
+    assert(!strcmp(stats.kernels[0].name, "apply_gate"));
+    assert(stats.kernels[0].launches == 2);
+    assert(stats.kernels[0].queued_time == 150);
+    assert(stats.kernels[0].submit_time == 250);
+    assert(stats.kernels[0].run_time == 4000);
+    assert(stats.kernels[1].launches == 1);
+    assert(stats.kernels[1].run_time == 500);
+
+    assert(stats.kinds[PROFILE_GENERAL].launches == 2);
+    assert(stats.kinds[PROFILE_READOUT].launches == 1);
+    assert(stats.kinds[PROFILE_DIAGONAL].launches == 0);
+
+    assert(stats.targets[3].launches == 1 && stats.targets[3].run_time == 1000);
+    assert(stats.targets[5].launches == 1 && stats.targets[5].run_time == 3000);
+    assert(stats.targets[0].launches == 0);
+
+    printf("Pass\n");
+}
+
+void test_dump_profile_stats()
+{
+    printf("Testing dump_profile_stats: ");
+
+    // given
+    ProfileStats stats;
+    const unsigned long long times[4] = {0, 1000, 2000, 12000};
+    FILE *stream = tmpfile();
+    char output[2048];
+    size_t length;
+
+    reset_profile_stats(&stats);
+    add_profile_sample("apply_diagonal_gate", PROFILE_DIAGONAL, 7, times, &stats);
+
+    // when
+    dump_profile_stats(stream, &stats);
+
+    // then
+    rewind(stream);
+    length = fread(output, 1, sizeof(output)-1, stream);
+    output[length] = '\0';
+
+    assert(strstr(output, "apply_diagonal_gate") != NULL);
+    assert(strstr(output, "diagonal") != NULL);
+    assert(strstr(output, "permutation") == NULL);
+    assert(strstr(output, "10.000") != NULL);
+    assert(strstr(output, "2.000") != NULL);
+
+    fclose(stream);
+
+    printf("Pass\n");
+}
+
+int main()
+{
+    printf("\033[1;32m");
+
+    test_add_profile_sample();
+    test_dump_profile_stats();
+
+    printf("\033[0m");
+}
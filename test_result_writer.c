@@ -0,0 +1,174 @@
+#include "result_writer.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void assert(int status)
+{
+    if(status == 1)
+        return;
+
+    printf("\033[1;31mFailed\n \033[0m");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Reads back everything written to a temporary file.
+ * @param file The file, which is closed
+ * @param contents An array to hold the contents, NUL terminated
+ * @param size The size of the contents array
+ * @return The number of bytes read
+ */
+size_t read_back(FILE *file, char *contents, size_t size)
+{
+    size_t length;
+
+    rewind(file);
+    length = fread(contents, 1, size-1, file);
+    contents[length] = '\0';
+    fclose(file);
+
+    return length;
+}
+
+void test_format_bitstring()
+{
+    printf("Testing format_bitstring: ");
+
+    // given
+    char string[8];
+
+    // when
+    format_bitstring(6, 5, string);
+
+    // then
+    assert(!strcmp(string, "01100"));
+
+    printf("Pass\n");
+}
+
+void test_threshold_text()
+{
+    printf("Testing threshold text results: ");
+
+    // given
+    char contents[64];
+    FILE *file = tmpfile();
+    ResultOptions options = default_result_options();
+    options.threshold = 0.1;
+    Simulation *simulation = set_up_simulation();
+
+    initialise_qubits(3, simulation);
+    apply_gate(0, x, simulation);
+    apply_gate(2, hadamard, simulation);
+    measure(simulation);
+
+    // when
+    size_t written = write_results(file, &options, simulation);
+
+    // then
+    read_back(file, contents, sizeof(contents));
+    assert(written == 2);
+    assert(!strcmp(contents, "100\n101\n"));
+
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+void test_top_k_csv()
+{
+    printf("Testing top k CSV results: ");
+
+    // given
+    char contents[128];
+    FILE *file = tmpfile();
+    double ry[8] = {cos(0.3), 0, -sin(0.3), 0, sin(0.3), 0, cos(0.3), 0};
+    ResultOptions options = default_result_options();
+    options.format = RESULT_CSV;
+    options.selection = RESULT_TOP_K;
+    options.k = 2;
+    Simulation *simulation = set_up_simulation();
+
+    initialise_qubits(4, simulation);
+    apply_gate(1, x, simulation);
+    apply_gate(3, ry, simulation);
+    apply_gate(0, hadamard, simulation);
+    apply_controlled_gate(2, 0, ry, simulation);
+
+    // when
+    size_t written = write_results(file, &options, simulation);
+
+    // then
+    read_back(file, contents, sizeof(contents));
+    assert(written == 2);
+    assert(!strncmp(contents, "state,probability\n0100,0.456", 28));
+    assert(strstr(contents, "\n1100,0.416") != NULL);
+
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+void test_parallel_binary()
+{
+    printf("Testing parallel binary results: ");
+
+    // given
+    const int qubits = 16;
+    const size_t num_amp = (size_t) 1 << qubits;
+    const size_t record_size = sizeof(uint64_t) + sizeof(double);
+    char *contents = (char *) malloc(num_amp*record_size + 1);
+    FILE *file = tmpfile();
+    uint64_t index;
+    double probability;
+    ResultOptions options = default_result_options();
+    options.format = RESULT_BINARY;
+    SimulationOptions simulation_options = default_simulation_options();
+    simulation_options.backend = BACKEND_CPU;
+    simulation_options.num_threads = 4;
+    Simulation *simulation = set_up_simulation_with_options(&simulation_options);
+
+    initialise_qubits(qubits, simulation);
+    for(int i=0; i<qubits; i++)
+        apply_gate(i, hadamard, simulation);
+    apply_gate(5, z, simulation);
+
+    // when
+    size_t written = write_results(file, &options, simulation);
+
+    // then
+    assert(written == num_amp);
+    assert(read_back(file, contents, num_amp*record_size + 1) == num_amp*record_size);
+    for(size_t i=0; i<num_amp; i++) {
+        memcpy(&index, contents + i*record_size, sizeof(uint64_t));
+        memcpy(&probability, contents + i*record_size + sizeof(uint64_t), sizeof(double));
+        assert(index == i);
+        assert(fabs(probability - 1.0/num_amp) < 1e-9);
+    }
+
+    file = tmpfile();
+    options.threshold = 2.0/num_amp;
+    assert(write_results(file, &options, simulation) == 0);
+    assert(read_back(file, contents, num_amp*record_size + 1) == 0);
+
+    deallocate_resources(simulation);
+    free(contents);
+
+    printf("Pass\n");
+}
+
+int main()
+{
+    printf("\033[1;32m");
+
+    test_format_bitstring();
+    test_threshold_text();
+    test_top_k_csv();
+    test_parallel_binary();
+
+    printf("\033[0m");
+}
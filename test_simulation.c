@@ -20,13 +20,13 @@ void test_simple_simulation()
     // given
     Simulation *simulation = set_up_simulation();
     initialise_qubits(4, simulation);
-    apply_gate(0, (float *) hadamard, simulation);
-    apply_gate(1, (float *) x, simulation);
-    apply_gate(3, (float *) x, simulation);
-    apply_gate(1, (float *) hadamard, simulation);
-    apply_controlled_gate(2, 1, (float *) x, simulation);
-    apply_controlled_gate(1, 0, (float *) x, simulation);
-    apply_gate(1, (float *) x, simulation);
+    apply_gate(0, hadamard, simulation);
+    apply_gate(1, x, simulation);
+    apply_gate(3, x, simulation);
+    apply_gate(1, hadamard, simulation);
+    apply_controlled_gate(2, 1, x, simulation);
+    apply_controlled_gate(1, 0, x, simulation);
+    apply_gate(1, x, simulation);
     
     // when
     measure(simulation);
@@ -54,13 +54,1183 @@ void test_simple_simulation()
     printf("Pass\n");
 }
 
+void test_threaded_cpu_simulation()
+{
+    printf("Testing threaded cpu simulation: ");
+
+    // given
+    const int qubits = 14;
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    options.num_threads = 1;
+    Simulation *serial = set_up_simulation_with_options(&options);
+    options.num_threads = 4;
+    Simulation *threaded = set_up_simulation_with_options(&options);
+    double *serial_state = (double *) malloc(sizeof(double)*2*(1 << qubits));
+    double *threaded_state = (double *) malloc(sizeof(double)*2*(1 << qubits));
+
+    initialise_qubits(qubits, serial);
+    initialise_qubits(qubits, threaded);
+
+    // when
+    for(int i=0; i<qubits; i++) {
+        apply_gate(i, hadamard, serial);
+        apply_gate(i, hadamard, threaded);
+    }
+    apply_controlled_gate(0, qubits-1, x, serial);
+    apply_controlled_gate(0, qubits-1, x, threaded);
+    apply_double_controlled_gate(5, 2, qubits-1, z, serial);
+    apply_double_controlled_gate(5, 2, qubits-1, z, threaded);
+    apply_gate(qubits-1, hadamard, serial);
+    apply_gate(qubits-1, hadamard, threaded);
+
+    test_state_vector(serial_state, serial);
+    test_state_vector(threaded_state, threaded);
+
+    // then
+    assert(threaded->backend == BACKEND_CPU);
+    assert(threaded->thread_pool->num_threads == 4);
+
+    for(int i=0; i<2*(1 << qubits); i++)
+        assert(serial_state[i] == threaded_state[i]);
+
+    free(serial_state);
+    free(threaded_state);
+    deallocate_resources(serial);
+    deallocate_resources(threaded);
+
+    printf("Pass\n");
+}
+
+void test_cache_blocked_simulation()
+{
+    printf("Testing cache blocked simulation: ");
+
+    // given
+    const int qubits = 12;
+    double phase[8] = {1,0,0,0,0,0,0.6,0.8};
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    options.num_threads = 2;
+    Simulation *unblocked = set_up_simulation_with_options(&options);
+    Simulation *blocked = set_up_simulation_with_options(&options);
+    OperationList *list = initialise_operation_list();
+    double *unblocked_state = (double *) malloc(sizeof(double)*2*(1 << qubits));
+    double *blocked_state = (double *) malloc(sizeof(double)*2*(1 << qubits));
+
+    unblocked->block_qubits = 0;
+    blocked->block_qubits = 6;
+    initialise_qubits(qubits, unblocked);
+    initialise_qubits(qubits, blocked);
+
+    for(int i=0; i<qubits; i++)
+        append_gate(i, hadamard, list);
+    for(int i=0; i<qubits; i++) {
+        append_gate((5*i) % qubits, phase, list);
+        append_controlled_gate((i+3) % qubits, i, x, list);
+        append_gate((7*i+2) % qubits, hadamard, list);
+        append_double_controlled_gate(i % 6, (i+1) % qubits, (i+9) % qubits, phase, list);
+    }
+
+    // when
+    apply_operation_list(list, unblocked);
+    apply_operation_list(list, blocked);
+
+    test_state_vector(unblocked_state, unblocked);
+    test_state_vector(blocked_state, blocked);
+
+    // then
+    for(int i=0; i<2*(1 << qubits); i++)
+        assert(fabs(unblocked_state[i] - blocked_state[i]) < 1e-5);
+
+    free(unblocked_state);
+    free(blocked_state);
+    free_operation_list(list);
+    deallocate_resources(unblocked);
+    deallocate_resources(blocked);
+
+    printf("Pass\n");
+}
+
+void test_double_precision_simulation()
+{
+    printf("Testing double precision simulation: ");
+
+    // given
+    const int qubits = 10;
+    double phase[8], angle, *state = (double *) malloc(sizeof(double)*2*(1 << qubits));
+    double *list_state = (double *) malloc(sizeof(double)*2*(1 << qubits));
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    options.precision = PRECISION_DOUBLE;
+    options.num_threads = 2;
+    Simulation *simulation = set_up_simulation_with_options(&options);
+    Simulation *list_simulation = set_up_simulation_with_options(&options);
+    OperationList *list = initialise_operation_list();
+
+    list_simulation->block_qubits = 5;
+    initialise_qubits(qubits, simulation);
+    initialise_qubits(qubits, list_simulation);
+
+    // when
+    for(int i=0; i<qubits; i++) {
+        apply_gate(i, hadamard, simulation);
+        append_gate(i, hadamard, list);
+    }
+    for(int i=0; i<qubits; i++) {
+        angle = M_PI/pow(2, 20+i);
+        double values[8] = {1, 0, 0, 0, 0, 0, cos(angle), sin(angle)};
+        for(int j=0; j<8; j++)
+            phase[j] = values[j];
+        apply_gate(i, phase, simulation);
+        append_gate(i, phase, list);
+    }
+    apply_operation_list(list, list_simulation);
+
+    test_state_vector(state, simulation);
+    test_state_vector(list_state, list_simulation);
+
+    // then
+    assert(simulation->precision == PRECISION_DOUBLE);
+
+    for(int b=0; b<(1 << qubits); b++) {
+        angle = 0;
+        for(int i=0; i<qubits; i++)
+            if((b >> i) & 1)
+                angle += M_PI/pow(2, 20+i);
+
+        assert(fabs(state[2*b] - cos(angle)/sqrt(1 << qubits)) < 1e-12);
+        assert(fabs(state[2*b+1] - sin(angle)/sqrt(1 << qubits)) < 1e-12);
+        assert(fabs(list_state[2*b] - state[2*b]) < 1e-12);
+        assert(fabs(list_state[2*b+1] - state[2*b+1]) < 1e-12);
+    }
+
+    free(state);
+    free(list_state);
+    free_operation_list(list);
+    deallocate_resources(simulation);
+    deallocate_resources(list_simulation);
+
+    printf("Pass\n");
+}
+
+void test_multi_controlled_gate()
+{
+    printf("Testing multi controlled gate: ");
+
+    // given
+    const int qubits = 8, target = 3;
+    const size_t control_mask = (1 << 0) | (1 << 5) | (1 << 6);
+    double general[8] = {0.6, 0.1, -0.3, 0.7, 0.2, -0.5, 0.9, 0.4};
+    double phase[8] = {1, 0, 0, 0, 0, 0, 0.6, 0.8};
+    double *gates[3] = {general, phase, x};
+    double *before = (double *) malloc(sizeof(double)*2*(1 << qubits));
+    double *after = (double *) malloc(sizeof(double)*2*(1 << qubits));
+    double expected_re, expected_im;
+    int zero_state, one_state;
+    Simulation *simulation = set_up_simulation();
+    initialise_qubits(qubits, simulation);
+
+    for(int i=0; i<qubits; i++) {
+        apply_gate(i, hadamard, simulation);
+        apply_controlled_gate(i, (i+3) % qubits, phase, simulation);
+    }
+
+    for(int g=0; g<3; g++) {
+        const double *gate = gates[g];
+        test_state_vector(before, simulation);
+
+        // when
+        apply_multi_controlled_gate(target, control_mask, gates[g], simulation);
+        test_state_vector(after, simulation);
+
+        // then
+        for(int i=0; i<(1 << qubits); i++) {
+            zero_state = i & ~(1 << target);
+            one_state = i | (1 << target);
+
+            if((i & control_mask) != control_mask) {
+                expected_re = before[2*i];
+                expected_im = before[2*i+1];
+            } else {
+                int row = (i >> target) & 1;
+                const double *a = gate + 4*row, *b = gate + 4*row + 2;
+
+                expected_re = a[0]*before[2*zero_state] - a[1]*before[2*zero_state+1] +
+                    b[0]*before[2*one_state] - b[1]*before[2*one_state+1];
+                expected_im = a[0]*before[2*zero_state+1] + a[1]*before[2*zero_state] +
+                    b[0]*before[2*one_state+1] + b[1]*before[2*one_state];
+            }
+
+            assert(fabs(after[2*i] - expected_re) < 1e-5);
+            assert(fabs(after[2*i+1] - expected_im) < 1e-5);
+        }
+    }
+
+    free(before);
+    free(after);
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+void test_deferred_simulation()
+{
+    printf("Testing deferred simulation: ");
+
+    // given
+    const int qubits = 10;
+    double phase[8] = {1, 0, 0, 0, 0, 0, 0.6, 0.8};
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    options.deferred = false;
+    Simulation *eager = set_up_simulation_with_options(&options);
+    options.deferred = true;
+    Simulation *deferred = set_up_simulation_with_options(&options);
+    Simulation *simulations[2] = {eager, deferred};
+    double *eager_state = (double *) malloc(sizeof(double)*2*(1 << qubits));
+    double *deferred_state = (double *) malloc(sizeof(double)*2*(1 << qubits));
+
+    // when
+    for(int s=0; s<2; s++) {
+        initialise_qubits(qubits, simulations[s]);
+        for(int i=0; i<qubits; i++) {
+            apply_gate(i, hadamard, simulations[s]);
+            apply_controlled_gate(i, (i+1) % qubits, phase, simulations[s]);
+            apply_controlled_gate((i+2) % qubits, i, x, simulations[s]);
+            apply_controlled_gate((i+2) % qubits, i, x, simulations[s]);
+        }
+        apply_multi_controlled_gate(0, (1 << 3) | (1 << 4) | (1 << 7), x,
+            simulations[s]);
+    }
+
+    // then
+    assert(deferred->pending_operations->num_operations == 4*qubits+1);
+
+    test_state_vector(eager_state, eager);
+    test_state_vector(deferred_state, deferred);
+
+    assert(deferred->pending_operations->num_operations == 0);
+    for(int i=0; i<2*(1 << qubits); i++)
+        assert(fabs(eager_state[i] - deferred_state[i]) < 1e-5);
+
+    free(eager_state);
+    free(deferred_state);
+    deallocate_resources(eager);
+    deallocate_resources(deferred);
+
+    printf("Pass\n");
+}
+
+void test_deferred_reinitialise()
+{
+    printf("Testing deferred reinitialise: ");
+
+    // given
+    double state[2*(1 << 3)];
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    options.deferred = true;
+    Simulation *simulation = set_up_simulation_with_options(&options);
+
+    initialise_qubits(5, simulation);
+    apply_gate(0, x, simulation);
+    apply_gate(4, x, simulation);
+
+    // when
+    initialise_qubits(3, simulation);
+
+    // then
+    assert(simulation->pending_operations->num_operations == 0);
+    test_state_vector(state, simulation);
+    assert(state[0] == 1 && state[1] == 0);
+    for(int i=2; i<2*(1 << 3); i++)
+        assert(state[i] == 0);
+
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+void count_callback(const double *values, size_t size, void *user_data)
+{
+    (void) values;
+    (void) size;
+    (*(int *) user_data)++;
+}
+
+void test_async_results()
+{
+    printf("Testing async results: ");
+
+    // given
+    const int qubits = 6;
+    int callbacks = 0;
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    Simulation *simulation = set_up_simulation_with_options(&options);
+    double *state = (double *) malloc(sizeof(double)*2*(1 << qubits));
+    AsyncResult *first, *second, *state_result;
+    const double *first_probabilities, *second_probabilities, *async_state;
+
+    initialise_qubits(qubits, simulation);
+    for(int i=0; i<qubits; i++)
+        apply_gate(i, hadamard, simulation);
+
+    // when
+    first = measure_async(count_callback, &callbacks, simulation);
+    apply_gate(0, hadamard, simulation);
+    second = measure_async(count_callback, &callbacks, simulation);
+    state_result = read_state_async(NULL, NULL, simulation);
+
+    // then
+    first_probabilities = wait_result(first);
+    second_probabilities = wait_result(second);
+    async_state = wait_result(state_result);
+    test_state_vector(state, simulation);
+
+    assert(result_ready(first) && result_ready(second));
+    assert(callbacks == 2);
+    assert(first_probabilities != second_probabilities);
+    for(int i=0; i<(1 << qubits); i++) {
+        assert(fabs(first_probabilities[i] - 1.0/(1 << qubits)) < 1e-5);
+        assert(fabs(second_probabilities[i] - ((i & 1) ? 0 : 2.0/(1 << qubits))) < 1e-5);
+    }
+    for(int i=0; i<2*(1 << qubits); i++)
+        assert(async_state[i] == state[i]);
+
+    free_result(first);
+    free_result(second);
+    free_result(state_result);
+    free(state);
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+void test_reductions()
+{
+    printf("Testing reductions: ");
+
+    // given
+    const int qubits = 12, k = 20;
+    double rotation[8] = {0.6, 0, -0.8, 0, 0.8, 0, 0.6, 0};
+    double phase[8] = {1, 0, 0, 0, 0, 0, 0, 1};
+    double marginals[12], expected_marginals[12], norm = 0;
+    double register_probabilities[1 << 5], expected_register[1 << 5] = {0};
+    double top_probabilities[20], full_register[1 << 12];
+    double scattered[1 << 4], expected_scattered[1 << 4] = {0};
+    double wide[1 << 11], expected_wide[1 << 11] = {0};
+    const size_t scattered_mask = 1 | (1 << 3) | (1 << 7) | (1 << 11);
+    const size_t wide_mask = ((1 << 12) - 1) & ~(1 << 5);
+    size_t top_indices[20];
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    options.num_threads = 4;
+    Simulation *simulation = set_up_simulation_with_options(&options);
+
+    initialise_qubits(qubits, simulation);
+    for(int i=0; i<qubits; i++) {
+        apply_gate(i, i % 3 ? rotation : hadamard, simulation);
+        apply_controlled_gate((i+1) % qubits, i, phase, simulation);
+    }
+    apply_controlled_gate(3, 7, x, simulation);
+    measure(simulation);
+
+    for(int q=0; q<qubits; q++)
+        expected_marginals[q] = 0;
+    for(size_t i=0; i<simulation->num_amp; i++) {
+        norm += simulation->probabilities[i];
+        for(int q=0; q<qubits; q++)
+            if((i >> q) & 1)
+                expected_marginals[q] += simulation->probabilities[i];
+        expected_register[(i >> 4) & 31] += simulation->probabilities[i];
+        expected_scattered[(i & 1) | ((i >> 2) & 2) | ((i >> 5) & 4) | ((i >> 8) & 8)] +=
+            simulation->probabilities[i];
+        expected_wide[(i & 31) | ((i >> 1) & ~(size_t) 31)] += simulation->probabilities[i];
+    }
+
+    // when
+    qubit_marginals(marginals, simulation);
+    register_marginal(4, 5, register_probabilities, simulation);
+    marginal(scattered_mask, scattered, simulation);
+    marginal(wide_mask, wide, simulation);
+
+    // then
+    assert(fabs(state_norm(simulation) - norm) < 1e-5);
+    for(int q=0; q<qubits; q++)
+        assert(fabs(marginals[q] - expected_marginals[q]) < 1e-5);
+    for(int v=0; v<32; v++)
+        assert(fabs(register_probabilities[v] - expected_register[v]) < 1e-5);
+    for(int v=0; v<16; v++)
+        assert(fabs(scattered[v] - expected_scattered[v]) < 1e-5);
+    for(int v=0; v<(1 << 11); v++)
+        assert(fabs(wide[v] - expected_wide[v]) < 1e-6);
 
+    register_marginal(0, qubits, full_register, simulation);
+    for(size_t i=0; i<simulation->num_amp; i++)
+        assert(fabs(full_register[i] - simulation->probabilities[i]) < 1e-6);
+
+    assert(top_k_states(k, top_indices, top_probabilities, simulation) == (size_t) k);
+    for(int i=0; i<k; i++) {
+        assert(top_probabilities[i] == simulation->probabilities[top_indices[i]]);
+        assert(i == 0 || top_probabilities[i] <= top_probabilities[i-1]);
+    }
+    for(size_t i=0, above=0; i<simulation->num_amp; i++) {
+        if(simulation->probabilities[i] > top_probabilities[k-1])
+            above++;
+        assert(above < (size_t) k);
+    }
+
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+void test_large_marginal()
+{
+    printf("Testing large register marginal: ");
+
+    // given
+    const int qubits = 20;
+    const size_t large_mask = 0xF5F3F, small_mask = 0x0AC65;
+    const size_t num_large = (size_t) 1 << 16, num_small = (size_t) 1 << 8;
+    double rotation[8] = {0.6, 0, -0.8, 0, 0.8, 0, 0.6, 0};
+    double *large = (double *) malloc(sizeof(double)*num_large);
+    double *expected_large = (double *) calloc(num_large, sizeof(double));
+    double small[1 << 8], expected_small[1 << 8] = {0};
+    size_t value;
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    options.num_threads = 4;
+    Simulation *simulation = set_up_simulation_with_options(&options);
+
+    initialise_qubits(qubits, simulation);
+    for(int i=0; i<qubits; i++) {
+        apply_gate(i, i % 2 ? rotation : hadamard, simulation);
+        apply_controlled_gate((i+3) % qubits, i, rotation, simulation);
+    }
+    measure(simulation);
+
+    for(size_t i=0; i<simulation->num_amp; i++) {
+        value = 0;
+        for(int q=0, bit=0; q<qubits; q++)
+            if((large_mask >> q) & 1)
+                value |= ((i >> q) & 1) << bit++;
+        expected_large[value] += simulation->probabilities[i];
+
+        value = 0;
+        for(int q=0, bit=0; q<qubits; q++)
+            if((small_mask >> q) & 1)
+                value |= ((i >> q) & 1) << bit++;
+        expected_small[value] += simulation->probabilities[i];
+    }
+
+    // when
+    marginal(large_mask, large, simulation);
+    marginal(small_mask, small, simulation);
+
+    // then
+    for(size_t v=0; v<num_large; v++)
+        assert(fabs(large[v] - expected_large[v]) < 1e-9);
+    for(size_t v=0; v<num_small; v++)
+        assert(fabs(small[v] - expected_small[v]) < 1e-9);
+
+    deallocate_resources(simulation);
+    free(large);
+    free(expected_large);
+
+    printf("Pass\n");
+}
+
+void test_sampling()
+{
+    printf("Testing sampling: ");
+
+    // given
+    const int qubits = 10;
+    const size_t shots = 80000, mask = 1 | (1 << 7) | (1 << 9);
+    SampleCount *counts = (SampleCount *) malloc(sizeof(SampleCount)*shots);
+    SampleCount *repeated = (SampleCount *) malloc(sizeof(SampleCount)*shots);
+    size_t total = 0;
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    options.num_threads = 4;
+    Simulation *simulation = set_up_simulation_with_options(&options);
+
+    initialise_qubits(qubits, simulation);
+    apply_gate(0, hadamard, simulation);
+    apply_gate(7, hadamard, simulation);
+    apply_gate(9, hadamard, simulation);
+    apply_gate(4, x, simulation);
+
+    // when
+    size_t num_states = sample(shots, 42, counts, simulation);
+
+    // then
+    assert(num_states == 8);
+    assert(sample(shots, 42, repeated, simulation) == num_states);
+    for(size_t i=0; i<num_states; i++) {
+        total += counts[i].count;
+        assert(counts[i].index == repeated[i].index);
+        assert(counts[i].count == repeated[i].count);
+        assert(i == 0 || counts[i].index > counts[i-1].index);
+        assert((counts[i].index & ~mask) == (1 << 4));
+        assert(counts[i].count > shots/8 - 600 && counts[i].count < shots/8 + 600);
+    }
+    assert(total == shots);
+
+    assert(sample(1, 7, counts, simulation) == 1);
+    assert(counts[0].count == 1);
+
+    free(counts);
+    free(repeated);
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+void test_measure_qubit()
+{
+    printf("Testing measure qubit: ");
+
+    // given
+    const int qubits = 6, runs = 200;
+    double state[2 << 6], norm;
+    int first, second, ones = 0;
+    unsigned long long rng_state = 7;
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    options.precision = PRECISION_DOUBLE;
+    Simulation *simulation;
+
+    for(int r=0; r<runs; r++) {
+        simulation = set_up_simulation_with_options(&options);
+        initialise_qubits(qubits, simulation);
+        apply_gate(1, hadamard, simulation);
+        apply_controlled_gate(4, 1, x, simulation);
+        apply_gate(3, x, simulation);
+
+        // when
+        first = measure_qubit(1, &rng_state, simulation);
+        second = measure_qubit(4, &rng_state, simulation);
+
+        // then
+        assert(first == second);
+        assert(measure_qubit(3, &rng_state, simulation) == 1);
+        assert(measure_qubit(0, &rng_state, simulation) == 0);
+        ones += first;
+
+        test_state_vector(state, simulation);
+        norm = 0;
+        for(size_t i=0; i<simulation->num_amp; i++) {
+            norm += state[2*i]*state[2*i] + state[2*i+1]*state[2*i+1];
+            if(i == (size_t) ((1 << 3) | (first ? (1 << 1) | (1 << 4) : 0)))
+                assert(fabs(state[2*i] - 1) < 1e-12);
+            else
+                assert(state[2*i] == 0 && state[2*i+1] == 0);
+        }
+        assert(fabs(norm - 1) < 1e-12);
+
+        deallocate_resources(simulation);
+    }
+    assert(ones > runs/4 && ones < 3*runs/4);
+
+    printf("Pass\n");
+}
+
+void test_expectation()
+{
+    printf("Testing expectation: ");
+
+    // given
+    const int qubits = 9;
+    const char *strings[] = {"ZIIIIIIII", "ZZIIIIIII", "XIIIIIIIX", "YIIIIIIIY",
+        "XIZIIIIIY", "IYXZIIIII", "IIIIIIIII", "YYYIIIZIX"};
+    const int num_terms = sizeof(strings)/sizeof(strings[0]);
+    double ry[8] = {cos(0.3), 0, -sin(0.3), 0, sin(0.3), 0, cos(0.3), 0};
+    double phase[8] = {1, 0, 0, 0, 0, 0, cos(0.7), sin(0.7)};
+    double state[2 << 9], coefficients[8], expected = 0, sum_re, sign, value;
+    PauliTerm terms[8];
+    int num_y;
+    size_t partner;
+    SimulationOptions options = default_simulation_options();
+    options.backend = BACKEND_CPU;
+    options.precision = PRECISION_DOUBLE;
+    options.num_threads = 4;
+    Simulation *simulation = set_up_simulation_with_options(&options);
+
+    initialise_qubits(qubits, simulation);
+    for(int i=0; i<qubits; i++) {
+        apply_gate(i, i % 2 ? hadamard : ry, simulation);
+        apply_controlled_gate((i+1) % qubits, i, phase, simulation);
+        apply_controlled_gate((i+2) % qubits, i, x, simulation);
+    }
+    test_state_vector(state, simulation);
+
+    // Sum <state|P|state> term by term, P|j> = i^|y| (-1)^|j&z| |j^x>
+    for(int t=0; t<num_terms; t++) {
+        terms[t] = pauli_term(strings[t]);
+        coefficients[t] = 0.5 + t;
+        sum_re = 0;
+        num_y = 0;
+        for(size_t y=terms[t].x_mask & terms[t].z_mask; y; y &= y-1)
+            num_y++;
+        for(size_t j=0; j<simulation->num_amp; j++) {
+            partner = j ^ terms[t].x_mask;
+            sign = 1;
+            for(size_t bits=j & terms[t].z_mask; bits; bits &= bits-1)
+                sign = -sign;
+            switch(num_y % 4) {
+                case 0: sum_re += sign*(state[2*partner]*state[2*j] +
+                    state[2*partner+1]*state[2*j+1]); break;
+                case 1: sum_re -= sign*(state[2*partner]*state[2*j+1] -
+                    state[2*partner+1]*state[2*j]); break;
+                case 2: sum_re -= sign*(state[2*partner]*state[2*j] +
+                    state[2*partner+1]*state[2*j+1]); break;
+                default: sum_re += sign*(state[2*partner]*state[2*j+1] -
+                    state[2*partner+1]*state[2*j]);
+            }
+        }
+        expected += coefficients[t]*sum_re;
+    }
+
+    // when
+    value = expectation(num_terms, terms, coefficients, simulation);
+
+    // then
+    assert(fabs(value - expected) < 1e-10);
+    assert(fabs(expectation(1, &terms[6], coefficients, simulation) - 0.5) < 1e-12);
+
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+void test_max_qubits()
+{
+    printf("Testing max qubits: ");
+
+    // given
+    SimulationOptions options = default_simulation_options();
+    Simulation *simulation;
+    int single_qubits, double_qubits;
+
+    options.backend = BACKEND_CPU;
+    options.precision = PRECISION_SINGLE;
+    simulation = set_up_simulation_with_options(&options);
+
+    // when
+    simulation->host_mem_size = 24ULL << 34;
+    single_qubits = max_qubits(simulation);
+    simulation->precision = PRECISION_DOUBLE;
+    double_qubits = max_qubits(simulation);
+
+    // then
+    assert(single_qubits == 34);
+    assert(double_qubits == 33);
+
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+#ifdef OPENCL
+/**
+ * @brief Sets up a simulation on any OpenCL device.
+ * @param options The options of the simulation, whose backend and device type
+ * are overridden
+ * @return The simulation, or NULL if no OpenCL device is available
+ */
+Simulation *set_up_opencl_simulation(SimulationOptions *options)
+{
+    Simulation *simulation;
+
+    options->backend = BACKEND_DEFAULT;
+    options->device_type = DEVICE_ALL;
+    simulation = set_up_simulation_with_options(options);
+
+    if(simulation->backend != BACKEND_OPENCL) {
+        deallocate_resources(simulation);
+        return NULL;
+    }
+
+    return simulation;
+}
+
+/**
+ * @brief Checks that two simulations hold the same state.
+ * @param expected The simulation holding the expected state
+ * @param actual The simulation to check
+ * @param tolerance The largest difference allowed in each real
+ */
+void assert_same_state(Simulation *expected, Simulation *actual, double tolerance)
+{
+    double *expected_state = (double *) malloc(sizeof(double)*2*expected->num_amp);
+    double *actual_state = (double *) malloc(sizeof(double)*2*actual->num_amp);
+
+    assert(expected->num_amp == actual->num_amp);
+    test_state_vector(expected_state, expected);
+    test_state_vector(actual_state, actual);
+    for(size_t i=0; i<2*expected->num_amp; i++)
+        assert(fabs(expected_state[i] - actual_state[i]) < tolerance);
+
+    free(expected_state);
+    free(actual_state);
+}
+
+/**
+ * @brief Builds a list of gates of every class on every qubit.
+ * @param qubits The number of qubits
+ * @return The list of gates
+ */
+OperationList *build_test_list(int qubits)
+{
+    double phase[8] = {1, 0, 0, 0, 0, 0, 0.6, 0.8};
+    double rotation[8] = {0.6, 0, -0.8, 0, 0.8, 0, 0.6, 0};
+    size_t control_mask;
+    OperationList *list = initialise_operation_list();
+
+    for(int i=0; i<qubits; i++)
+        append_gate(i, hadamard, list);
+    for(int i=0; i<qubits; i++) {
+        control_mask = ((size_t) 0x15 << ((i+1) % (qubits-5))) & ~((size_t) 1 << i);
+        append_gate((5*i) % qubits, phase, list);
+        append_controlled_gate((i+3) % qubits, i, x, list);
+        append_gate((7*i+2) % qubits, rotation, list);
+        append_double_controlled_gate(i % 6, (i+1) % qubits, (i+9) % qubits, phase,
+            list);
+        append_multi_controlled_gate(i, control_mask, rotation, list);
+    }
+
+    return list;
+}
+
+/**
+ * @brief Applies layers of gates of every class and number of controls. Ten
+ * layers repeat each gate configuration often enough for OpenCL to specialise
+ * it.
+ * @param qubits The number of qubits
+ * @param layers The number of layers
+ * @param simulation The simulation on which to apply the gates
+ */
+void apply_test_layers(int qubits, int layers, Simulation *simulation)
+{
+    double rotation[8] = {0.6, 0, -0.8, 0, 0.8, 0, 0.6, 0};
+    double phase[8] = {1, 0, 0, 0, 0, 0, 0.6, 0.8};
+    size_t control_mask;
+
+    for(int layer=0; layer<layers; layer++)
+        for(int i=0; i<qubits; i++) {
+            control_mask = ((size_t) 0xB << ((i+1) % (qubits-4))) & ~((size_t) 1 << i);
+            apply_gate(i, layer % 2 ? rotation : hadamard, simulation);
+            apply_controlled_gate((i+1) % qubits, i, phase, simulation);
+            apply_controlled_gate((i+layer+1) % qubits, i, x, simulation);
+            apply_double_controlled_gate(i, (i+2) % qubits, (i+5) % qubits, rotation,
+                simulation);
+            apply_multi_controlled_gate(i, control_mask, layer % 3 ? phase : x,
+                simulation);
+        }
+}
+
+void test_opencl_tiles()
+{
+    printf("Testing OpenCL tiles: ");
+
+    // given
+    const int qubits = 17;
+    OperationList *list = build_test_list(qubits);
+    SimulationOptions options = default_simulation_options();
+    Simulation *expected, *tiled, *untiled;
+
+    options.backend = BACKEND_CPU;
+    options.precision = PRECISION_DOUBLE;
+    expected = set_up_simulation_with_options(&options);
+    initialise_qubits(qubits, expected);
+    for(int i=0; i<list->num_operations; i++)
+        apply_operation(&list->operations[i], expected);
+
+    options = default_simulation_options();
+    tiled = set_up_opencl_simulation(&options);
+    options = default_simulation_options();
+    untiled = set_up_opencl_simulation(&options);
+    if(!tiled || !untiled) {
+        if(tiled)
+            deallocate_resources(tiled);
+        if(untiled)
+            deallocate_resources(untiled);
+        deallocate_resources(expected);
+        free_operation_list(list);
+        printf("Skipped, no OpenCL device\n");
+        return;
+    }
+    // No tile holds a gate, so each one is fused and applied on its own
+    untiled->block_qubits = 0;
+
+    // when
+    initialise_qubits(qubits, tiled);
+    initialise_qubits(qubits, untiled);
+    apply_operation_list(list, tiled);
+    apply_operation_list(list, untiled);
+
+    // then
+    assert(tiled->block_qubits > 0);
+    assert_same_state(expected, tiled, 1e-4);
+    assert_same_state(expected, untiled, 1e-4);
+
+    deallocate_resources(expected);
+    deallocate_resources(tiled);
+    deallocate_resources(untiled);
+    free_operation_list(list);
+
+    printf("Pass\n");
+}
+
+void test_opencl_gate_lists()
+{
+    printf("Testing OpenCL gate lists: ");
+
+    // given
+    const int sizes[2] = {10, 14};
+    const int gate_list_qubits[2] = {16, 0};
+    SimulationOptions options;
+    Simulation *expected, *simulation;
+    OperationList *list;
+    bool tested = false;
+
+    for(int n=0; n<2; n++) {
+        const int qubits = sizes[n];
+
+        list = build_test_list(qubits);
+        options = default_simulation_options();
+        options.backend = BACKEND_CPU;
+        options.precision = PRECISION_DOUBLE;
+        expected = set_up_simulation_with_options(&options);
+        initialise_qubits(qubits, expected);
+        for(int i=0; i<list->num_operations; i++)
+            apply_operation(&list->operations[i], expected);
+
+        // Applies the list with the gate list kernel and without it
+        for(int path=0; path<2; path++) {
+            options = default_simulation_options();
+            options.gate_list_qubits = gate_list_qubits[path];
+            simulation = set_up_opencl_simulation(&options);
+            if(!simulation)
+                continue;
+
+            // when
+            initialise_qubits(qubits, simulation);
+            apply_operation_list(list, simulation);
+
+            // then
+            assert_same_state(expected, simulation, 1e-4);
+            deallocate_resources(simulation);
+            tested = true;
+        }
+
+        deallocate_resources(expected);
+        free_operation_list(list);
+    }
+
+    printf(tested ? "Pass\n" : "Skipped, no OpenCL device\n");
+}
+
+void test_opencl_marginals()
+{
+    printf("Testing OpenCL marginals: ");
+
+    // given
+    const int qubits = 14, k = 20;
+    const size_t scattered_mask = 1 | (1 << 3) | (1 << 7) | (1 << 11) | (1 << 13);
+    const size_t wide_mask = ((1 << 14) - 1) & ~(1 << 5);
+    double marginals[14], expected_marginals[14];
+    double registers[1 << 6], expected_registers[1 << 6];
+    double scattered[1 << 5], expected_scattered[1 << 5];
+    double *wide = (double *) malloc(sizeof(double)*(1 << 13));
+    double *expected_wide = (double *) malloc(sizeof(double)*(1 << 13));
+    double top_probabilities[20];
+    size_t top_indices[20];
+    SimulationOptions options = default_simulation_options();
+    Simulation *expected, *simulation;
+
+    options.backend = BACKEND_CPU;
+    options.precision = PRECISION_DOUBLE;
+    expected = set_up_simulation_with_options(&options);
+    options = default_simulation_options();
+    simulation = set_up_opencl_simulation(&options);
+    if(!simulation) {
+        deallocate_resources(expected);
+        free(wide);
+        free(expected_wide);
+        printf("Skipped, no OpenCL device\n");
+        return;
+    }
+
+    initialise_qubits(qubits, expected);
+    initialise_qubits(qubits, simulation);
+    apply_test_layers(qubits, 2, expected);
+    apply_test_layers(qubits, 2, simulation);
+
+    qubit_marginals(expected_marginals, expected);
+    register_marginal(3, 6, expected_registers, expected);
+    marginal(scattered_mask, expected_scattered, expected);
+    marginal(wide_mask, expected_wide, expected);
+    measure(expected);
+
+    // when
+    qubit_marginals(marginals, simulation);
+    register_marginal(3, 6, registers, simulation);
+    marginal(scattered_mask, scattered, simulation);
+    marginal(wide_mask, wide, simulation);
+    size_t num_top = top_k_states(k, top_indices, top_probabilities, simulation);
+
+    // then
+    assert(fabs(state_norm(simulation) - 1) < 1e-4);
+    for(int q=0; q<qubits; q++)
+        assert(fabs(marginals[q] - expected_marginals[q]) < 1e-4);
+    for(int v=0; v<(1 << 6); v++)
+        assert(fabs(registers[v] - expected_registers[v]) < 1e-5);
+    for(int v=0; v<(1 << 5); v++)
+        assert(fabs(scattered[v] - expected_scattered[v]) < 1e-5);
+    for(int v=0; v<(1 << 13); v++)
+        assert(fabs(wide[v] - expected_wide[v]) < 1e-6);
+
+    assert(num_top == (size_t) k);
+    for(int i=0; i<k; i++) {
+        assert(fabs(top_probabilities[i] - expected->probabilities[top_indices[i]]) < 1e-6);
+        assert(i == 0 || top_probabilities[i] <= top_probabilities[i-1]);
+    }
+    for(size_t i=0, above=0; i<expected->num_amp; i++) {
+        if(expected->probabilities[i] > top_probabilities[k-1] + 1e-6)
+            above++;
+        assert(above < (size_t) k);
+    }
+
+    free(wide);
+    free(expected_wide);
+    deallocate_resources(expected);
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+void test_opencl_partitions()
+{
+    printf("Testing OpenCL partitions: ");
+
+    // given
+    const int qubits = 14;
+    const Precision precisions[2] = {PRECISION_SINGLE, PRECISION_DOUBLE};
+    const double tolerances[2] = {1e-4, 1e-10};
+    SimulationOptions options = default_simulation_options();
+    Simulation *expected, *simulation;
+    bool tested = false;
+
+    options.backend = BACKEND_CPU;
+    options.precision = PRECISION_DOUBLE;
+    expected = set_up_simulation_with_options(&options);
+    initialise_qubits(qubits, expected);
+    apply_test_layers(qubits, 2, expected);
+
+    for(int p=0; p<2; p++) {
+        options = default_simulation_options();
+        options.precision = precisions[p];
+        options.num_partitions = 2;
+        simulation = set_up_opencl_simulation(&options);
+        if(!simulation)
+            continue;
+
+        // when
+        initialise_qubits(qubits, simulation);
+        apply_test_layers(qubits, 2, simulation);
+
+        // then
+        if(simulation->num_partitions == 2) {
+            assert_same_state(expected, simulation, tolerances[p]);
+            tested = true;
+        }
+        deallocate_resources(simulation);
+    }
+
+    deallocate_resources(expected);
+
+    printf(tested ? "Pass\n" : "Skipped, no OpenCL devices to partition\n");
+}
+
+void test_opencl_specialised_gates()
+{
+    printf("Testing OpenCL specialised gates: ");
+
+    // given
+    const int qubits = 14;
+    const Precision precisions[2] = {PRECISION_SINGLE, PRECISION_DOUBLE};
+    const double tolerances[2] = {1e-4, 1e-10};
+    SimulationOptions options = default_simulation_options();
+    Simulation *expected, *simulation;
+    bool tested = false;
+
+    options.backend = BACKEND_CPU;
+    options.precision = PRECISION_DOUBLE;
+    expected = set_up_simulation_with_options(&options);
+    initialise_qubits(qubits, expected);
+    apply_test_layers(qubits, 10, expected);
+
+    for(int p=0; p<2; p++) {
+        options = default_simulation_options();
+        options.precision = precisions[p];
+        options.specialised_kernels = true;
+        simulation = set_up_opencl_simulation(&options);
+        if(!simulation)
+            continue;
+
+        // when
+        initialise_qubits(qubits, simulation);
+        apply_test_layers(qubits, 10, simulation);
+
+        // then
+        assert(simulation->num_kernel_variants > 0);
+        assert_same_state(expected, simulation, tolerances[p]);
+        deallocate_resources(simulation);
+        tested = true;
+    }
+
+    deallocate_resources(expected);
+
+    printf(tested ? "Pass\n" : "Skipped, no OpenCL device\n");
+}
+
+void test_opencl_sampling()
+{
+    printf("Testing OpenCL sampling: ");
+
+    // given
+    const int qubits = 12;
+    const size_t shots = 80000;
+    double rotation[8] = {0.6, 0, -0.8, 0, 0.8, 0, 0.6, 0};
+    SampleCount *counts = (SampleCount *) malloc(sizeof(SampleCount)*shots);
+    SampleCount *expected_counts = (SampleCount *) malloc(sizeof(SampleCount)*shots);
+    size_t total = 0;
+    SimulationOptions options = default_simulation_options();
+    Simulation *expected, *simulation;
+
+    options.backend = BACKEND_CPU;
+    expected = set_up_simulation_with_options(&options);
+    options = default_simulation_options();
+    simulation = set_up_opencl_simulation(&options);
+    if(!simulation) {
+        deallocate_resources(expected);
+        free(counts);
+        free(expected_counts);
+        printf("Skipped, no OpenCL device\n");
+        return;
+    }
+
+    initialise_qubits(qubits, expected);
+    initialise_qubits(qubits, simulation);
+    for(int i=0; i<qubits; i+=3) {
+        apply_gate(i, i % 2 ? rotation : hadamard, expected);
+        apply_gate(i, i % 2 ? rotation : hadamard, simulation);
+    }
+    apply_gate(10, x, expected);
+    apply_gate(10, x, simulation);
+
+    // when
+    size_t num_states = sample(shots, 42, counts, simulation);
+    size_t expected_states = sample(shots, 42, expected_counts, expected);
+
+    // then
+    assert(num_states == expected_states);
+    for(size_t i=0; i<num_states; i++) {
+        total += counts[i].count;
+        assert(counts[i].index == expected_counts[i].index);
+        assert(counts[i].count + 10 > expected_counts[i].count &&
+            counts[i].count < expected_counts[i].count + 10);
+    }
+    assert(total == shots);
+
+    assert(sample(1, 7, counts, simulation) == 1);
+    assert(counts[0].count == 1);
+
+    free(counts);
+    free(expected_counts);
+    deallocate_resources(expected);
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+
+void test_opencl_async_reinitialise()
+{
+    printf("Testing OpenCL async reinitialise: ");
+
+    // given
+    const int sizes[3] = {6, 12, 4};
+    SimulationOptions options = default_simulation_options();
+    Simulation *simulation = set_up_opencl_simulation(&options);
+    AsyncResult *front, *back;
+    const double *front_probabilities, *back_probabilities;
+
+    if(!simulation) {
+        printf("Skipped, no OpenCL device\n");
+        return;
+    }
+
+    for(int s=0; s<3; s++) {
+        const int qubits = sizes[s];
+
+        initialise_qubits(qubits, simulation);
+        for(int i=0; i<qubits; i++)
+            apply_gate(i, hadamard, simulation);
+
+        // when
+        front = measure_async(NULL, NULL, simulation);
+        back = measure_async(NULL, NULL, simulation);
+
+        // then
+        front_probabilities = wait_result(front);
+        back_probabilities = wait_result(back);
+        for(int i=0; i<(1 << qubits); i++) {
+            assert(fabs(front_probabilities[i] - 1.0/(1 << qubits)) < 1e-5);
+            assert(fabs(back_probabilities[i] - 1.0/(1 << qubits)) < 1e-5);
+        }
+
+        free_result(front);
+        free_result(back);
+    }
+
+    deallocate_resources(simulation);
+
+    printf("Pass\n");
+}
+#endif
 
 int main()
 {
     printf("\033[1;32m");
 
     test_simple_simulation();
+    test_threaded_cpu_simulation();
+    test_cache_blocked_simulation();
+    test_double_precision_simulation();
+    test_multi_controlled_gate();
+    test_deferred_simulation();
+    test_deferred_reinitialise();
+    test_max_qubits();
+    test_async_results();
+    test_reductions();
+    test_large_marginal();
+    test_sampling();
+    test_measure_qubit();
+    test_expectation();
+#ifdef OPENCL
+    test_opencl_tiles();
+    test_opencl_gate_lists();
+    test_opencl_marginals();
+    test_opencl_partitions();
+    test_opencl_specialised_gates();
+    test_opencl_sampling();
+    test_opencl_async_reinitialise();
+#endif
     
     printf("\033[0m");
 }
@@ -0,0 +1,214 @@
+#define _POSIX_C_SOURCE 200809L
+#define MIN_PARALLEL_SIZE 4096
+
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct Worker
+{
+    ThreadPool *pool;
+    int id;
+} Worker;
+
+/**
+ * @brief Returns the number of processors currently online.
+ * @return The number of online processors, at least 1
+ */
+int get_num_processors()
+{
+    long num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return num_processors < 1 ? 1 : (int) num_processors;
+}
+
+/**
+ * @brief Main loop of a worker thread.
+ * Waits for a new generation of work, runs its share of the range and
+ * reports back to the thread which called run_parallel().
+ * @param data The Worker describing the pool and the worker's index
+ * @return NULL once the pool is shut down
+ */
+static void *run_worker(void *data)
+{
+    Worker *worker = (Worker *) data;
+    ThreadPool *pool = worker->pool;
+    int id = worker->id;
+    unsigned long generation = 0;
+    ThreadTask task;
+    void *arg;
+    size_t size, start, end;
+
+    free(worker);
+
+    while(true) {
+        pthread_mutex_lock(&pool->lock);
+        while(pool->generation == generation && !pool->shutdown)
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+
+        if(pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        generation = pool->generation;
+        task = pool->task;
+        arg = pool->arg;
+        size = pool->size;
+        pthread_mutex_unlock(&pool->lock);
+
+        start = size*id/pool->num_threads;
+        end = size*(id+1)/pool->num_threads;
+        if(start < end)
+            task(start, end, arg);
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->remaining == 0)
+            pthread_cond_signal(&pool->work_done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/**
+ * @brief Creates a pool of persistent worker threads.
+ * The calling thread takes part in every parallel run, so num_threads-1
+ * threads are spawned.
+ * @param num_threads The total number of threads to run work on, uses the
+ * number of online processors if less than 1
+ * @return The initialised thread pool
+ */
+ThreadPool *initialise_thread_pool(int num_threads)
+{
+    ThreadPool *pool;
+    Worker *worker;
+
+    if(num_threads < 1)
+        num_threads = get_num_processors();
+
+    pool = (ThreadPool *) malloc(sizeof(ThreadPool));
+    if(!pool) {
+        fprintf(stderr, "error: unable to initialise ThreadPool.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pool->num_threads = num_threads;
+    pool->task = NULL;
+    pool->arg = NULL;
+    pool->size = 0;
+    pool->remaining = 0;
+    pool->generation = 0;
+    pool->shutdown = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    pool->threads = (pthread_t *) malloc(sizeof(pthread_t)*num_threads);
+    if(!pool->threads) {
+        fprintf(stderr, "error: unable to initialise ThreadPool.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i=1; i<num_threads; i++) {
+        worker = (Worker *) malloc(sizeof(Worker));
+        worker->pool = pool;
+        worker->id = i;
+
+        if(pthread_create(&pool->threads[i], NULL, run_worker, worker)) {
+            perror("Couldn't create worker thread");
+            exit(1);
+        }
+    }
+
+    return pool;
+}
+
+/**
+ * @brief Stops all worker threads and frees the pool.
+ * @param pool The thread pool to be freed
+ */
+void free_thread_pool(ThreadPool *pool)
+{
+    if(!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i=1; i<pool->num_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->threads);
+    free(pool);
+}
+
+/**
+ * @brief Runs a task over [0, size) on every thread of the pool.
+ * @param pool The thread pool to run on
+ * @param task The task to run on each sub-range
+ * @param size The size of the range
+ * @param arg The argument shared by all calls to task
+ */
+static void dispatch(ThreadPool *pool, ThreadTask task, size_t size, void *arg)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->size = size;
+    pool->remaining = pool->num_threads-1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    task(0, size/pool->num_threads, arg);
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->remaining > 0)
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Runs a task over the range [0, size) split evenly across the pool.
+ * Blocks until every thread has finished its share. Small ranges are run
+ * on the calling thread alone as waking the workers would cost more than
+ * the work itself.
+ * @param pool The thread pool to run on, may be NULL to run serially
+ * @param task The task to run on each sub-range
+ * @param size The size of the range
+ * @param arg The argument shared by all calls to task
+ */
+void run_parallel(ThreadPool *pool, ThreadTask task, size_t size, void *arg)
+{
+    if(!pool || pool->num_threads == 1 || size < MIN_PARALLEL_SIZE) {
+        task(0, size, arg);
+        return;
+    }
+
+    dispatch(pool, task, size, arg);
+}
+
+/**
+ * @brief Runs a task over a range of large blocks split across the pool.
+ * Unlike run_parallel() the range is split however small it is, for tasks
+ * where each index stands for a large amount of work.
+ * @param pool The thread pool to run on, may be NULL to run serially
+ * @param task The task to run on each sub-range of blocks
+ * @param size The number of blocks
+ * @param arg The argument shared by all calls to task
+ */
+void run_parallel_blocks(ThreadPool *pool, ThreadTask task, size_t size, void *arg)
+{
+    if(!pool || pool->num_threads == 1 || size < 2) {
+        task(0, size, arg);
+        return;
+    }
+
+    dispatch(pool, task, size, arg);
+}
@@ -0,0 +1,32 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** A task run over the index range [start, end) with a shared argument */
+typedef void (*ThreadTask)(size_t, size_t, void *);
+
+typedef struct ThreadPool
+{
+    int num_threads;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    ThreadTask task;
+    void *arg;
+    size_t size;
+    int remaining;
+    unsigned long generation;
+    bool shutdown;
+} ThreadPool;
+
+int get_num_processors(void);
+ThreadPool *initialise_thread_pool(int);
+void free_thread_pool(ThreadPool *);
+void run_parallel(ThreadPool *, ThreadTask, size_t, void *);
+void run_parallel_blocks(ThreadPool *, ThreadTask, size_t, void *);
+
+#endif